@@ -20,13 +20,12 @@
 #include <android-base/logging.h>
 
 #include <fstream>
-#include <regex>
 #include <unordered_map>
 
 namespace android::hardware::thermal::V2_0::implementation {
 
-CoolDevice::CoolDevice(std::string&& iSysFileName) noexcept
-    : ThermalDeviceDir(std::move(iSysFileName)) {
+CoolDevice::CoolDevice(std::string&& iSysFileName, const char* iBasePath) noexcept
+    : ThermalDeviceDir(std::move(iSysFileName), iBasePath) {
     std::string typeName;
 
     // Unfortunately, cannot use _dev.name directly (hidl_string);
@@ -35,13 +34,7 @@ CoolDevice::CoolDevice(std::string&& iSysFileName) noexcept
     _dev.name = std::move(typeName);
     _dev.type = mapSysfsToCoolingType(_dev.name);
     _dev.value = 0;
-}
-
-// CoolingDevice_1_0 conversion operator. Cannot handle some v2.0 cooling types
-CoolDevice::operator CoolingDevice_1_0() const {
-    return CoolingDevice_1_0{.type = static_cast<CoolingType_1_0>(_dev.type),
-                             .name = _dev.name,
-                             .currentValue = static_cast<float>(_dev.value)};
+    _stateFd = openFile("cur_state");
 }
 
 CoolingType CoolDevice::mapSysfsToCoolingType(const std::string& sysTypeName) {
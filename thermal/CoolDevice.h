@@ -29,20 +29,20 @@ using CoolingType_1_0 = ::android::hardware::thermal::V1_0::CoolingType;
 static_assert(static_cast<std::underlying_type_t<CoolingType_1_0>>(CoolingType_1_0::FAN_RPM) ==
               static_cast<std::underlying_type_t<CoolingType>>(CoolingType::FAN));
 
-// Describes a cooling device
+// Describes a cooling device, its readings being kept by CoolingTable
 class CoolDevice : public ThermalDeviceDir {
    public:
-    CoolDevice(std::string&& iSysFileName) noexcept;
+    // Cooling device <iBasePath><iSysFileName>, the benchmarks using their own mock sysfs
+    CoolDevice(std::string&& iSysFileName, const char* iBasePath = _sysThermalPath) noexcept;
 
     CoolingDevice _dev;  // Unfortunately, CoolingDevice struct is 'final'
 
-    // CoolingDevice_1_0 conversion operator.Cannot handle some v2.0 cooling types
-    operator CoolingDevice_1_0() const;
-
-    // Gets the current zone's temperature
-    void readValue() { getInputStream("cur_state") >> _dev.value; }
+    int getStateFd() const { return _stateFd; }
 
    private:
+    // Kept opened for periodic readings
+    android::base::unique_fd _stateFd;
+
     /* Maps a cooling type(CPU, BATTERY, ...) to a given sensor type name
        (contained in /sys/class/cooling_device[0-9]+/type, e.g fan, processor, ... */
     static CoolingType mapSysfsToCoolingType(const std::string& sysTypeName);
@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CpuSampler.h"
+
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/properties.h>
+#include <android-base/strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <thread>
+
+#include "Scheduling.h"
+
+namespace android::hardware::thermal::V2_0::implementation {
+
+static constexpr char kSamplePeriodProperty[] = "ro.vendor.thermal.cpu_sample_ms";
+// Comma separated averaging windows, in ms
+static constexpr char kWindowsProperty[] = "ro.vendor.thermal.cpu_windows_ms";
+
+bool CpuSampler::init() {
+    using android::base::GetUintProperty;
+
+    _period = std::chrono::milliseconds(
+        std::max<uint32_t>(GetUintProperty<uint32_t>(kSamplePeriodProperty, _period.count()), 1));
+
+    const std::string windows = android::base::GetProperty(kWindowsProperty, "");
+    if (!windows.empty()) {
+        std::vector<uint32_t> windowsMs;
+
+        for (const auto& window : android::base::Split(windows, ",")) {
+            uint32_t ms;
+
+            if (android::base::ParseUint(android::base::Trim(window), &ms) && ms)
+                windowsMs.push_back(ms);
+            else
+                LOG(ERROR) << __FUNCTION__ << " - Invalid window " << window << "\n";
+        }
+        if (!windowsMs.empty()) _windowsMs = std::move(windowsMs);
+    }
+    std::sort(_windowsMs.begin(), _windowsMs.end());
+
+    const long cpuCount = std::max(sysconf(_SC_NPROCESSORS_CONF), 1l);
+    _cpuNames.resize(cpuCount);
+    for (long cpu = 0; cpu < cpuCount; ++cpu) _cpuNames[cpu] = "cpu" + std::to_string(cpu);
+
+    // Enough samples to cover the longest window, whatever the sampling jitter
+    _history.resize(_windowsMs.back() / _period.count() + 2);
+    for (auto& sample : _history) sample.cpus.resize(cpuCount);
+    _latest.cpus.resize(cpuCount);
+
+    _statFd.reset(open(_kProcStatPath, O_RDONLY | O_CLOEXEC));
+    if (_statFd < 0) {
+        LOG(ERROR) << __FUNCTION__ << " - Unable to open " << _kProcStatPath << "("
+                   << strerror(errno) << ")\n";
+        return false;
+    }
+
+    std::thread(&CpuSampler::samplerFunc, this).detach();
+    return true;
+}
+
+bool CpuSampler::getUsages(std::vector<CpuUsage>* ioUsages) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    const auto now = getBootTime();
+    const Sample* sample = nullptr;
+
+    if (_count && now - _history[_newest].time < _period)
+        sample = &_history[_newest];
+    else if (_latest.time.count() && now - _latest.time < _period)
+        sample = &_latest;
+    else if (parse(&_latest))
+        sample = &_latest;
+    else
+        return false;
+
+    if (ioUsages->size() != _cpuNames.size()) {
+        ioUsages->resize(_cpuNames.size());
+        for (size_t cpu = 0; cpu < _cpuNames.size(); ++cpu)
+            (*ioUsages)[cpu].name.setToExternal(_cpuNames[cpu].c_str(), _cpuNames[cpu].size());
+    }
+    for (size_t cpu = 0; cpu < _cpuNames.size(); ++cpu) {
+        const Counters& counters = sample->cpus[cpu];
+
+        (*ioUsages)[cpu].active = counters.active;
+        (*ioUsages)[cpu].total = counters.total;
+        (*ioUsages)[cpu].isOnline = counters.isOnline;
+    }
+    return true;
+}
+
+bool CpuSampler::getUtilization(hidl_vec<uint32_t>* oWindowsMs,
+                                std::vector<CpuUtilization>* ioCpus) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _lastQuery = getBootTime();
+    if (!_running) {
+        _running = true;
+        _wakeup.notify_one();
+    }
+    // The very first caller doesn't wait for the sampling thread
+    if (!_count) {
+        if (!parse(&_history[_newest])) return false;
+        _count = 1;
+    }
+
+    const Sample& newest = _history[_newest];
+    oWindowsMs->setToExternal(_windowsMs.data(), _windowsMs.size());
+    if (ioCpus->size() != _cpuNames.size()) {
+        ioCpus->resize(_cpuNames.size());
+        for (size_t cpu = 0; cpu < _cpuNames.size(); ++cpu) {
+            (*ioCpus)[cpu].name.setToExternal(_cpuNames[cpu].c_str(), _cpuNames[cpu].size());
+            (*ioCpus)[cpu].utilization.resize(_windowsMs.size());
+        }
+    }
+    for (size_t cpu = 0; cpu < _cpuNames.size(); ++cpu)
+        (*ioCpus)[cpu].isOnline = newest.cpus[cpu].isOnline;
+
+    for (size_t w = 0; w < _windowsMs.size(); ++w) {
+        const Sample& start = getWindowStart(std::chrono::milliseconds(_windowsMs[w]));
+
+        for (size_t cpu = 0; cpu < _cpuNames.size(); ++cpu) {
+            const Counters& end = newest.cpus[cpu];
+            /* Without any earlier reading of the CPU, the window starts at boot, when the
+               counters were null */
+            const Counters begin =
+                &start != &newest && start.cpus[cpu].isOnline ? start.cpus[cpu] : Counters{};
+            const uint64_t total = end.total - begin.total;
+
+            (*ioCpus)[cpu].utilization[w] =
+                end.isOnline && total ? 100.f * (end.active - begin.active) / total : 0;
+        }
+    }
+
+    return true;
+}
+
+void CpuSampler::samplerFunc() {
+    const std::chrono::milliseconds idleTimeout(2 * _windowsMs.back());
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (true) {
+        _wakeup.wait(lock, [this] { return _running; });
+
+        const size_t next = (_newest + 1) % _history.size();
+        if (parse(&_history[next])) {
+            _newest = next;
+            _count = std::min(_count + 1, _history.size());
+        }
+
+        // Nobody is interested anymore, the windows will be filled again from scratch
+        if (getBootTime() - _lastQuery > idleTimeout) {
+            LOG(INFO) << __FUNCTION__ << " - No more client, sampling stopped\n";
+            _running = false;
+            _count = 0;
+            continue;
+        }
+        _wakeup.wait_for(lock, _period);
+    }
+}
+
+bool CpuSampler::parse(Sample* oSample) {
+    // Only the leading cpu lines are needed, not the interrupts following them
+    char buffer[8192];
+    const ssize_t len = TEMP_FAILURE_RETRY(pread(_statFd, buffer, sizeof(buffer) - 1, 0));
+
+    if (len <= 0) {
+        LOG(ERROR) << __FUNCTION__ << " - Unable to read " << _kProcStatPath << "("
+                   << strerror(errno) << ")\n";
+        return false;
+    }
+    buffer[len] = '\0';
+
+    oSample->time = getBootTime();
+    // Offline CPUs have no line
+    for (auto& counters : oSample->cpus) counters = {};
+
+    // Lines look like "cpuN user nice system idle iowait ...", after the "cpu " total one
+    for (const char* line = buffer; !strncmp(line, "cpu", 3);) {
+        char* end;
+        const unsigned long cpu = strtoul(line + 3, &end, 10);
+
+        if (isdigit(line[3]) && cpu < oSample->cpus.size()) {
+            uint64_t fields[4];
+            for (auto& field : fields) field = strtoull(end, &end, 10);
+
+            Counters& counters = oSample->cpus[cpu];
+            counters.active = fields[0] + fields[1] + fields[2];
+            counters.total = counters.active + fields[3];
+            counters.isOnline = true;
+        }
+
+        line = strchr(line, '\n');
+        if (!line++) break;
+    }
+
+    return true;
+}
+
+const CpuSampler::Sample& CpuSampler::getWindowStart(std::chrono::nanoseconds iWindow) const {
+    const auto limit = _history[_newest].time - iWindow;
+    size_t index = _newest;
+
+    for (size_t i = 1; i < _count; ++i) {
+        index = (_newest + _history.size() - i) % _history.size();
+        if (_history[index].time <= limit) break;
+    }
+    return _history[index];
+}
+
+}  // namespace android::hardware::thermal::V2_0::implementation
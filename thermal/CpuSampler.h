@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CPU_SAMPLER_CPP__
+#define __CPU_SAMPLER_CPP__
+
+#include <android-base/unique_fd.h>
+#include <android/hardware/thermal/2.0/IThermal.h>
+#include <vendor/ti/hardware/thermal/1.0/IThermalExt.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+namespace android::hardware::thermal::V2_0::implementation {
+
+using ::android::hardware::thermal::V1_0::CpuUsage;
+using ::vendor::ti::hardware::thermal::V1_0::CpuUtilization;
+
+/* Samples /proc/stat on its own schedule, for any number of clients: one parsing per period
+   instead of one per client call. Runs only while clients query the utilization, and stops
+   after twice the longest window without any query. */
+class CpuSampler {
+   public:
+    static constexpr char _kProcStatPath[] = "/proc/stat";
+
+    // Reads the sampling settings, and opens /proc/stat
+    bool init();
+
+    /* Gets the cumulative usage of every CPU, from the latest sample if it's not older than the
+       sampling period. ioUsages is sized and named by the first call only, so that the following
+       ones don't allocate */
+    bool getUsages(std::vector<CpuUsage>* ioUsages);
+
+    /* Gets the utilization of every CPU over each window, and starts sampling if needed. Like
+       getUsages(), ioCpus is only sized by the first call, and oWindowsMs references our storage */
+    bool getUtilization(hidl_vec<uint32_t>* oWindowsMs, std::vector<CpuUtilization>* ioCpus);
+
+   private:
+    // Cumulative counters of a CPU, in jiffies
+    struct Counters {
+        uint64_t active;
+        uint64_t total;
+        bool isOnline;
+    };
+    struct Sample {
+        // CLOCK_BOOTTIME time of the parsing
+        std::chrono::nanoseconds time{0};
+        // Indexed by CPU number
+        std::vector<Counters> cpus;
+    };
+
+    std::chrono::milliseconds _period{1000};
+    std::vector<uint32_t> _windowsMs{1000, 5000, 60000};
+    std::vector<hidl_string> _cpuNames;
+
+    android::base::unique_fd _statFd;
+
+    // _mutex protects the fields below
+    std::mutex _mutex;
+    std::condition_variable _wakeup;
+    bool _running = false;
+    std::chrono::nanoseconds _lastQuery{0};
+    // Ring of the samples covering the longest window, _history[_newest] being the latest one
+    std::vector<Sample> _history;
+    size_t _newest = 0;
+    size_t _count = 0;
+    // Parsed for getUsages() when the ring holds nothing fresh enough
+    Sample _latest;
+
+    void samplerFunc();
+    // Parses /proc/stat into oSample
+    bool parse(Sample* oSample);
+    // Gets the latest sample taken at least iWindow before the newest one, else the oldest one
+    const Sample& getWindowStart(std::chrono::nanoseconds iWindow) const;
+};
+
+}  // namespace android::hardware::thermal::V2_0::implementation
+
+#endif  // #ifndef __CPU_SAMPLER_CPP__
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FlightRecorder.h"
+
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace android::hardware::thermal::V2_0::implementation {
+
+FlightRecorder::~FlightRecorder() {
+    close();
+}
+
+void FlightRecorder::close() {
+    if (_map) {
+        msync(_map, _mapSize, MS_SYNC);
+        munmap(_map, _mapSize);
+    }
+    _map = nullptr;
+    _header = nullptr;
+}
+
+bool FlightRecorder::open(const char* path, size_t size,
+                          const std::vector<FlightRecorderChannel>& channels) {
+    // The first block is used by the header
+    const size_t blockCount = std::max<size_t>(size / kFlightRecorderBlockSize, 1) - 1;
+
+    close();
+
+    if (channels.empty() || channels.size() > kFlightRecorderMaxChannels || blockCount < 2 ||
+        blockCount > UINT32_MAX) {
+        LOG(ERROR) << __FUNCTION__ << " - Unsupported geometry(" << channels.size()
+                   << " channels, " << size << " bytes)\n";
+        return false;
+    }
+
+    android::base::unique_fd fd(::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0660));
+    if (fd < 0) {
+        LOG(ERROR) << __FUNCTION__ << " - Unable to open " << path << "(" << strerror(errno)
+                   << ")\n";
+        return false;
+    }
+
+    struct stat fileStat;
+    _mapSize = kFlightRecorderBlockSize * (blockCount + 1);
+    if (fstat(fd, &fileStat) || (static_cast<size_t>(fileStat.st_size) != _mapSize &&
+                                 ftruncate(fd, _mapSize))) {
+        LOG(ERROR) << __FUNCTION__ << " - Unable to size " << path << "(" << strerror(errno)
+                   << ")\n";
+        return false;
+    }
+
+    void* map = mmap(nullptr, _mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == map) {
+        LOG(ERROR) << __FUNCTION__ << " - Unable to map " << path << "(" << strerror(errno)
+                   << ")\n";
+        return false;
+    }
+    _map = static_cast<uint8_t*>(map);
+    _header = reinterpret_cast<FlightRecorderHeader*>(_map);
+
+    bool compatible = !memcmp(_header->magic, kFlightRecorderMagic, sizeof(_header->magic)) &&
+                      _header->version == kFlightRecorderVersion &&
+                      _header->blockSize == kFlightRecorderBlockSize &&
+                      _header->blockCount == blockCount &&
+                      _header->channelCount == channels.size() &&
+                      !memcmp(_header->channels, channels.data(),
+                              channels.size() * sizeof(FlightRecorderChannel));
+
+    if (compatible) {
+        // Resumes after the most recent block, it was written before the previous shutdown
+        _sequence = 0;
+        _blockIndex = blockCount - 1;
+        for (uint32_t i = 0; i < blockCount; ++i) {
+            if (getBlock(i)->sequence > _sequence) {
+                _sequence = getBlock(i)->sequence;
+                _blockIndex = i;
+            }
+        }
+        LOG(INFO) << __FUNCTION__ << " - Resuming " << path << " after block " << _sequence
+                  << "\n";
+    } else {
+        LOG(INFO) << __FUNCTION__ << " - Formatting " << path << "\n";
+        memset(_map, 0, _mapSize);
+        memcpy(_header->magic, kFlightRecorderMagic, sizeof(_header->magic));
+        _header->version = kFlightRecorderVersion;
+        _header->blockSize = kFlightRecorderBlockSize;
+        _header->blockCount = blockCount;
+        _header->channelCount = channels.size();
+        memcpy(_header->channels, channels.data(), channels.size() * sizeof(FlightRecorderChannel));
+        _sequence = 0;
+        _blockIndex = blockCount - 1;
+        msync(_map, _mapSize, MS_SYNC);
+    }
+
+    // Readings of a new boot always start a new block
+    _header->tickCount = _header->tickTotalNs = _header->tickMaxNs = 0;
+    _unsyncedSamples = 0;
+    startBlock(0);
+
+    return true;
+}
+
+void FlightRecorder::startBlock(int64_t timeMs) {
+    _blockIndex = (_blockIndex + 1) % _header->blockCount;
+
+    FlightRecorderBlock* block = getBlock(_blockIndex);
+
+    // Invalidates the block first, a crash in between must not leave a half-reset block valid
+    block->sequence = 0;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    block->baseTimeMs = timeMs;
+    block->used = 0;
+    block->sampleCount = 0;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    block->sequence = ++_sequence;
+
+    _lastTimeMs = timeMs;
+    memset(_lastValues, 0, sizeof(_lastValues));
+}
+
+void FlightRecorder::record(int64_t timeMs, const int32_t* values, bool flush) {
+    if (!isOpen()) return;
+
+    timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    FlightRecorderBlock* block = getBlock(_blockIndex);
+    if (block->used + sizeof(FlightRecorderBlock) + kFlightRecorderMaxSampleSize >
+        kFlightRecorderBlockSize) {
+        startBlock(timeMs);
+        block = getBlock(_blockIndex);
+    } else if (!block->sampleCount) {
+        block->baseTimeMs = _lastTimeMs = timeMs;
+    }
+
+    uint8_t* out = reinterpret_cast<uint8_t*>(block + 1) + block->used;
+    size_t len = varintEncode(zigzagEncode(timeMs - _lastTimeMs), out);
+
+    for (uint32_t i = 0; i < _header->channelCount; ++i) {
+        len += varintEncode(zigzagEncode(static_cast<int64_t>(values[i]) - _lastValues[i]),
+                            out + len);
+        _lastValues[i] = values[i];
+    }
+    _lastTimeMs = timeMs;
+
+    // Publishes the sample only once fully written
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    block->used += len;
+    block->sampleCount++;
+
+    if (flush || ++_unsyncedSamples >= _kSyncPeriod) {
+        msync(_map, _mapSize, flush ? MS_SYNC : MS_ASYNC);
+        _unsyncedSamples = 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t elapsedNs = (end.tv_sec - start.tv_sec) * 1000000000ull + end.tv_nsec - start.tv_nsec;
+
+    _header->tickCount++;
+    _header->tickTotalNs += elapsedNs;
+    if (elapsedNs > _header->tickMaxNs) _header->tickMaxNs = elapsedNs;
+}
+
+}  // namespace android::hardware::thermal::V2_0::implementation
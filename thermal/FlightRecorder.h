@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __FLIGHT_RECORDER_CPP__
+#define __FLIGHT_RECORDER_CPP__
+
+#include <vector>
+
+#include "FlightRecorderFormat.h"
+
+namespace android::hardware::thermal::V2_0::implementation {
+
+/* Persistent ring of the latest sensor readings, kept in a memory mapped file so that the
+   readings leading to a critical shutdown survive it. See FlightRecorderFormat.h for the layout */
+class FlightRecorder {
+   public:
+    static constexpr char _kDefaultPath[] = "/data/vendor/thermal/flight_recorder.bin";
+
+    FlightRecorder() = default;
+    FlightRecorder(const FlightRecorder&) = delete;
+    FlightRecorder& operator=(const FlightRecorder&) = delete;
+    ~FlightRecorder();
+
+    /* Maps the ring file of the given size, keeping its content if it was written with the same
+       channels, formatting it otherwise */
+    bool open(const char* path, size_t size, const std::vector<FlightRecorderChannel>& channels);
+
+    bool isOpen() const { return _header != nullptr; }
+
+    /* Appends a sample made of one value per channel, in the channels order. Does nothing but
+       memory writes, unless flush is set or a periodic msync() is due */
+    void record(int64_t timeMs, const int32_t* values, bool flush);
+
+   private:
+    // Number of samples between two asynchronous msync()
+    static constexpr unsigned _kSyncPeriod = 12;
+
+    uint8_t* _map = nullptr;
+    size_t _mapSize = 0;
+    FlightRecorderHeader* _header = nullptr;
+
+    // Block being written and the state its next sample deltas are computed against
+    uint32_t _blockIndex = 0;
+    uint64_t _sequence = 0;
+    int64_t _lastTimeMs = 0;
+    int32_t _lastValues[kFlightRecorderMaxChannels] = {};
+    unsigned _unsyncedSamples = 0;
+
+    FlightRecorderBlock* getBlock(uint32_t index) const {
+        return reinterpret_cast<FlightRecorderBlock*>(
+            _map + kFlightRecorderBlockSize * (static_cast<size_t>(index) + 1));
+    }
+    // Moves to the next block of the ring, the oldest one
+    void startBlock(int64_t timeMs);
+    void close();
+};
+
+}  // namespace android::hardware::thermal::V2_0::implementation
+
+#endif  // #ifndef __FLIGHT_RECORDER_CPP__
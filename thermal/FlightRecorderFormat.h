@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __FLIGHT_RECORDER_FORMAT_H__
+#define __FLIGHT_RECORDER_FORMAT_H__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+/* Layout of the thermal flight recorder file, shared by the service and the host decoder.
+ *
+ * The file is a FlightRecorderHeader page followed by fixed-size blocks used as a ring. Each
+ * block starts with a FlightRecorderBlock header followed by samples:
+ *   zigzag varint(time delta in ms), then per channel zigzag varint(value delta)
+ * Deltas are computed against the previous sample of the same block, the first sample of a block
+ * being taken against 0, so that any block can be decoded on its own. Blocks are ordered by their
+ * sequence number, 0 meaning the block holds nothing.
+ */
+namespace android::hardware::thermal::V2_0::implementation {
+
+static constexpr char kFlightRecorderMagic[8] = {'T', 'I', 'T', 'H', 'R', 'E', 'C', '1'};
+static constexpr uint32_t kFlightRecorderVersion = 1;
+static constexpr uint32_t kFlightRecorderBlockSize = 4096;
+static constexpr size_t kFlightRecorderMaxChannels = 64;
+static constexpr size_t kFlightRecorderNameSize = 24;
+// Upper bound of a sample size: time delta plus one 32 bits value per channel
+static constexpr size_t kFlightRecorderMaxSampleSize = 10 + 5 * kFlightRecorderMaxChannels;
+
+enum class FlightRecorderChannelKind : uint8_t {
+    TEMPERATURE = 0,  // millidegrees Celsius
+    COOLING = 1,      // cooling device state
+};
+
+struct FlightRecorderChannel {
+    FlightRecorderChannelKind kind;
+    int8_t type;  // TemperatureType or CoolingType
+    char name[kFlightRecorderNameSize - 2];
+};
+
+struct FlightRecorderHeader {
+    char magic[sizeof(kFlightRecorderMagic)];
+    uint32_t version;
+    uint32_t blockSize;
+    uint32_t blockCount;
+    uint32_t channelCount;
+    // Cost of FlightRecorder::record(), in ns
+    uint64_t tickCount;
+    uint64_t tickTotalNs;
+    uint64_t tickMaxNs;
+    FlightRecorderChannel channels[kFlightRecorderMaxChannels];
+};
+
+struct FlightRecorderBlock {
+    uint64_t sequence;
+    // Wall clock time, in ms, the time deltas of the block samples are relative to
+    int64_t baseTimeMs;
+    // Bytes of samples written after this header
+    uint32_t used;
+    uint32_t sampleCount;
+};
+
+static_assert(sizeof(FlightRecorderHeader) <= kFlightRecorderBlockSize);
+static_assert(sizeof(FlightRecorderBlock) + kFlightRecorderMaxSampleSize <=
+              kFlightRecorderBlockSize);
+
+inline uint64_t zigzagEncode(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t zigzagDecode(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// Writes value as a LEB128 varint, returns the number of bytes written
+inline size_t varintEncode(uint64_t value, uint8_t* out) {
+    size_t len = 0;
+
+    while (value >= 0x80) {
+        out[len++] = static_cast<uint8_t>(value) | 0x80;
+        value >>= 7;
+    }
+    out[len++] = static_cast<uint8_t>(value);
+    return len;
+}
+
+// Reads a LEB128 varint from [in, end), returns the number of bytes read or 0 if truncated
+inline size_t varintDecode(const uint8_t* in, const uint8_t* end, uint64_t* value) {
+    size_t len = 0;
+
+    *value = 0;
+    for (unsigned shift = 0; in + len < end && shift < 64; shift += 7) {
+        uint8_t byte = in[len++];
+
+        *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return len;
+    }
+    return 0;
+}
+
+// Copies the header of a flight recorder file image, returns false if it is not one
+inline bool readFlightRecorderHeader(const uint8_t* data, size_t size,
+                                     FlightRecorderHeader* header) {
+    if (size < kFlightRecorderBlockSize) return false;
+
+    memcpy(header, data, sizeof(*header));
+    return !memcmp(header->magic, kFlightRecorderMagic, sizeof(header->magic)) &&
+           header->version == kFlightRecorderVersion &&
+           header->blockSize == kFlightRecorderBlockSize &&
+           header->channelCount <= kFlightRecorderMaxChannels &&
+           size >= static_cast<size_t>(header->blockCount + 1) * header->blockSize;
+}
+
+/* Calls onSample(sequence, timeMs, values) for each sample of a flight recorder file image read
+ * by readFlightRecorderHeader(), from the oldest block to the newest. Returns the number of
+ * blocks ending with a truncated sample, which is skipped.
+ */
+template <typename OnSample>
+size_t decodeFlightRecorder(const uint8_t* data, const FlightRecorderHeader& header,
+                            OnSample onSample) {
+    // Orders the written blocks from the oldest to the newest
+    std::vector<std::pair<uint64_t, const uint8_t*>> blocks;
+    for (uint32_t i = 0; i < header.blockCount; ++i) {
+        const uint8_t* block = data + static_cast<size_t>(i + 1) * header.blockSize;
+        FlightRecorderBlock blockHeader;
+
+        memcpy(&blockHeader, block, sizeof(blockHeader));
+        if (blockHeader.sequence) blocks.emplace_back(blockHeader.sequence, block);
+    }
+    std::sort(blocks.begin(), blocks.end());
+
+    size_t truncated = 0;
+    std::vector<int64_t> values(header.channelCount);
+    for (const auto& [sequence, block] : blocks) {
+        FlightRecorderBlock blockHeader;
+        memcpy(&blockHeader, block, sizeof(blockHeader));
+
+        const uint8_t* in = block + sizeof(FlightRecorderBlock);
+        const uint8_t* end =
+            in + std::min<size_t>(blockHeader.used, header.blockSize - sizeof(FlightRecorderBlock));
+        int64_t timeMs = blockHeader.baseTimeMs;
+        std::fill(values.begin(), values.end(), 0);
+
+        for (uint32_t s = 0; s < blockHeader.sampleCount; ++s) {
+            uint64_t raw;
+            size_t len = varintDecode(in, end, &raw);
+
+            in += len;
+            timeMs += zigzagDecode(raw);
+            for (uint32_t c = 0; c < header.channelCount && len; ++c) {
+                len = varintDecode(in, end, &raw);
+                in += len;
+                values[c] += zigzagDecode(raw);
+            }
+            if (!len) {
+                truncated++;
+                break;
+            }
+            onSample(sequence, timeMs, values);
+        }
+    }
+    return truncated;
+}
+
+}  // namespace android::hardware::thermal::V2_0::implementation
+
+#endif  // #ifndef __FLIGHT_RECORDER_FORMAT_H__
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MetricsExporter.h"
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+#include <cutils/sockets.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cinttypes>
+#include <thread>
+
+namespace android::hardware::thermal::V2_0::implementation {
+
+using ::android::base::StringAppendF;
+
+bool MetricsExporter::start() {
+    int fd = android_get_control_socket(_kSocketName);
+
+    if (fd < 0) {
+        LOG(INFO) << __FUNCTION__ << " - No " << _kSocketName << " socket, metrics disabled\n";
+        return false;
+    }
+    if (listen(fd, 4)) {
+        LOG(ERROR) << __FUNCTION__ << " - listen error(" << strerror(errno) << ")\n";
+        close(fd);
+        return false;
+    }
+    _socket.reset(fd);
+
+    std::thread(&MetricsExporter::serve, this).detach();
+    return true;
+}
+
+void MetricsExporter::publish(const ThermalSnapshot& snapshot) {
+    std::unique_lock<std::mutex> lock(_mutex, std::try_to_lock);
+
+    if (lock.owns_lock()) _published = snapshot;
+}
+
+void MetricsExporter::serve() {
+    ThermalSnapshot snapshot;
+    std::string text;
+
+    while (true) {
+        android::base::unique_fd client(
+            TEMP_FAILURE_RETRY(accept4(_socket, nullptr, nullptr, SOCK_CLOEXEC)));
+
+        if (client < 0) {
+            switch (errno) {
+                case ECONNABORTED:
+                    // The client went away before being accepted
+                    continue;
+                case EMFILE:
+                case ENFILE:
+                case ENOBUFS:
+                case ENOMEM:
+                    /* Out of resources, retrying right away would only spin and flood the log.
+                       The pending clients stay queued meanwhile */
+                    LOG(ERROR) << __FUNCTION__ << " - accept error(" << strerror(errno)
+                               << "), retrying in " << _kRetryDelay.count() << "s\n";
+                    std::this_thread::sleep_for(_kRetryDelay);
+                    continue;
+                default:
+                    LOG(ERROR) << __FUNCTION__ << " - accept error(" << strerror(errno)
+                               << "), metrics disabled\n";
+                    return;
+            }
+        }
+        // A stalled client must not hold the others forever
+        timeval timeout{.tv_sec = 1, .tv_usec = 0};
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        // Formats outside the lock, the monitoring thread must only wait for a copy
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            snapshot = _published;
+        }
+        text.clear();
+        format(snapshot, &text);
+        // A slow client only delays the others, never the sampling
+        if (!android::base::WriteStringToFd(text, client))
+            LOG(WARNING) << __FUNCTION__ << " - Client write error(" << strerror(errno) << ")\n";
+    }
+}
+
+void MetricsExporter::format(const ThermalSnapshot& snapshot, std::string* out) {
+    constexpr size_t severityCount =
+        std::tuple_size_v<decltype(ThermalSnapshot::Zone::severityTicks)>;
+
+    StringAppendF(out, "thermal_sample_timestamp_ms %" PRId64 "\n", snapshot.timeMs);
+    StringAppendF(out, "thermal_sample_ticks_total %" PRIu64 "\n", snapshot.ticks);
+
+    for (const auto& zone : snapshot.zones) {
+        const char* name = zone.name.c_str();
+        const std::string type = toString(zone.type);
+
+        StringAppendF(out, "thermal_temperature_celsius{zone=\"%s\",type=\"%s\"} %.3f\n", name,
+                      type.c_str(), zone.value);
+        StringAppendF(out, "thermal_temperature_raw_celsius{zone=\"%s\"} %.3f\n", name,
+                      zone.rawValue);
+        StringAppendF(out, "thermal_throttling_severity{zone=\"%s\",severity=\"%s\"} %u\n", name,
+                      toString(zone.severity).c_str(), static_cast<unsigned>(zone.severity));
+        if (zone.samples) {
+            StringAppendF(out, "thermal_temperature_min_celsius{zone=\"%s\"} %.3f\n", name,
+                          zone.min);
+            StringAppendF(out, "thermal_temperature_max_celsius{zone=\"%s\"} %.3f\n", name,
+                          zone.max);
+            StringAppendF(out, "thermal_temperature_mean_celsius{zone=\"%s\"} %.3f\n", name,
+                          zone.sum / zone.samples);
+        }
+        StringAppendF(out, "thermal_throttling_transitions_total{zone=\"%s\"} %" PRIu64 "\n",
+                      name, zone.transitions);
+        for (size_t i = 0; i < severityCount; ++i) {
+            StringAppendF(out,
+                          "thermal_throttling_ticks_total{zone=\"%s\",severity=\"%s\"} %" PRIu64
+                          "\n",
+                          name, toString(static_cast<ThrottlingSeverity>(i)).c_str(),
+                          zone.severityTicks[i]);
+        }
+    }
+
+    for (const auto& dev : snapshot.coolingDevices) {
+        StringAppendF(out, "thermal_cooling_state{device=\"%s\",type=\"%s\"} %" PRIu64 "\n",
+                      dev.name.c_str(), toString(dev.type).c_str(), dev.value);
+        StringAppendF(out, "thermal_cooling_transitions_total{device=\"%s\"} %" PRIu64 "\n",
+                      dev.name.c_str(), dev.transitions);
+    }
+
+    // Jiffies counters, the scraper computes the utilization over its own scrape interval
+    for (const auto& cpu : snapshot.cpus) {
+        StringAppendF(out, "thermal_cpu_active_jiffies_total{cpu=\"%s\"} %" PRIu64 "\n",
+                      cpu.name.c_str(), cpu.active);
+        StringAppendF(out, "thermal_cpu_jiffies_total{cpu=\"%s\"} %" PRIu64 "\n",
+                      cpu.name.c_str(), cpu.total);
+        StringAppendF(out, "thermal_cpu_online{cpu=\"%s\"} %d\n", cpu.name.c_str(),
+                      cpu.isOnline ? 1 : 0);
+    }
+}
+
+}  // namespace android::hardware::thermal::V2_0::implementation
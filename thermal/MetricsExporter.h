@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __METRICS_EXPORTER_CPP__
+#define __METRICS_EXPORTER_CPP__
+
+#include <android-base/unique_fd.h>
+#include <android/hardware/thermal/2.0/IThermal.h>
+
+#include <array>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace android::hardware::thermal::V2_0::implementation {
+
+using ::android::hardware::thermal::V1_0::CpuUsage;
+
+// What the monitoring thread knows about the devices after a sampling period
+struct ThermalSnapshot {
+    struct Zone {
+        std::string name;
+        TemperatureType type;
+        // Filtered temperature, the throttling severity is evaluated from
+        float value;
+        // Temperature as read
+        float rawValue;
+        ThrottlingSeverity severity;
+        // Statistics since the service start
+        float min;
+        float max;
+        double sum;
+        uint64_t samples;
+        // Number of throttling severity changes
+        uint64_t transitions;
+        // Number of sampling periods spent at each throttling severity
+        std::array<uint64_t, 7 /* ThrottlingSeverity#len */> severityTicks;
+    };
+    struct Cooling {
+        std::string name;
+        CoolingType type;
+        uint64_t value;
+        // Number of state changes
+        uint64_t transitions;
+    };
+
+    // CLOCK_REALTIME time of the sampling, in ms
+    int64_t timeMs = 0;
+    uint64_t ticks = 0;
+    std::vector<Zone> zones;
+    std::vector<Cooling> coolingDevices;
+    // Cumulative usage of every CPU, only sampled while the exporter is started
+    std::vector<CpuUsage> cpus;
+};
+
+/* Serves the latest ThermalSnapshot as text on a local stream socket: a client connects, reads
+   the exposition until EOF and is disconnected. Clients never reach the devices nor slow the
+   monitoring thread down. */
+class MetricsExporter {
+   public:
+    static constexpr char _kSocketName[] = "thermal_metrics";
+
+    // Starts serving the socket created by init, returns false when there's none
+    bool start();
+
+    bool isStarted() const { return _socket.ok(); }
+
+    /* Makes the snapshot the one served. Never blocks: when a client is being served, the
+       publication is just skipped and the next one will do */
+    void publish(const ThermalSnapshot& snapshot);
+
+   private:
+    // Pause after accept() ran out of resources, e.g. file descriptors
+    static constexpr std::chrono::seconds _kRetryDelay{1};
+
+    android::base::unique_fd _socket;
+
+    // Protects _published
+    std::mutex _mutex;
+    ThermalSnapshot _published;
+
+    void serve();
+    static void format(const ThermalSnapshot& snapshot, std::string* out);
+};
+
+}  // namespace android::hardware::thermal::V2_0::implementation
+
+#endif  // #ifndef __METRICS_EXPORTER_CPP__
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MonitorSchedule.h"
+
+#include <algorithm>
+
+namespace android::hardware::thermal::V2_0::implementation {
+
+void MonitorSchedule::polled(std::chrono::nanoseconds now, bool idle) {
+    _nextPoll = now + (idle && _idleInterval.count() ? _idleInterval : _pollInterval);
+}
+
+std::chrono::nanoseconds MonitorSchedule::getWait(bool polling,
+                                                  std::chrono::milliseconds streamInterval,
+                                                  std::chrono::nanoseconds now) const {
+    std::chrono::nanoseconds wait = std::chrono::nanoseconds::zero();
+
+    // A poll already due still needs the timer armed, zero would disarm it
+    if (polling) wait = std::max(_nextPoll - now, std::chrono::nanoseconds(1));
+    if (streamInterval.count() && (!polling || streamInterval < wait)) wait = streamInterval;
+    return wait;
+}
+
+}  // namespace android::hardware::thermal::V2_0::implementation
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __MONITOR_SCHEDULE_CPP__
+#define __MONITOR_SCHEDULE_CPP__
+
+#include <chrono>
+
+namespace android::hardware::thermal::V2_0::implementation {
+
+/* When the monitoring thread polls the devices, and how long it sleeps in between, on
+   CLOCK_BOOTTIME. It neither reads a clock nor arms a timer, so that the policy can be replayed on
+   a virtual clock */
+class MonitorSchedule {
+   public:
+    std::chrono::milliseconds _pollInterval{5000};
+    // Used instead of _pollInterval when every zone is far enough below its thresholds
+    std::chrono::milliseconds _idleInterval{0};  // 0 disables it
+
+    // Tells whether the devices are due for polling at now, polling telling whether anyone reads
+    bool isPollDue(bool polling, std::chrono::nanoseconds now) const {
+        return polling && now >= _nextPoll;
+    }
+
+    // Schedules the poll following the one done at now
+    void polled(std::chrono::nanoseconds now, bool idle);
+
+    // Makes the next poll due right away, e.g for a new listener to be notified at once
+    void pollNow() { _nextPoll = std::chrono::nanoseconds::zero(); }
+
+    /* Gets how long to sleep from now until the next poll or streaming period, zero meaning
+       until woken up */
+    std::chrono::nanoseconds getWait(bool polling, std::chrono::milliseconds streamInterval,
+                                     std::chrono::nanoseconds now) const;
+
+   private:
+    // CLOCK_BOOTTIME time of the next poll
+    std::chrono::nanoseconds _nextPoll{0};
+};
+
+}  // namespace android::hardware::thermal::V2_0::implementation
+
+#endif  // #ifndef __MONITOR_SCHEDULE_CPP__
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Scheduling.h"
+
+#include <android-base/chrono_utils.h>
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/properties.h>
+#include <android-base/strings.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace android::hardware::thermal::V2_0::implementation {
+
+ThreadScheduling ThreadScheduling::fromProperties(const char* iName, const std::string& iPrefix) {
+    using android::base::GetIntProperty;
+    ThreadScheduling scheduling;
+
+    scheduling.name = iName;
+    scheduling.rtPriority = GetIntProperty(iPrefix + ".rt_priority", 0, 0, 99);
+    scheduling.nice = GetIntProperty(iPrefix + ".nice", 0, -20, 19);
+    scheduling.cpus = android::base::GetProperty(iPrefix + ".cpus", "");
+    return scheduling;
+}
+
+bool ThreadScheduling::apply() const {
+    bool ok = true;
+    sched_param param{.sched_priority = rtPriority};
+
+    // The policy is always set, not to inherit the one of the creating thread
+    int error = pthread_setschedparam(pthread_self(), rtPriority ? SCHED_FIFO : SCHED_OTHER,
+                                      &param);
+    if (error) {
+        LOG(ERROR) << __FUNCTION__ << " - Unable to set the " << name << " policy("
+                   << strerror(error) << ")\n";
+        ok = false;
+    }
+    if (!rtPriority && setpriority(PRIO_PROCESS, gettid(), nice)) {
+        LOG(ERROR) << __FUNCTION__ << " - Unable to set the " << name << " nice level("
+                   << strerror(errno) << ")\n";
+        ok = false;
+    }
+
+    if (!cpus.empty()) {
+        cpu_set_t set;
+
+        if (!parseCpus(cpus, &set)) {
+            LOG(ERROR) << __FUNCTION__ << " - Invalid " << name << " CPU list " << cpus << "\n";
+            ok = false;
+        } else if (sched_setaffinity(0, sizeof(set), &set)) {
+            LOG(ERROR) << __FUNCTION__ << " - Unable to set the " << name << " affinity("
+                       << strerror(errno) << ")\n";
+            ok = false;
+        }
+    }
+
+    LOG(INFO) << __FUNCTION__ << " - " << name << ": "
+              << (rtPriority ? "SCHED_FIFO " + std::to_string(rtPriority)
+                             : "SCHED_OTHER nice " + std::to_string(nice))
+              << ", CPUs " << (cpus.empty() ? "all" : cpus) << "\n";
+    return ok;
+}
+
+bool ThreadScheduling::parseCpus(const std::string& iCpus, cpu_set_t* oSet) {
+    CPU_ZERO(oSet);
+
+    for (const auto& range : android::base::Split(iCpus, ",")) {
+        auto bounds = android::base::Split(range, "-");
+        unsigned first, last;
+
+        if (bounds.size() > 2 ||
+            !android::base::ParseUint(bounds.front(), &first, CPU_SETSIZE - 1u) ||
+            !android::base::ParseUint(bounds.back(), &last, CPU_SETSIZE - 1u) || first > last)
+            return false;
+        for (unsigned cpu = first; cpu <= last; ++cpu) CPU_SET(cpu, oSet);
+    }
+
+    return CPU_COUNT(oSet) > 0;
+}
+
+std::chrono::nanoseconds getBootTime() {
+    return android::base::boot_clock::now().time_since_epoch();
+}
+
+}  // namespace android::hardware::thermal::V2_0::implementation
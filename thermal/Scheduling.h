@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SCHEDULING_CPP__
+#define __SCHEDULING_CPP__
+
+#include <sched.h>
+
+#include <chrono>
+#include <string>
+
+namespace android::hardware::thermal::V2_0::implementation {
+
+/* Scheduling of a service thread, read from the vendor properties
+     <prefix>.rt_priority  SCHED_FIFO priority(1-99), 0 for SCHED_OTHER
+     <prefix>.nice         SCHED_OTHER nice level(-20-19)
+     <prefix>.cpus         CPU list the thread runs on, e.g "0-1,3", every CPU when empty
+   Real-time priorities and negative nice levels need CAP_SYS_NICE. */
+struct ThreadScheduling {
+    std::string name;
+    int rtPriority = 0;
+    int nice = 0;
+    std::string cpus;
+
+    // Reads the settings of the given properties prefix, e.g "ro.vendor.thermal.sampler"
+    static ThreadScheduling fromProperties(const char* iName, const std::string& iPrefix);
+
+    // Applies the settings to the calling thread, threads it creates inherit them
+    bool apply() const;
+
+   private:
+    static bool parseCpus(const std::string& iCpus, cpu_set_t* oSet);
+};
+
+// Current CLOCK_BOOTTIME time, the clock the service threads are scheduled on
+std::chrono::nanoseconds getBootTime();
+
+}  // namespace android::hardware::thermal::V2_0::implementation
+
+#endif  // #ifndef __SCHEDULING_CPP__
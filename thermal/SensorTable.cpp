@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SensorTable.h"
+
+#include <android-base/logging.h>
+
+#include <algorithm>
+#include <limits>
+
+namespace android::hardware::thermal::V2_0::implementation {
+
+static constexpr float kUndefinedThreshold = std::numeric_limits<float>::infinity();
+
+static_assert(kSeverityCount == decltype(ThermalZone::_hotThrottlingThresholds)::size());
+
+static size_t typeIndex(TemperatureType type) {
+    return static_cast<size_t>(static_cast<int32_t>(type) + 1);
+}
+
+static size_t typeIndex(CoolingType type) {
+    return static_cast<size_t>(type);
+}
+
+/* Moves the items into the returned vector ordered by type, and sets the first index of each type.
+   The devices aren't move assignable, which rules std::stable_sort out */
+template <typename Item, typename GetType, size_t N>
+static std::vector<Item> orderByType(std::vector<Item>&& items, GetType getType,
+                                     std::array<size_t, N>* oTypeStart) {
+    std::vector<Item> ordered;
+
+    ordered.reserve(items.size());
+    for (size_t t = 0; t < N - 1; ++t) {
+        (*oTypeStart)[t] = ordered.size();
+        for (auto& item : items) {
+            if (typeIndex(getType(item)) == t) ordered.push_back(std::move(item));
+        }
+    }
+    (*oTypeStart)[N - 1] = ordered.size();
+
+    if (ordered.size() != items.size())
+        LOG(WARNING) << __FUNCTION__ << " - Ignoring " << items.size() - ordered.size()
+                     << " device(s) of unsupported type\n";
+    return ordered;
+}
+
+void ZoneTable::build(std::vector<ThermalZone>&& zones) {
+    _zones = orderByType(
+        std::move(zones), [](const ThermalZone& tz) { return tz._temp.type; }, &_typeStart);
+
+    _fds.resize(_zones.size());
+    _values.assign(_zones.size(), -1);
+    _severities.assign(_zones.size(), ThrottlingSeverity::NONE);
+    _thresholds.assign(_zones.size() * kSeverityCount, kUndefinedThreshold);
+    _thresholdsLoaded.assign(_zones.size(), false);
+    _rawValues.assign(_zones.size(), -1);
+    _alphas.assign(_zones.size(), 1);
+    _readCounts.assign(_zones.size(), 0);
+    _medianZones.clear();
+    _medianWindows.assign(_zones.size(), 1);
+    _history.resize(_zones.size() * kMaxMedianWindow);
+    _filteredCount = 0;
+    for (size_t i = 0; i < _zones.size(); ++i) _fds[i] = _zones[i].getTempFd();
+}
+
+void ZoneTable::loadThresholds(IndexRange range) {
+    for (size_t i = range.first; i < range.second; ++i) {
+        if (_thresholdsLoaded[i]) continue;
+
+        if (!_zones[i].init())
+            LOG(ERROR) << __FUNCTION__ << " - Error while initializing the sensor threshold of "
+                       << _zones[i]._temp.name << "\n";
+        updateThresholds(i);
+        _thresholdsLoaded[i] = true;
+    }
+}
+
+void ZoneTable::setFilter(size_t i, const SensorFilter& filter) {
+    if (isFiltered(i)) _filteredCount--;
+    _alphas[i] = SensorFilter::Kind::EMA == filter.kind ? filter.alpha : 1;
+    _medianWindows[i] = SensorFilter::Kind::MEDIAN == filter.kind ? filter.window : 1;
+    _readCounts[i] = 0;
+
+    auto median = std::lower_bound(_medianZones.begin(), _medianZones.end(), i);
+    if (median != _medianZones.end() && *median == i) _medianZones.erase(median);
+    if (SensorFilter::Kind::MEDIAN == filter.kind)
+        _medianZones.insert(std::lower_bound(_medianZones.begin(), _medianZones.end(), i), i);
+    if (isFiltered(i)) _filteredCount++;
+}
+
+IndexRange ZoneTable::getRange(bool filterType, TemperatureType type) const {
+    if (!filterType) return {0, _zones.size()};
+
+    size_t t = typeIndex(type);
+    if (t >= kTemperatureTypeCount) return {0, 0};
+    return {_typeStart[t], _typeStart[t + 1]};
+}
+
+void ZoneTable::updateThresholds(size_t i) {
+    float* thresholds = &_thresholds[i * kSeverityCount];
+
+    for (size_t s = 0; s < kSeverityCount; ++s) {
+        float threshold = _zones[i]._hotThrottlingThresholds[s];
+        thresholds[s] = threshold != -1 ? threshold : kUndefinedThreshold;
+    }
+}
+
+void ZoneTable::readRawValues(IndexRange range) {
+    for (size_t i = range.first; i < range.second; ++i) {
+        int64_t milliCelsius;
+
+        if (ThermalDeviceDir::readValue(_fds[i], &milliCelsius))
+            _rawValues[i] = milliCelsius / 1000.f;
+    }
+}
+
+void ZoneTable::read(IndexRange range) {
+    loadThresholds(range);
+    readRawValues(range);
+
+    // Until their first sample(), filtered zones have no output but the reading itself
+    for (size_t i = range.first; i < range.second; ++i) {
+        if (!_readCounts[i] || !isFiltered(i)) _values[i] = _rawValues[i];
+    }
+
+    evaluateSeverities(range);
+}
+
+void ZoneTable::sample(IndexRange range) {
+    loadThresholds(range);
+    readRawValues(range);
+
+    /* Exponential moving average, without any branch so that it's vectorized across zones. The
+       first reading is taken as is */
+    for (size_t i = range.first; i < range.second; ++i) {
+        const float alpha = _readCounts[i] ? _alphas[i] : 1.f;
+
+        _values[i] += alpha * (_rawValues[i] - _values[i]);
+        _readCounts[i]++;
+    }
+
+    // Median of the last readings, the window being bounded the cost per reading is too
+    for (size_t i : _medianZones) {
+        if (i < range.first || i >= range.second) continue;
+
+        const uint32_t window = _medianWindows[i];
+        const uint32_t count = std::min(_readCounts[i], window);
+        float* history = &_history[i * kMaxMedianWindow];
+        float sorted[kMaxMedianWindow];
+
+        history[(_readCounts[i] - 1) % window] = _rawValues[i];
+        std::copy(history, history + count, sorted);
+        std::sort(sorted, sorted + count);
+        _values[i] = sorted[count / 2];
+    }
+
+    evaluateSeverities(range);
+}
+
+void ZoneTable::evaluateSeverities(IndexRange range) {
+    // Sets the throttling status based on the current temperature and the throttling thresholds
+    for (size_t i = range.first; i < range.second; ++i) {
+        const float* thresholds = &_thresholds[i * kSeverityCount];
+        size_t severity = 0;
+
+        for (size_t s = 0; s < kSeverityCount; ++s) {
+            if (_values[i] >= thresholds[s])
+                severity = s;
+            else if (thresholds[s] != kUndefinedThreshold)
+                break;
+        }
+        _severities[i] = static_cast<ThrottlingSeverity>(severity);
+    }
+}
+
+float ZoneTable::getHeadroom(size_t i) const {
+    const float* thresholds = &_thresholds[i * kSeverityCount];
+
+    // Skips ThrottlingSeverity::NONE which isn't a throttling threshold
+    for (size_t s = 1; s < kSeverityCount; ++s) {
+        if (thresholds[s] != kUndefinedThreshold) return thresholds[s] - _values[i];
+    }
+
+    return std::numeric_limits<float>::infinity();
+}
+
+void ZoneTable::fill(size_t i, Temperature* oTemp) const {
+    const Temperature& temp = _zones[i]._temp;
+
+    oTemp->type = temp.type;
+    oTemp->name.setToExternal(temp.name.c_str(), temp.name.size());
+    oTemp->value = _values[i];
+    oTemp->throttlingStatus = _severities[i];
+}
+
+// Cannot handle some v2.0 temperature types
+void ZoneTable::fill(size_t i, Temperature_1_0* oTemp) const {
+    const ThermalZone& tz = _zones[i];
+
+    oTemp->type = static_cast<TemperatureType_1_0>(tz._temp.type);
+    oTemp->name.setToExternal(tz._temp.name.c_str(), tz._temp.name.size());
+    oTemp->currentValue = _values[i];
+    oTemp->throttlingThreshold =
+        tz._hotThrottlingThresholds[static_cast<std::underlying_type_t<ThrottlingSeverity>>(
+            ThrottlingSeverity::SEVERE)];
+    oTemp->shutdownThreshold =
+        tz._hotThrottlingThresholds[static_cast<std::underlying_type_t<ThrottlingSeverity>>(
+            ThrottlingSeverity::SHUTDOWN)];
+    oTemp->vrThrottlingThreshold = tz._vrThrottlingThreshold;
+}
+
+void ZoneTable::fill(size_t i, TemperatureThreshold* oThreshold) const {
+    const ThermalZone& tz = _zones[i];
+
+    oThreshold->type = tz._temp.type;
+    oThreshold->name.setToExternal(tz._temp.name.c_str(), tz._temp.name.size());
+    oThreshold->hotThrottlingThresholds = tz._hotThrottlingThresholds;
+    oThreshold->coldThrottlingThresholds = tz._coldThrottlingThresholds;
+    oThreshold->vrThrottlingThreshold = tz._vrThrottlingThreshold;
+}
+
+void CoolingTable::build(std::vector<CoolDevice>&& devices) {
+    _devices = orderByType(
+        std::move(devices), [](const CoolDevice& dev) { return dev._dev.type; }, &_typeStart);
+
+    _fds.resize(_devices.size());
+    _values.assign(_devices.size(), 0);
+    for (size_t i = 0; i < _devices.size(); ++i) _fds[i] = _devices[i].getStateFd();
+}
+
+IndexRange CoolingTable::getRange(bool filterType, CoolingType type) const {
+    if (!filterType) return {0, _devices.size()};
+
+    size_t t = typeIndex(type);
+    if (t >= kCoolingTypeCount) return {0, 0};
+    return {_typeStart[t], _typeStart[t + 1]};
+}
+
+void CoolingTable::sample(IndexRange range) {
+    for (size_t i = range.first; i < range.second; ++i) {
+        int64_t state;
+
+        if (ThermalDeviceDir::readValue(_fds[i], &state)) _values[i] = state;
+    }
+}
+
+void CoolingTable::fill(size_t i, CoolingDevice* oDev) const {
+    const CoolingDevice& dev = _devices[i]._dev;
+
+    oDev->type = dev.type;
+    oDev->name.setToExternal(dev.name.c_str(), dev.name.size());
+    oDev->value = _values[i];
+}
+
+// Cannot handle some v2.0 cooling types
+void CoolingTable::fill(size_t i, CoolingDevice_1_0* oDev) const {
+    const CoolingDevice& dev = _devices[i]._dev;
+
+    oDev->type = static_cast<CoolingType_1_0>(dev.type);
+    oDev->name.setToExternal(dev.name.c_str(), dev.name.size());
+    oDev->currentValue = static_cast<float>(_values[i]);
+}
+
+}  // namespace android::hardware::thermal::V2_0::implementation
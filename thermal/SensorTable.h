@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SENSOR_TABLE_CPP__
+#define __SENSOR_TABLE_CPP__
+
+#include <array>
+#include <utility>
+#include <vector>
+
+#include "CoolDevice.h"
+#include "ThermalConfig.h"
+#include "ThermalZone.h"
+
+namespace android::hardware::thermal::V2_0::implementation {
+
+static constexpr size_t kSeverityCount = 7;  // ThrottlingSeverity#len
+// TemperatureType values range from UNKNOWN(-1) to NPU
+static constexpr size_t kTemperatureTypeCount = static_cast<size_t>(TemperatureType::NPU) + 2;
+// CoolingType values range from FAN(0) to COMPONENT
+static constexpr size_t kCoolingTypeCount = static_cast<size_t>(CoolingType::COMPONENT) + 1;
+
+// Index range [first, second) of table entries
+using IndexRange = std::pair<size_t, size_t>;
+
+/* Thermal zones laid out as a structure of arrays: the data used upon each sampling(file
+   descriptors, values, thresholds, severities) is packed in contiguous arrays, the zones being
+   ordered by type so that the zones of a given type make a contiguous index range */
+class ZoneTable {
+   public:
+    // Takes the zones over, ordering them by type
+    void build(std::vector<ThermalZone>&& zones);
+
+    size_t size() const { return _zones.size(); }
+    bool empty() const { return _zones.empty(); }
+
+    // Gets the zones of the given type, every zone if filterType is false
+    IndexRange getRange(bool filterType, TemperatureType type) const;
+
+    /* Reads the temperature of the zones in range, advances their filter and evaluates their
+       throttling severity from the filtered value. Filters run on the monitoring period, which
+       is the only caller: how often clients query must not change what the filters average */
+    void sample(IndexRange range);
+
+    /* Reads the temperature of the zones in range without advancing their filter: the unfiltered
+       zones get the new reading, the filtered ones keep the output of the last sample() */
+    void read(IndexRange range);
+
+    // Sets the noise filter of a zone, restarting it from the next sample()
+    void setFilter(size_t i, const SensorFilter& filter);
+
+    // Tells whether any zone is filtered, which requires periodic sample() calls
+    bool hasFilters() const { return _filteredCount; }
+
+    /* Loads the trip points of the zones in range which haven't been yet. Deferred until their
+       first use(sampling, thresholds query), not to delay the service startup */
+    void loadThresholds(IndexRange range);
+
+    // Reloads the packed thresholds of a zone from its trip points
+    void updateThresholds(size_t i);
+
+    const ThermalZone& getZone(size_t i) const { return _zones[i]; }
+    ThermalZone& getZone(size_t i) { return _zones[i]; }
+    TemperatureType getType(size_t i) const { return _zones[i]._temp.type; }
+    // Gets the filtered temperature, the one thresholds apply to
+    float getValue(size_t i) const { return _values[i]; }
+    // Gets the temperature as last read, for diagnostics
+    float getRawValue(size_t i) const { return _rawValues[i]; }
+    ThrottlingSeverity getSeverity(size_t i) const { return _severities[i]; }
+
+    /* Gets the distance between the current temperature and the lowest hot throttling threshold,
+       +infinity if none is defined */
+    float getHeadroom(size_t i) const;
+
+    /* Fill the HIDL structures from the current zone data. The name isn't copied but referenced,
+       so that no allocation occurs: the filled structure must not outlive the table */
+    void fill(size_t i, Temperature* oTemp) const;
+    // Cannot handle some v2.0 temperature types
+    void fill(size_t i, Temperature_1_0* oTemp) const;
+    void fill(size_t i, TemperatureThreshold* oThreshold) const;
+
+   private:
+    // Cold data: names, types, trip points, ...
+    std::vector<ThermalZone> _zones;
+
+    std::vector<int> _fds;
+    std::vector<float> _values;
+    std::vector<ThrottlingSeverity> _severities;
+    // kSeverityCount hot thresholds per zone, undefined ones being +infinity
+    std::vector<float> _thresholds;
+    std::vector<uint8_t> _thresholdsLoaded;
+
+    /* Noise filtering state. Readings land in _rawValues and the filtered values in _values.
+       Every zone goes through the averaging stage, the ones not averaged with a weight of 1 */
+    std::vector<float> _rawValues;
+    std::vector<float> _alphas;
+    // Number of readings since the filter was set
+    std::vector<uint32_t> _readCounts;
+    // Median filtered zones in ascending order, and their kMaxMedianWindow last readings
+    std::vector<size_t> _medianZones;
+    std::vector<uint32_t> _medianWindows;
+    std::vector<float> _history;
+    // Number of zones having either an average or a median filter
+    size_t _filteredCount = 0;
+
+    // First index of each type, by TemperatureType + 1, followed by the zone count
+    std::array<size_t, kTemperatureTypeCount + 1> _typeStart{};
+
+    bool isFiltered(size_t i) const { return _alphas[i] != 1 || _medianWindows[i] != 1; }
+    // Reads the zones in range into _rawValues
+    void readRawValues(IndexRange range);
+    // Sets the throttling severity of the zones in range from their current value
+    void evaluateSeverities(IndexRange range);
+};
+
+// Cooling devices laid out like ZoneTable
+class CoolingTable {
+   public:
+    // Takes the devices over, ordering them by type
+    void build(std::vector<CoolDevice>&& devices);
+
+    size_t size() const { return _devices.size(); }
+    bool empty() const { return _devices.empty(); }
+
+    // Gets the devices of the given type, every device if filterType is false
+    IndexRange getRange(bool filterType, CoolingType type) const;
+
+    // Reads the state of the devices in range
+    void sample(IndexRange range);
+
+    const CoolDevice& getDevice(size_t i) const { return _devices[i]; }
+    CoolingType getType(size_t i) const { return _devices[i]._dev.type; }
+    uint64_t getValue(size_t i) const { return _values[i]; }
+
+    /* Fill the HIDL structures from the current device data. The name isn't copied but
+       referenced, so that no allocation occurs: the filled structure must not outlive the table */
+    void fill(size_t i, CoolingDevice* oDev) const;
+    // Cannot handle some v2.0 cooling types
+    void fill(size_t i, CoolingDevice_1_0* oDev) const;
+
+   private:
+    std::vector<CoolDevice> _devices;
+
+    std::vector<int> _fds;
+    std::vector<uint64_t> _values;
+
+    // First index of each type, by CoolingType, followed by the device count
+    std::array<size_t, kCoolingTypeCount + 1> _typeStart{};
+};
+
+}  // namespace android::hardware::thermal::V2_0::implementation
+
+#endif  // #ifndef __SENSOR_TABLE_CPP__
@@ -18,11 +18,20 @@
 #include "Thermal.h"
 
 #include <android-base/logging.h>
+#include <android-base/properties.h>
 #include <dirent.h>
 #include <hidl/HidlTransportSupport.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 
+#include <algorithm>
 #include <chrono>
-#include <regex>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <optional>
 #include <set>
 
 namespace android::hardware::thermal::V2_0::implementation {
@@ -30,96 +39,95 @@ namespace android::hardware::thermal::V2_0::implementation {
 using ::android::hardware::thermal::V1_0::ThermalStatus;
 using ::android::hardware::thermal::V1_0::ThermalStatusCode;
 
+static constexpr char kPollIntervalProperty[] = "ro.vendor.thermal.poll_interval_ms";
+static constexpr char kIdleIntervalProperty[] = "ro.vendor.thermal.idle_interval_ms";
+static constexpr char kIdleMarginProperty[] = "ro.vendor.thermal.idle_margin";
+// Capacity of the sample queue, in sampling periods
+static constexpr char kStreamQueuePeriodsProperty[] = "ro.vendor.thermal.stream_queue_periods";
+// Size of the flight recorder file in KiB, 0 disables it
+static constexpr char kRecorderSizeProperty[] = "ro.vendor.thermal.flight_recorder_kb";
+// Number of threads discovering the devices at startup
+static constexpr size_t kDiscoveryThreads = 4;
+// Longest wait of a HAL call for the devices to be loaded
+static constexpr std::chrono::seconds kReadyTimeout{5};
+static constexpr char kNotReadyMessage[] = "Devices not loaded yet";
+// Prefix of the monitoring thread scheduling properties, cf ThreadScheduling
+static constexpr char kSamplerSchedulingPrefix[] = "ro.vendor.thermal.sampler";
+
+// Failure status referencing iMessage instead of copying it, failing getters don't allocate either
+static ThermalStatus failure(const char* iMessage) {
+    ThermalStatus status{ThermalStatusCode::FAILURE, {}};
+
+    status.debugMessage.setToExternal(iMessage, strlen(iMessage));
+    return status;
+}
+
 // Methods from ::android::hardware::thermal::V1_0::IThermal follow.
 Return<void> Thermal::getTemperatures(getTemperatures_cb _hidl_cb) {
     if (!_hidl_cb) return Void();
 
-    std::vector<Temperature_1_0> temps;
-    // Fills dynamic values coming from sys files
-    for (auto& tz : _thermalZones) {
-        tz.second.readTemp();
-        temps.emplace_back(static_cast<Temperature_1_0>(tz.second));
+    if (!waitReady()) {
+        _hidl_cb(failure(kNotReadyMessage), {});
+        return Void();
     }
 
+    std::lock_guard<std::mutex> _lock(_devices_mutex);
+    const size_t count = _thermalZones.size();
+    // Fills dynamic values coming from sys files
+    _thermalZones.read({0, count});
+    for (size_t i = 0; i < count; ++i) _thermalZones.fill(i, &_temperatureReplies_1_0[i]);
+
+    hidl_vec<Temperature_1_0> temps;
+    temps.setToExternal(_temperatureReplies_1_0.data(), count);
     if (temps.size())
         _hidl_cb({ThermalStatusCode::SUCCESS, {}}, temps);
     else
-        _hidl_cb({ThermalStatusCode::FAILURE, "No sensor available"}, temps);
+        _hidl_cb(failure("No sensor available"), temps);
 
     return Void();
 }
 
 Return<void> Thermal::getCpuUsages(getCpuUsages_cb _hidl_cb) {
-    static constexpr char cpuStats[] = "/proc/stat";
-    static constexpr char cpuDirPath[] = "/sys/devices/system/cpu/";
-    static const std::regex statPattern{"^(cpu[0-9]+) ([0-9]+) ([0-9]+) ([0-9]+) ([0-9]+).*"};
-
     if (!_hidl_cb) return Void();
 
-    ThermalStatus status{ThermalStatusCode::SUCCESS, {}};
+    if (!waitReady()) {
+        _hidl_cb(failure(kNotReadyMessage), {});
+        return Void();
+    }
 
-    std::vector<CpuUsage> cpuUsages;
-    std::ifstream statData(cpuStats);
-    if (!statData.is_open()) {
-        status.code = ThermalStatusCode::FAILURE;
-        status.debugMessage = "Unable to find cpu statistics";
-        LOG(ERROR) << status.debugMessage;
+    // Served from the CPU sampler cache, whatever the number of clients
+    std::lock_guard<std::mutex> _lock(_cpuRepliesMutex);
+    hidl_vec<CpuUsage> cpuUsages;
+    if (_cpuSampler.getUsages(&_cpuUsageReplies)) {
+        cpuUsages.setToExternal(_cpuUsageReplies.data(), _cpuUsageReplies.size());
+        _hidl_cb({ThermalStatusCode::SUCCESS, {}}, cpuUsages);
     } else {
-        std::string line;
-        std::match_results<std::string::const_iterator> statItems;
-
-        while (std::getline(statData, line)) {
-            std::cout << "Found " << line << " in /proc/stat\n";
-            if (std::regex_match(line, statItems, statPattern)) {
-                std::cout << "Matching the pattern\n";
-                if (statItems.size() == 6) {  // Should always be true
-                    std::string cpuName = statItems[1];
-                    uint64_t active = std::stoull(statItems[2]) + std::stoull(statItems[3]) +
-                                      std::stoull(statItems[4]);
-                    uint64_t idle = std::stoull(statItems[5]);
-                    // Checks the cpu online status
-                    bool isOnline = false;
-                    std::ifstream onlineFile{
-                        std::string(cpuDirPath).append(cpuName).append("/online")};
-
-                    if (!onlineFile.is_open()) {
-                        if (cpuName == "cpu0")
-                            isOnline = true;
-                        else {
-                            status.code = ThermalStatusCode::FAILURE;
-                            status.debugMessage = std::string("Unable to find ")
-                                                      .append(cpuName)
-                                                      .append(" online file");
-                            LOG(ERROR) << status.debugMessage;
-                        }
-                    } else
-                        onlineFile >> isOnline;
-
-                    cpuUsages.push_back({cpuName, active, active + idle, isOnline});
-                } else
-                    std::cout << "But not the items number " << statItems.size() << "\n";
-            }
-        }
+        _hidl_cb(failure("Unable to find cpu statistics"), cpuUsages);
     }
 
-    _hidl_cb(status, cpuUsages);
     return Void();
 }
 
 Return<void> Thermal::getCoolingDevices(getCoolingDevices_cb _hidl_cb) {
     if (!_hidl_cb) return Void();
 
-    std::vector<CoolingDevice_1_0> devs;
-    // Fills dynamic values coming from sys files
-    for (auto& [coolType, dev] : _coolingDevices) {
-        dev.readValue();
-        devs.push_back(static_cast<CoolingDevice_1_0>(dev));
+    if (!waitReady()) {
+        _hidl_cb(failure(kNotReadyMessage), {});
+        return Void();
     }
 
+    std::lock_guard<std::mutex> _lock(_devices_mutex);
+    const size_t count = _coolingDevices.size();
+    // Fills dynamic values coming from sys files
+    _coolingDevices.sample({0, count});
+    for (size_t i = 0; i < count; ++i) _coolingDevices.fill(i, &_coolingReplies_1_0[i]);
+
+    hidl_vec<CoolingDevice_1_0> devs;
+    devs.setToExternal(_coolingReplies_1_0.data(), count);
     if (devs.size())
         _hidl_cb({ThermalStatusCode::SUCCESS, {}}, devs);
     else
-        _hidl_cb({ThermalStatusCode::FAILURE, "No cooling device"}, devs);
+        _hidl_cb(failure("No cooling device"), devs);
 
     return Void();
 }
@@ -129,19 +137,25 @@ Return<void> Thermal::getCurrentTemperatures(bool filterType, TemperatureType ty
                                              getCurrentTemperatures_cb _hidl_cb) {
     if (!_hidl_cb) return Void();
 
-    std::vector<Temperature> temps;
-    // Fills dynamic values coming from sys files
-    for (auto& [tempType, tz] : _thermalZones) {
-        if (filterType && type != tempType)
-            continue;
-        tz.readTemp();
-        temps.push_back(tz._temp);
+    if (!waitReady()) {
+        _hidl_cb(failure(kNotReadyMessage), {});
+        return Void();
     }
 
+    std::lock_guard<std::mutex> _lock(_devices_mutex);
+    const IndexRange range = _thermalZones.getRange(filterType, type);
+    const size_t count = range.second - range.first;
+    // Fills dynamic values coming from sys files
+    _thermalZones.read(range);
+    for (size_t i = 0; i < count; ++i)
+        _thermalZones.fill(range.first + i, &_temperatureReplies[i]);
+
+    hidl_vec<Temperature> temps;
+    temps.setToExternal(_temperatureReplies.data(), count);
     if (temps.size())
         _hidl_cb({ThermalStatusCode::SUCCESS, {}}, temps);
     else
-        _hidl_cb({ThermalStatusCode::FAILURE, "No sensor available"}, temps);
+        _hidl_cb(failure("No sensor available"), temps);
 
     return Void();
 }
@@ -150,28 +164,30 @@ Return<void> Thermal::getTemperatureThresholds(bool filterType, TemperatureType
                                                getTemperatureThresholds_cb _hidl_cb) {
     if (!_hidl_cb) return Void();
 
-    std::vector<TemperatureThreshold> tempThresholds;
-    // Fills dynamic values coming from sys files
-    for (auto& [tempType, tz] : _thermalZones) {
-        if (filterType && type != tempType)
-            continue;
+    if (!waitReady()) {
+        _hidl_cb(failure(kNotReadyMessage), {});
+        return Void();
+    }
+
+    std::lock_guard<std::mutex> _lock(_devices_mutex);
+    const IndexRange range = _thermalZones.getRange(filterType, type);
+    size_t count = 0;
+    _thermalZones.loadThresholds(range);
+    for (size_t i = range.first; i < range.second; ++i) {
         // We assume that if the hotest threshold isn't defined, none is defined and we ignore this
         // sensor.
-        if (-1 ==
-            tz._hotThrottlingThresholds[static_cast<std::underlying_type_t<ThrottlingSeverity>>(
-                ThrottlingSeverity::SHUTDOWN)])
+        if (-1 == _thermalZones.getZone(i)._hotThrottlingThresholds[static_cast<
+                      std::underlying_type_t<ThrottlingSeverity>>(ThrottlingSeverity::SHUTDOWN)])
             continue;
-        tempThresholds.push_back({.type = tz._temp.type,
-                                  .name = tz._temp.name,
-                                  .hotThrottlingThresholds = tz._hotThrottlingThresholds,
-                                  .coldThrottlingThresholds = tz._coldThrottlingThresholds,
-                                  .vrThrottlingThreshold = tz._vrThrottlingThreshold});
+        _thermalZones.fill(i, &_thresholdReplies[count++]);
     }
 
+    hidl_vec<TemperatureThreshold> tempThresholds;
+    tempThresholds.setToExternal(_thresholdReplies.data(), count);
     if (tempThresholds.size())
         _hidl_cb({ThermalStatusCode::SUCCESS, {}}, tempThresholds);
     else
-        _hidl_cb({ThermalStatusCode::FAILURE, "No temperature threshold"}, tempThresholds);
+        _hidl_cb(failure("No temperature threshold"), tempThresholds);
 
     return Void();
 }
@@ -180,19 +196,24 @@ Return<void> Thermal::getCurrentCoolingDevices(bool filterType, CoolingType type
                                                getCurrentCoolingDevices_cb _hidl_cb) {
     if (!_hidl_cb) return Void();
 
-    std::vector<CoolingDevice> devs;
-    // Fills dynamic values coming from sys files
-    for (auto& [coolType, dev] : _coolingDevices) {
-        if (filterType && type != coolType)
-            continue;
-        dev.readValue();
-        devs.push_back(dev._dev);
+    if (!waitReady()) {
+        _hidl_cb(failure(kNotReadyMessage), {});
+        return Void();
     }
 
+    std::lock_guard<std::mutex> _lock(_devices_mutex);
+    const IndexRange range = _coolingDevices.getRange(filterType, type);
+    const size_t count = range.second - range.first;
+    // Fills dynamic values coming from sys files
+    _coolingDevices.sample(range);
+    for (size_t i = 0; i < count; ++i) _coolingDevices.fill(range.first + i, &_coolingReplies[i]);
+
+    hidl_vec<CoolingDevice> devs;
+    devs.setToExternal(_coolingReplies.data(), count);
     if (devs.size())
         _hidl_cb({ThermalStatusCode::SUCCESS, {}}, devs);
     else
-        _hidl_cb({ThermalStatusCode::FAILURE, "No cooling device"}, devs);
+        _hidl_cb(failure("No cooling device"), devs);
 
     return Void();
 }
@@ -204,7 +225,12 @@ Return<void> Thermal::registerThermalChangedCallback(const sp<IThermalChangedCal
 
     if (nullptr == callback) {
         LOG(ERROR) << __FUNCTION__ << " null callback";
-        _hidl_cb({ThermalStatusCode::FAILURE, "null callback"});
+        _hidl_cb(failure("null callback"));
+        return Void();
+    }
+
+    if (!waitReady()) {
+        _hidl_cb(failure(kNotReadyMessage));
         return Void();
     }
 
@@ -228,6 +254,14 @@ Return<void> Thermal::registerThermalChangedCallback(const sp<IThermalChangedCal
                       << " Type: " << android::hardware::thermal::V2_0::toString(type);
         }
     }
+    // The new client gets its first notification without waiting for the next period
+    if (ThermalStatusCode::SUCCESS == status.code) {
+        {
+            std::lock_guard<std::mutex> _lock(_callback_mutex);
+            _schedule.pollNow();
+        }
+        wakeMonitor();
+    }
 
     _hidl_cb(status);
     return Void();
@@ -239,7 +273,7 @@ Return<void> Thermal::unregisterThermalChangedCallback(
 
     if (nullptr == callback) {
         LOG(ERROR) << __FUNCTION__ << "null callback";
-        _hidl_cb({ThermalStatusCode::FAILURE, "null callback"});
+        _hidl_cb(failure("null callback"));
         return Void();
     }
 
@@ -271,12 +305,28 @@ Return<void> Thermal::unregisterThermalChangedCallback(
     return Void();
 }
 
+/* Runs job(i) for every i in [0, count) over a few threads, the calling one included. Opening and
+   reading sysfs attributes is mostly waiting for the drivers, which overlaps well */
+template <typename Job>
+static void parallelFor(size_t count, const Job& job) {
+    std::atomic<size_t> next{0};
+    auto worker = [&next, count, &job]() {
+        for (size_t i; (i = next++) < count;) job(i);
+    };
+    std::vector<std::thread> threads;
+
+    for (size_t t = 1; t < std::min(count, kDiscoveryThreads); ++t) threads.emplace_back(worker);
+    worker();
+    for (auto& thread : threads) thread.join();
+}
+
 // Loads the thermal sensors and cooling devices
 bool Thermal::loadDevices() {
-    _thermalZones.clear();
-    _thermalZones.reserve(5);  // Arbitrary value of 5
-    _coolingDevices.clear();
-    _coolingDevices.reserve(5);  // Arbitrary value of 5
+    std::vector<std::string> zoneDirs;
+    std::vector<std::string> coolingDirs;
+
+    // Sensor names are mapped to types through the configuration too
+    bool ok = _config.load(ThermalConfig::_kDefaultPath);
 
     // Unfortunately, std::filesystem(libc++fs) isn't yet accessible from vendor components
     std::unique_ptr<DIR, int (*)(DIR*)> sysThermalDir{opendir(ThermalZone::_sysThermalPath),
@@ -289,10 +339,7 @@ bool Thermal::loadDevices() {
     }
 
     dirent* thermalFile = nullptr;
-    const std::regex tzNamePattern("thermal_zone[0-9]+$");
-    const std::regex coolingDevNamePattern("cooling_device[0-9]+$");
-
-    bool ok = true;
+    unsigned index;
 
     errno = 0;
     while ((thermalFile = readdir(sysThermalDir.get())) && !errno) {
@@ -302,86 +349,512 @@ bool Thermal::loadDevices() {
             ok = false;
             break;
         }
-        if (std::regex_search(thermalFile->d_name, tzNamePattern)) {
-            // Matches a thermal zone file name
-            ThermalZone tz{std::string(thermalFile->d_name)};
-
-            if (tz._temp.type != TemperatureType::UNKNOWN) {
-                auto thermalZone = _thermalZones.emplace(tz._temp.type, std::move(tz));
-                // Intializes sensor thresholds
-                if (!thermalZone->second.init())
-                    LOG(ERROR) << __FUNCTION__
-                               << " - Error while initializing the sensor threshold ("
-                               << strerror(errno) << ")\n";
-            } else
-                LOG(WARNING) << __FUNCTION__ << " - Ignoring sensor " << tz._temp.name << ")\n";
-        } else if (std::regex_search(thermalFile->d_name, coolingDevNamePattern)) {
-            // Matches a cooling device file name
-            CoolDevice coolingDev{std::string(thermalFile->d_name)};
-
-            _coolingDevices.emplace(coolingDev._dev.type, std::move(coolingDev));
-        }
+        if (ThermalDeviceDir::parseIndexedName(thermalFile->d_name, "thermal_zone", "", &index))
+            zoneDirs.emplace_back(thermalFile->d_name);
+        else if (ThermalDeviceDir::parseIndexedName(thermalFile->d_name, "cooling_device", "",
+                                                    &index))
+            coolingDirs.emplace_back(thermalFile->d_name);
     }
 
+    // Trip points aren't read here but upon their first use, cf ZoneTable::loadThresholds()
+    std::vector<std::optional<ThermalZone>> sensors(zoneDirs.size());
+    std::vector<std::optional<CoolDevice>> coolingDevices(coolingDirs.size());
+    parallelFor(zoneDirs.size() + coolingDirs.size(), [&](size_t i) {
+        const size_t dev = i - zoneDirs.size();
+
+        if (i < zoneDirs.size())
+            sensors[i].emplace(std::move(zoneDirs[i]));
+        else
+            coolingDevices[dev].emplace(std::move(coolingDirs[dev]));
+    });
+
+    loadHwmonSensors(&sensors);
+
+    std::vector<ThermalZone> thermalZones;
+    for (auto& tz : sensors) {
+        const SensorConfig& config = _config.getSensor(tz->_temp.name);
+
+        if (config.type) tz->_temp.type = *config.type;
+        if (tz->_temp.type != TemperatureType::UNKNOWN)
+            thermalZones.push_back(std::move(*tz));
+        else
+            LOG(WARNING) << __FUNCTION__ << " - Ignoring sensor " << tz->_temp.name << ")\n";
+    }
+
+    std::vector<CoolDevice> coolDevices;
+    for (auto& dev : coolingDevices) coolDevices.push_back(std::move(*dev));
+
+    // Lays the devices out once for all, grouped by type
+    _thermalZones.build(std::move(thermalZones));
+    _coolingDevices.build(std::move(coolDevices));
+
+    for (size_t i = 0; i < _thermalZones.size(); ++i)
+        _thermalZones.setFilter(i, _config.getSensor(_thermalZones.getZone(i)._temp.name).filter);
+
+    // Sizes the replies storage once for all, getters then never allocate
+    _temperatureReplies.resize(_thermalZones.size());
+    _temperatureReplies_1_0.resize(_thermalZones.size());
+    _thresholdReplies.resize(_thermalZones.size());
+    _notifiedTemperatures.resize(_thermalZones.size());
+    _coolingReplies.resize(_coolingDevices.size());
+    _coolingReplies_1_0.resize(_coolingDevices.size());
+
     return ok;
 }
 
+// Adds the hwmon temperature channels to the sensors, skipping the thermal zones mirrors
+void Thermal::loadHwmonSensors(std::vector<std::optional<ThermalZone>>* ioSensors) {
+    std::unique_ptr<DIR, int (*)(DIR*)> sysHwmonDir{opendir(ThermalZone::_sysHwmonPath), closedir};
+
+    if (!sysHwmonDir) {
+        LOG(INFO) << __FUNCTION__ << " - No hwmon device(" << strerror(errno) << ")\n";
+        return;
+    }
+
+    /* The thermal core registers a hwmon device for some zones, named after the zone type with
+       '-' turned into '_': such a channel is a zone read twice */
+    std::set<std::string> zoneNames;
+    for (const auto& tz : *ioSensors) {
+        std::string name = tz->_temp.name;
+
+        std::replace(name.begin(), name.end(), '-', '_');
+        zoneNames.insert(std::move(name));
+    }
+
+    std::vector<std::pair<std::string, unsigned>> channels;
+    dirent* hwmonFile = nullptr;
+    unsigned index;
+
+    while ((hwmonFile = readdir(sysHwmonDir.get()))) {
+        if (!ThermalDeviceDir::parseIndexedName(hwmonFile->d_name, "hwmon", "", &index)) continue;
+
+        const std::string hwmonPath = std::string(ThermalZone::_sysHwmonPath)
+                                          .append(hwmonFile->d_name);
+        std::string chipName;
+        std::ifstream(std::string(hwmonPath).append("/name")) >> chipName;
+        if (zoneNames.count(chipName)) continue;
+
+        std::unique_ptr<DIR, int (*)(DIR*)> chipDir{opendir(hwmonPath.c_str()), closedir};
+        dirent* channelFile = nullptr;
+
+        // Most likely a device path without the sysfs_hwmon_info label, see genfs_contexts
+        if (!chipDir)
+            LOG(ERROR) << __FUNCTION__ << " - Unable to list " << hwmonPath << "("
+                       << strerror(errno) << ")\n";
+        while (chipDir && (channelFile = readdir(chipDir.get()))) {
+            if (ThermalDeviceDir::parseIndexedName(channelFile->d_name, "temp", "_input", &index))
+                channels.emplace_back(hwmonFile->d_name, index);
+        }
+    }
+
+    const size_t hwmonStart = ioSensors->size();
+    ioSensors->resize(hwmonStart + channels.size());
+    parallelFor(channels.size(), [&](size_t i) {
+        (*ioSensors)[hwmonStart + i].emplace(std::move(channels[i].first), channels[i].second);
+    });
+
+    LOG(INFO) << __FUNCTION__ << " - Found " << channels.size()
+              << " hwmon temperature channel(s)\n";
+}
+
 /* The thermal monitoring thread function which calls any registered listener.
  * Note that we send any sensor's temperature of interest to a given client, whether the sensor
- * throttling status has changed since its last notification(5 seconds ago) or not.
+ * throttling status has changed since its last notification(a polling interval ago) or not.
+ * While streaming, zones are additionally read and streamed every _streamInterval.
+ * Without any listener, flight recorder, metrics exporter, filtered zone nor streaming, the
+ * thread sleeps until one shows up, and it never wakes the SoC up from suspend since its timer
+ * isn't an alarm one.
  */
 void Thermal::monitorFunc() {
-    using namespace std::chrono_literals;
-    constexpr std::chrono::duration sleepDuration = 5s;
+    epoll_event events[2];
 
-    /* We store already read temperatures upon each iteration in case several callbacks relate to
-       a given temperature type. May be overkilling against reading each sensor once, let's see */
-    std::unordered_multimap<TemperatureType, Temperature> cachedTemps;
+    // Sampling and notification must go on under a heavy CPU load, which is when they matter most
+    _monitorScheduling.apply();
 
     do {
-        {
-            std::lock_guard<std::mutex> _lock(_callback_mutex);
+        armTimer(monitorTick(getBootTime()));
+
+        int eventCount = TEMP_FAILURE_RETRY(epoll_wait(_epollFd, events, std::size(events), -1));
+        if (eventCount < 0) {
+            LOG(ERROR) << __FUNCTION__ << " - epoll_wait error(" << strerror(errno) << ")\n";
+            continue;
+        }
+        // Acknowledges the events, we don't care about their number
+        for (int i = 0; i < eventCount; ++i) {
+            uint64_t count;
+            read(events[i].data.fd, &count, sizeof(count));
+        }
+    } while (true);
+}
+
+std::chrono::nanoseconds Thermal::monitorTick(std::chrono::nanoseconds now) {
+    using std::chrono::milliseconds;
+    std::lock_guard<std::mutex> _lock(_callback_mutex);
+
+    const milliseconds streamInterval = _streamInterval.load();
+    // Filters are timed by the polling period, even without anyone to notify
+    const bool polling = !_callbacks.empty() || _recorder.isOpen() || _exporter.isStarted() ||
+                         _thermalZones.hasFilters();
+    const bool pollDue = _schedule.isPollDue(polling, now);
+
+    if (pollDue || streamInterval.count()) {
+        std::lock_guard<std::mutex> _devicesLock(_devices_mutex);
+
+        /* Every device is read once per period, whatever the number of listeners.
+           Streaming in between reads the zones without advancing their filters */
+        if (pollDue)
+            sampleDevices();
+        else
+            _thermalZones.read({0, _thermalZones.size()});
+        if (streamInterval.count()) streamSample(now);
+
+        if (pollDue) {
+            updateSnapshot();
+            if (_exporter.isStarted()) _exporter.publish(_snapshot);
+            recordSample();
+            _schedule.polled(now, isIdle());
+
+            // Listeners are called outside the devices lock, not to delay the getters
+            for (size_t i = 0; i < _thermalZones.size(); ++i)
+                _thermalZones.fill(i, &_notifiedTemperatures[i]);
+        }
+    }
+
+    if (pollDue) {
+        for (const auto& [callback, type] : _callbacks) {
+            // The notified temperatures are ordered like the zones, thus grouped by type
+            const IndexRange range = _thermalZones.getRange(TemperatureType::UNKNOWN != type, type);
+
+            for (size_t i = range.first; i < range.second; ++i)
+                callback->notifyThrottling(_notifiedTemperatures[i]);
+        }
+    }
+
+    return _schedule.getWait(polling, streamInterval, now);
+}
+
+void Thermal::sampleDevices() {
+    _thermalZones.sample({0, _thermalZones.size()});
+    _coolingDevices.sample({0, _coolingDevices.size()});
+}
+
+void Thermal::streamSample(std::chrono::nanoseconds now) {
+    std::lock_guard<std::mutex> lock(_queueMutex);
+
+    if (!_sampleQueue) return;
+
+    for (size_t i = 0; i < _streamedSamples.size(); ++i) {
+        ZoneSample& sample = _streamedSamples[i];
+
+        sample.timestampNs = now.count();
+        sample.period = _streamedPeriod;
+        sample.type = _thermalZones.getType(i);
+        sample.value = _thermalZones.getValue(i);
+        sample.throttlingStatus = _thermalZones.getSeverity(i);
+    }
+    _streamedPeriod++;
 
-            if (!_callbacks.empty()) {
-                bool allCached = false;
-                cachedTemps.clear();
-
-                for (const auto& c : _callbacks) {
-                    /* Note that structured binding of _callbacks items isn't possible here
-                       due to some use in the below lambda */
-                    bool typeFilter = (TemperatureType::UNKNOWN != c.second);
-                    auto temps = (typeFilter ? cachedTemps.find(c.second) : cachedTemps.begin());
-
-                    if (temps != cachedTemps.end() && (typeFilter || allCached)) {
-                        // We found it in the cache and we aren't in the case where we need to feed
-                        // the cache, so we use it
-                        for (; temps != cachedTemps.end(); ++temps) {
-                            LOG(INFO) << "HalThermal - Cached Temperature " << temps->second.name
-                                      << "(" << temps->second.value << "°C)\n";
-                            c.first->notifyThrottling(temps->second);
-                        }
-                    } else {
-                        // Here, we read measures from the files, and store it in our cache
-                        auto onRead = [&c, &cachedTemps](const ThermalStatus& status,
-                                                         hidl_vec<Temperature> temps) {
-                            if (ThermalStatusCode::SUCCESS == status.code) {
-                                for (const auto& temp : temps) {
-                                    c.first->notifyThrottling(temp);
-                                    cachedTemps.insert(std::make_pair(temp.type, std::move(temp)));
-                                }
-                            }
-                        };
-                        getCurrentTemperatures(typeFilter, c.second, onRead);
-                        if (!typeFilter) allCached = true;
-                    }
+    // Never blocks nor fails for lack of room: too slow readers are overrun
+    if (!_sampleQueue->write(_streamedSamples.data(), _streamedSamples.size()))
+        LOG(ERROR) << __FUNCTION__ << " - Unable to write the sample queue\n";
+}
+
+void Thermal::getCpuUtilization(const IThermalExt::getCpuUtilization_cb& _hidl_cb) {
+    if (!waitReady()) {
+        _hidl_cb(false, {}, {});
+        return;
+    }
+
+    std::lock_guard<std::mutex> _lock(_cpuRepliesMutex);
+    hidl_vec<uint32_t> windowsMs;
+    hidl_vec<CpuUtilization> cpus;
+    const bool success = _cpuSampler.getUtilization(&windowsMs, &_cpuUtilizationReplies);
+
+    if (success) cpus.setToExternal(_cpuUtilizationReplies.data(), _cpuUtilizationReplies.size());
+    _hidl_cb(success, windowsMs, cpus);
+}
+
+const SampleQueue* Thermal::getSampleQueue() {
+    if (!waitReady()) return nullptr;
+
+    std::lock_guard<std::mutex> lock(_queueMutex);
+
+    if (!_sampleQueue && !_thermalZones.empty()) {
+        const size_t periods =
+            android::base::GetUintProperty<uint32_t>(kStreamQueuePeriodsProperty, 128);
+        auto queue =
+            std::make_unique<SampleQueue>(std::max<size_t>(periods, 1) * _thermalZones.size());
+
+        if (!queue->isValid()) {
+            LOG(ERROR) << __FUNCTION__ << " - Unable to create the sample queue\n";
+            return nullptr;
+        }
+
+        _streamedSamples.resize(_thermalZones.size());
+        for (size_t i = 0; i < _streamedSamples.size(); ++i) {
+            _streamedSamples[i].zoneIndex = i;
+            _streamedSamples[i].zoneCount = _streamedSamples.size();
+        }
+        _sampleQueue = std::move(queue);
+        // Clients may have requested a period before getting the queue
+        updateStreamInterval();
+        wakeMonitor();
+    }
+
+    return _sampleQueue.get();
+}
+
+bool Thermal::setStreamInterval(const sp<IBase>& client, std::chrono::milliseconds interval) {
+    if (!waitReady()) return false;
+
+    {
+        std::lock_guard<std::mutex> lock(_queueMutex);
+        auto found = std::find_if(
+            _streamClients.begin(), _streamClients.end(),
+            [&client](const StreamClient& item) { return interfacesEqual(item.client, client); });
+
+        if (!interval.count()) {
+            if (found != _streamClients.end()) {
+                found->client->unlinkToDeath(_streamDeathRecipient);
+                _streamClients.erase(found);
+            }
+        } else if (found != _streamClients.end()) {
+            found->interval = interval;
+        } else {
+            const uint64_t cookie = _nextStreamCookie++;
+
+            // In-process clients cannot die without us, remote ones failing to link already did
+            if (client->isRemote()) {
+                Return<bool> linked = client->linkToDeath(_streamDeathRecipient, cookie);
+
+                if (!linked.isOk() || !linked) {
+                    LOG(ERROR) << __FUNCTION__ << " - Streaming client already dead\n";
+                    return false;
                 }
             }
+            _streamClients.push_back({client, interval, cookie});
         }
-    } while(std::this_thread::sleep_for(sleepDuration), true);
+        updateStreamInterval();
+    }
+
+    wakeMonitor();
+    return true;
+}
+
+void Thermal::StreamDeathRecipient::serviceDied(uint64_t cookie, const wp<IBase>& /* who */) {
+    _thermal->removeStreamClient(cookie);
+}
+
+void Thermal::removeStreamClient(uint64_t cookie) {
+    {
+        std::lock_guard<std::mutex> lock(_queueMutex);
+        auto found = std::find_if(
+            _streamClients.begin(), _streamClients.end(),
+            [cookie](const StreamClient& item) { return item.cookie == cookie; });
+
+        if (found == _streamClients.end()) return;
+        LOG(INFO) << __FUNCTION__ << " - Streaming client died\n";
+        _streamClients.erase(found);
+        updateStreamInterval();
+    }
+
+    wakeMonitor();
+}
+
+void Thermal::updateStreamInterval() {
+    std::chrono::milliseconds interval = std::chrono::milliseconds::zero();
+
+    // Without the queue, nobody could read the samples: the zones must not even be read
+    if (_sampleQueue) {
+        for (const auto& item : _streamClients) {
+            if (!interval.count() || item.interval < interval) interval = item.interval;
+        }
+    }
+
+    if (interval != _streamInterval.load()) {
+        LOG(INFO) << __FUNCTION__ << " - Streaming every " << interval.count() << "ms, "
+                  << _streamClients.size() << " client(s)\n";
+        _streamInterval = interval;
+    }
+}
+
+void Thermal::initSnapshot() {
+    _snapshot.zones.clear();
+    for (size_t i = 0; i < _thermalZones.size(); ++i) {
+        _snapshot.zones.push_back({.name = _thermalZones.getZone(i)._temp.name,
+                                   .type = _thermalZones.getType(i),
+                                   .value = _thermalZones.getValue(i),
+                                   .rawValue = _thermalZones.getRawValue(i),
+                                   .severity = _thermalZones.getSeverity(i),
+                                   .min = std::numeric_limits<float>::infinity(),
+                                   .max = -std::numeric_limits<float>::infinity(),
+                                   .sum = 0,
+                                   .samples = 0,
+                                   .transitions = 0,
+                                   .severityTicks = {}});
+    }
+
+    _snapshot.coolingDevices.clear();
+    for (size_t i = 0; i < _coolingDevices.size(); ++i) {
+        _snapshot.coolingDevices.push_back({.name = _coolingDevices.getDevice(i)._dev.name,
+                                            .type = _coolingDevices.getType(i),
+                                            .value = _coolingDevices.getValue(i),
+                                            .transitions = 0});
+    }
+}
+
+void Thermal::updateSnapshot() {
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    _snapshot.timeMs = now.tv_sec * 1000ll + now.tv_nsec / 1000000;
+    _snapshot.ticks++;
+
+    for (size_t i = 0; i < _snapshot.zones.size(); ++i) {
+        ThermalSnapshot::Zone& zone = _snapshot.zones[i];
+        const float value = _thermalZones.getValue(i);
+        const ThrottlingSeverity severity = _thermalZones.getSeverity(i);
+
+        if (zone.samples && zone.severity != severity) zone.transitions++;
+        zone.value = value;
+        zone.rawValue = _thermalZones.getRawValue(i);
+        zone.severity = severity;
+        zone.min = std::min(zone.min, value);
+        zone.max = std::max(zone.max, value);
+        zone.sum += value;
+        zone.samples++;
+        zone.severityTicks[static_cast<size_t>(severity)]++;
+    }
+
+    for (size_t i = 0; i < _snapshot.coolingDevices.size(); ++i) {
+        ThermalSnapshot::Cooling& cooling = _snapshot.coolingDevices[i];
+        const uint64_t value = _coolingDevices.getValue(i);
+
+        if (_snapshot.ticks > 1 && cooling.value != value) cooling.transitions++;
+        cooling.value = value;
+    }
+
+    /* At most one /proc/stat parsing per polling period, shared with the getCpuUsages()
+       callers. A failed parsing keeps the previous counters */
+    if (_exporter.isStarted()) _cpuSampler.getUsages(&_snapshot.cpus);
+}
+
+void Thermal::recordSample() {
+    if (!_recorder.isOpen()) return;
+
+    bool critical = false;
+    auto value = _recordedValues.begin();
+
+    for (size_t i = 0; i < _thermalZones.size(); ++i) {
+        *value++ = std::lround(_thermalZones.getValue(i) * 1000);
+        // A shutdown may be imminent, so the readings must reach the storage right away
+        critical |= _thermalZones.getSeverity(i) >= ThrottlingSeverity::EMERGENCY;
+    }
+    for (size_t i = 0; i < _coolingDevices.size(); ++i) *value++ = _coolingDevices.getValue(i);
+
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    _recorder.record(now.tv_sec * 1000ll + now.tv_nsec / 1000000, _recordedValues.data(),
+                     critical);
+}
+
+void Thermal::openRecorder() {
+    size_t size = android::base::GetUintProperty<uint32_t>(kRecorderSizeProperty, 256) * 1024;
+    std::vector<FlightRecorderChannel> channels;
+
+    if (!size) return;
+
+    auto addChannel = [&channels](FlightRecorderChannelKind kind, int type,
+                                  const hidl_string& name) {
+        FlightRecorderChannel channel{.kind = kind, .type = static_cast<int8_t>(type), .name = {}};
+
+        strncpy(channel.name, name.c_str(), sizeof(channel.name) - 1);
+        channels.push_back(channel);
+    };
+    for (size_t i = 0; i < _thermalZones.size(); ++i)
+        addChannel(FlightRecorderChannelKind::TEMPERATURE,
+                   static_cast<int>(_thermalZones.getType(i)), _thermalZones.getZone(i)._temp.name);
+    for (size_t i = 0; i < _coolingDevices.size(); ++i)
+        addChannel(FlightRecorderChannelKind::COOLING, static_cast<int>(_coolingDevices.getType(i)),
+                   _coolingDevices.getDevice(i)._dev.name);
+
+    if (_recorder.open(FlightRecorder::_kDefaultPath, size, channels))
+        _recordedValues.resize(channels.size());
+}
+
+bool Thermal::isIdle() const {
+    for (size_t i = 0; i < _thermalZones.size(); ++i) {
+        if (_thermalZones.getHeadroom(i) < _idleMargin) return false;
+    }
+    return true;
+}
+
+void Thermal::armTimer(std::chrono::nanoseconds interval) {
+    using namespace std::chrono;
+    itimerspec spec{};
+
+    spec.it_value.tv_sec = duration_cast<seconds>(interval).count();
+    spec.it_value.tv_nsec = duration_cast<nanoseconds>(interval % 1s).count();
+    if (timerfd_settime(_timerFd, 0, &spec, nullptr))
+        LOG(ERROR) << __FUNCTION__ << " - timerfd_settime error(" << strerror(errno) << ")\n";
+}
+
+void Thermal::wakeMonitor() {
+    uint64_t one = 1;
+
+    if (_eventFd.ok() && TEMP_FAILURE_RETRY(write(_eventFd, &one, sizeof(one))) < 0)
+        LOG(ERROR) << __FUNCTION__ << " - eventfd write error(" << strerror(errno) << ")\n";
 }
 
 std::thread Thermal::run() {
-    return std::thread(&Thermal::monitorFunc, this);
+    using android::base::GetUintProperty;
+
+    _schedule._pollInterval = std::chrono::milliseconds(
+        GetUintProperty<uint32_t>(kPollIntervalProperty, _schedule._pollInterval.count()));
+    _schedule._idleInterval = std::chrono::milliseconds(
+        GetUintProperty<uint32_t>(kIdleIntervalProperty, _schedule._idleInterval.count()));
+    _idleMargin =
+        GetUintProperty<uint32_t>(kIdleMarginProperty, static_cast<uint32_t>(_idleMargin));
+
+    _eventFd.reset(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+    _timerFd.reset(timerfd_create(CLOCK_BOOTTIME, TFD_CLOEXEC | TFD_NONBLOCK));
+    _epollFd.reset(epoll_create1(EPOLL_CLOEXEC));
+
+    for (int fd : {_eventFd.get(), _timerFd.get()}) {
+        epoll_event event;
+
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+
+        if (fd < 0 || _epollFd < 0 || epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &event))
+            LOG(FATAL) << __FUNCTION__ << " - Unable to set the monitoring up("
+                       << strerror(errno) << ")\n";
+    }
+
+    _monitorScheduling = ThreadScheduling::fromProperties("sampler", kSamplerSchedulingPrefix);
+
+    _cpuSampler.init();
+    openRecorder();
+    initSnapshot();
+    _exporter.start();
+
+    std::thread monitor(&Thermal::monitorFunc, this);
+    {
+        std::lock_guard<std::mutex> lock(_readyMutex);
+        _ready = true;
+    }
+    _readyCondition.notify_all();
+
+    return monitor;
+}
+
+bool Thermal::waitReady() {
+    std::unique_lock<std::mutex> lock(_readyMutex);
+
+    if (!_readyCondition.wait_for(lock, kReadyTimeout, [this] { return _ready; })) {
+        LOG(ERROR) << __FUNCTION__ << " - " << kNotReadyMessage << "\n";
+        return false;
+    }
+    return true;
 }
 
 }  // namespace android::hardware::thermal::V2_0::implementation
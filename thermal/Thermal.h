@@ -18,15 +18,34 @@
 #ifndef __THERMAL_CPP__
 #define __THERMAL_CPP__
 
+#include <android-base/unique_fd.h>
+#include <fmq/MessageQueue.h>
+#include <vendor/ti/hardware/thermal/1.0/IThermalExt.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <thread>
-#include <unordered_map>
 
-#include "CoolDevice.h"
-#include "ThermalZone.h"
+#include "CpuSampler.h"
+#include "FlightRecorder.h"
+#include "MetricsExporter.h"
+#include "MonitorSchedule.h"
+#include "Scheduling.h"
+#include "SensorTable.h"
+#include "ThermalConfig.h"
 
 namespace android::hardware::thermal::V2_0::implementation {
 
-using ::android::hardware::thermal::V1_0::CpuUsage;
+using ::android::wp;
+using ::android::hardware::hidl_death_recipient;
+using ::android::hardware::kUnsynchronizedWrite;
+using ::android::hardware::MessageQueue;
+using ::android::hidl::base::V1_0::IBase;
+using ::vendor::ti::hardware::thermal::V1_0::IThermalExt;
+using ::vendor::ti::hardware::thermal::V1_0::ZoneSample;
+
+using SampleQueue = MessageQueue<ZoneSample, kUnsynchronizedWrite>;
 
 class Thermal : public IThermal {
    public:
@@ -49,13 +68,49 @@ class Thermal : public IThermal {
     Return<void> getCurrentCoolingDevices(bool filterType, CoolingType type,
                                           getCurrentCoolingDevices_cb _hidl_cb) override;
 
-    // Loads the thermal sensors and cooling devices
+    /* Loads the thermal sensors and cooling devices. May run once the service is registered, HAL
+       calls waiting for run() to complete */
     bool loadDevices();
 
     // Starts the monitoring(listener client callbacks) service
     std::thread run();
 
+    /* Runs one period of the monitoring thread at now(CLOCK_BOOTTIME): samples, streams and
+       notifies the listeners when due. Returns how long to wait for the next one, zero meaning
+       until woken up. Public for the tests, which run it without the monitoring thread */
+    std::chrono::nanoseconds monitorTick(std::chrono::nanoseconds now);
+
+    // Replies the utilization of every CPU over the sampler windows(see IThermalExt)
+    void getCpuUtilization(const IThermalExt::getCpuUtilization_cb& _hidl_cb);
+    // Gets the queue zone readings are streamed into(see IThermalExt), nullptr if unavailable
+    const SampleQueue* getSampleQueue();
+    /* Sets the streaming period requested by a client, 0 withdrawing its request. Fails when the
+       devices aren't loaded or the client is dead */
+    bool setStreamInterval(const sp<IBase>& client, std::chrono::milliseconds interval);
+
    private:
+    // Withdraws the streaming request of a client upon its death
+    class StreamDeathRecipient : public hidl_death_recipient {
+       public:
+        StreamDeathRecipient(Thermal* thermal) : _thermal(thermal) {}
+        void serviceDied(uint64_t cookie, const wp<IBase>& who) override;
+
+       private:
+        Thermal* _thermal;
+    };
+
+    // Streaming period requested by a client, the cookie identifying it to the death recipient
+    struct StreamClient {
+        sp<IBase> client;
+        std::chrono::milliseconds interval;
+        uint64_t cookie;
+    };
+
+    // Set by run(), once the devices are loaded and the monitoring is set up
+    std::mutex _readyMutex;
+    std::condition_variable _readyCondition;
+    bool _ready = false;
+
     /* _callback_mutex synchronizes acces to _callbacks by (un)registerThermalChangedCallback()
        and our internal monitoring thread itself */
     std::mutex _callback_mutex;
@@ -68,12 +123,98 @@ class Thermal : public IThermal {
     */
     std::vector<callbackItems> _callbacks;
 
-    // Stores thermal zones V2.0 by type(CPU, BATTERY, ...)
-    std::unordered_multimap<TemperatureType, ThermalZone> _thermalZones;
-    // Stores cooling devices V2.0 by type(FAN, CPU, ...)
-    std::unordered_multimap<CoolingType, CoolDevice> _coolingDevices;
+    /* _devices_mutex synchronizes the readings of the devices below, and the use of the replies
+       storage, between the getters and our internal monitoring thread. The set of devices itself
+       never changes once loaded */
+    std::mutex _devices_mutex;
+
+    // Vendor settings of the sensors
+    ThermalConfig _config;
+
+    // Stores thermal zones V2.0 grouped by type(CPU, BATTERY, ...)
+    ZoneTable _thermalZones;
+    // Stores cooling devices V2.0 grouped by type(FAN, CPU, ...)
+    CoolingTable _coolingDevices;
+
+    /* Replies storage, sized once the devices are loaded so that no allocation occurs afterwards.
+       The names they hold reference the tables ones */
+    std::vector<Temperature> _temperatureReplies;
+    std::vector<Temperature_1_0> _temperatureReplies_1_0;
+    std::vector<TemperatureThreshold> _thresholdReplies;
+    std::vector<Temperature> _notifiedTemperatures;
+    std::vector<CoolingDevice> _coolingReplies;
+    std::vector<CoolingDevice_1_0> _coolingReplies_1_0;
+
+    /* Monitoring schedule. The polling timer runs on CLOCK_BOOTTIME without the _ALARM flavor:
+       it never wakes the SoC up by itself, but it expires right away upon resume when the
+       interval elapsed while suspended, so clients get fresh data as soon as we are back */
+    MonitorSchedule _schedule;
+    // The zones are idle when they are all at least _idleMargin below their thresholds
+    float _idleMargin = 10;
+
+    // Scheduling of the monitoring thread, which samples the devices and notifies the listeners
+    ThreadScheduling _monitorScheduling;
+
+    // Wakes the monitoring thread up whenever its schedule has to be reevaluated
+    android::base::unique_fd _eventFd;
+    android::base::unique_fd _timerFd;
+    // Polls on _eventFd and _timerFd
+    android::base::unique_fd _epollFd;
+
+    // Keeps the latest readings of every device across reboots
+    FlightRecorder _recorder;
+    std::vector<int32_t> _recordedValues;
+
+    /* Streams the zone readings every _streamInterval, created on the first client request.
+       _queueMutex protects the queue and the clients */
+    std::mutex _queueMutex;
+    std::unique_ptr<SampleQueue> _sampleQueue;
+    std::vector<StreamClient> _streamClients;
+    uint64_t _nextStreamCookie = 0;
+    sp<StreamDeathRecipient> _streamDeathRecipient = new StreamDeathRecipient(this);
+    // Shortest period requested by the clients alive, 0 without any client or queue
+    std::atomic<std::chrono::milliseconds> _streamInterval{std::chrono::milliseconds::zero()};
+    std::vector<ZoneSample> _streamedSamples;
+    uint32_t _streamedPeriod = 0;
+
+    // Serves getCpuUsages() and getCpuUtilization()
+    CpuSampler _cpuSampler;
+    // Replies storage of the CPU getters, sized by their first call and held while replying
+    std::mutex _cpuRepliesMutex;
+    std::vector<CpuUsage> _cpuUsageReplies;
+    std::vector<CpuUtilization> _cpuUtilizationReplies;
+
+    // Latest readings and statistics, served to local clients by _exporter
+    ThermalSnapshot _snapshot;
+    MetricsExporter _exporter;
 
+    // Adds the hwmon temperature channels to the sensors found
+    void loadHwmonSensors(std::vector<std::optional<ThermalZone>>* ioSensors);
+    // Waits for run() to complete, false when it takes too long
+    bool waitReady();
     void monitorFunc();
+    // Reads every device, advancing the zone filters. Only run on the polling period
+    void sampleDevices();
+    // Writes the zones as last read into _sampleQueue
+    void streamSample(std::chrono::nanoseconds now);
+    // Removes the streaming request of a dead client
+    void removeStreamClient(uint64_t cookie);
+    // Sets _streamInterval from the clients requests, _queueMutex being held
+    void updateStreamInterval();
+    // Updates _snapshot with the values read by the last sampleDevices()
+    void updateSnapshot();
+    // Sizes _snapshot after the loaded devices
+    void initSnapshot();
+    // Feeds _recorder with the values read by the last sampleDevices()
+    void recordSample();
+    // Maps the flight recorder file, its channels being the loaded devices
+    void openRecorder();
+    // Tells whether every thermal zone is far enough below its throttling thresholds
+    bool isIdle() const;
+    // Arms(or disarms when null) the polling timer
+    void armTimer(std::chrono::nanoseconds interval);
+    // Forces the monitoring thread to reevaluate its schedule
+    void wakeMonitor();
 };
 
 }  // namespace android::hardware::thermal::V2_0::implementation
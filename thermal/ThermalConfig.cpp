@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ThermalConfig.h"
+
+#include <android-base/logging.h>
+
+#include <fstream>
+#include <sstream>
+
+namespace android::hardware::thermal::V2_0::implementation {
+
+bool ThermalConfig::load(const char* iPath) {
+    std::ifstream file(iPath);
+
+    _sensors.clear();
+    if (!file.is_open()) {
+        LOG(INFO) << __FUNCTION__ << " - No " << iPath << ", using the default settings\n";
+        return true;
+    }
+
+    std::string line;
+    bool ok = true;
+    for (unsigned lineNumber = 1; std::getline(file, line); ++lineNumber) {
+        std::istringstream args(line);
+        std::string sensor, key;
+
+        if (!(args >> sensor) || '#' == sensor[0]) continue;
+
+        args >> key;
+        SensorConfig& config = _sensors[sensor];
+        if ("type" == key && parseType(args, &config.type)) continue;
+        if ("filter" == key && parseFilter(args, &config.filter)) continue;
+
+        LOG(ERROR) << __FUNCTION__ << " - " << iPath << ":" << lineNumber << ": invalid setting '"
+                   << line << "'\n";
+        ok = false;
+    }
+
+    return ok;
+}
+
+bool ThermalConfig::parseType(std::istream& iArgs, std::optional<TemperatureType>* oType) {
+    std::string name;
+
+    iArgs >> name;
+    for (auto value = static_cast<int32_t>(TemperatureType::UNKNOWN);
+         value <= static_cast<int32_t>(TemperatureType::NPU); ++value) {
+        const auto type = static_cast<TemperatureType>(value);
+
+        if (toString(type) == name) {
+            *oType = type;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool ThermalConfig::parseFilter(std::istream& iArgs, SensorFilter* oFilter) {
+    std::string kind;
+    SensorFilter filter;
+
+    iArgs >> kind;
+    if ("none" == kind) {
+        filter.kind = SensorFilter::Kind::NONE;
+    } else if ("ema" == kind) {
+        filter.kind = SensorFilter::Kind::EMA;
+        if (!(iArgs >> filter.alpha) || filter.alpha <= 0 || filter.alpha > 1) return false;
+    } else if ("median" == kind) {
+        filter.kind = SensorFilter::Kind::MEDIAN;
+        if (!(iArgs >> filter.window) || !(filter.window % 2) || filter.window > kMaxMedianWindow)
+            return false;
+    } else
+        return false;
+
+    *oFilter = filter;
+    return true;
+}
+
+const SensorConfig& ThermalConfig::getSensor(const std::string& iName) const {
+    static const SensorConfig defaults;
+    auto found = _sensors.find(iName);
+
+    return found != _sensors.end() ? found->second : defaults;
+}
+
+}  // namespace android::hardware::thermal::V2_0::implementation
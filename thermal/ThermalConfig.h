@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __THERMAL_CONFIG_CPP__
+#define __THERMAL_CONFIG_CPP__
+
+#include <android/hardware/thermal/2.0/IThermal.h>
+
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+namespace android::hardware::thermal::V2_0::implementation {
+
+// Largest median filter window, bounding the filtering cost of a reading
+static constexpr uint32_t kMaxMedianWindow = 9;
+
+// Noise filter applied to the readings of a sensor before its severity is evaluated
+struct SensorFilter {
+    enum class Kind { NONE, EMA, MEDIAN };
+
+    Kind kind = Kind::NONE;
+    // EMA: weight of the new reading, in ]0, 1]
+    float alpha = 1;
+    // MEDIAN: number of readings the median is taken from, odd and up to kMaxMedianWindow
+    uint32_t window = 1;
+};
+
+// Per sensor settings
+struct SensorConfig {
+    // Overrides the built-in mapping of the sensor name to a temperature type
+    std::optional<TemperatureType> type;
+    SensorFilter filter;
+};
+
+/* Vendor sensor configuration. One setting per line, sensors being designated by their sysfs type
+   name, or for hwmon channels by <chip name>-<channel label or tempN>:
+     <sensor> type <TemperatureType, e.g CPU, SKIN>
+     <sensor> filter none
+     <sensor> filter ema <alpha>
+     <sensor> filter median <window>
+   Blank lines and lines starting with '#' are ignored */
+class ThermalConfig {
+   public:
+    static constexpr char _kDefaultPath[] = "/vendor/etc/thermal_sensors.conf";
+
+    // Loads the file, a missing one meaning defaults for every sensor
+    bool load(const char* iPath);
+
+    // Gets the settings of a sensor, the defaults when it isn't configured
+    const SensorConfig& getSensor(const std::string& iName) const;
+
+   private:
+    std::unordered_map<std::string, SensorConfig> _sensors;
+
+    bool parseType(std::istream& iArgs, std::optional<TemperatureType>* oType);
+    bool parseFilter(std::istream& iArgs, SensorFilter* oFilter);
+};
+
+}  // namespace android::hardware::thermal::V2_0::implementation
+
+#endif  // #ifndef __THERMAL_CONFIG_CPP__
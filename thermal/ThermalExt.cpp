@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ThermalExt.h"
+
+#include <android-base/logging.h>
+
+namespace vendor::ti::hardware::thermal::V1_0::implementation {
+
+using ::android::hardware::MQDescriptorUnsync;
+using ::android::hardware::Void;
+
+// Streaming periods supported by setStreamInterval(), i.e 1 to 100 Hz
+static constexpr uint32_t kMinStreamIntervalMs = 10;
+static constexpr uint32_t kMaxStreamIntervalMs = 1000;
+
+Return<void> ThermalExt::getSampleQueue(getSampleQueue_cb _hidl_cb) {
+    if (!_hidl_cb) return Void();
+
+    const auto* queue = _thermal->getSampleQueue();
+
+    if (queue)
+        _hidl_cb(true, *queue->getDesc());
+    else
+        _hidl_cb(false, MQDescriptorUnsync<ZoneSample>());
+
+    return Void();
+}
+
+Return<bool> ThermalExt::setStreamInterval(const sp<IBase>& client, uint32_t intervalMs) {
+    if (!client) {
+        LOG(ERROR) << __FUNCTION__ << " - Missing client\n";
+        return false;
+    }
+    if (intervalMs && (intervalMs < kMinStreamIntervalMs || intervalMs > kMaxStreamIntervalMs)) {
+        LOG(ERROR) << __FUNCTION__ << " - Unsupported interval " << intervalMs << "ms\n";
+        return false;
+    }
+
+    return _thermal->setStreamInterval(client, std::chrono::milliseconds(intervalMs));
+}
+
+Return<void> ThermalExt::getCpuUtilization(getCpuUtilization_cb _hidl_cb) {
+    if (!_hidl_cb) return Void();
+
+    _thermal->getCpuUtilization(_hidl_cb);
+    return Void();
+}
+
+}  // namespace vendor::ti::hardware::thermal::V1_0::implementation
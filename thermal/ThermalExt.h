@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __THERMAL_EXT_CPP__
+#define __THERMAL_EXT_CPP__
+
+#include <vendor/ti/hardware/thermal/1.0/IThermalExt.h>
+
+#include <memory>
+
+#include "Thermal.h"
+
+namespace vendor::ti::hardware::thermal::V1_0::implementation {
+
+using ::android::sp;
+using ::android::hardware::Return;
+using ::android::hardware::thermal::V2_0::implementation::Thermal;
+using ::android::hidl::base::V1_0::IBase;
+
+// TI extensions of the thermal HAL, backed by the Thermal service instance
+class ThermalExt : public IThermalExt {
+   public:
+    ThermalExt(std::shared_ptr<Thermal> thermal) : _thermal(std::move(thermal)) {}
+
+    // Methods from ::vendor::ti::hardware::thermal::V1_0::IThermalExt follow.
+    Return<void> getSampleQueue(getSampleQueue_cb _hidl_cb) override;
+    Return<bool> setStreamInterval(const sp<IBase>& client, uint32_t intervalMs) override;
+    Return<void> getCpuUtilization(getCpuUtilization_cb _hidl_cb) override;
+
+   private:
+    std::shared_ptr<Thermal> _thermal;
+};
+
+}  // namespace vendor::ti::hardware::thermal::V1_0::implementation
+
+#endif  // #ifndef __THERMAL_EXT_CPP__
@@ -18,15 +18,18 @@
 #include "ThermalZone.h"
 
 #include <android-base/logging.h>
+#include <fcntl.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
-#include <regex>
 #include <unordered_map>
 
 namespace android::hardware::thermal::V2_0::implementation {
 
-ThermalZone::ThermalZone(std::string&& iSysFileName) noexcept
-    : ThermalDeviceDir(std::move(iSysFileName)) {
+ThermalZone::ThermalZone(std::string&& iSysFileName, const char* iBasePath) noexcept
+    : ThermalDeviceDir(std::move(iSysFileName), iBasePath) {
     std::string typeName;
 
     // Unfortunately, cannot use _temp.name directly (hidl_string);
@@ -36,25 +39,71 @@ ThermalZone::ThermalZone(std::string&& iSysFileName) noexcept
     _temp.type = mapSysfsToTemperatureType(_temp.name);
     _temp.value = -1;
     _temp.throttlingStatus = ThrottlingSeverity::NONE;
+    _tempFd = openFile("temp");
 }
 
-// Temperature_1_0 conversion operator. Cannot handle some v2.0 temperature types
-ThermalZone::operator Temperature_1_0() const {
-    return Temperature_1_0{
-        .type = static_cast<TemperatureType_1_0>(_temp.type),
-        .name = _temp.name,
-        .currentValue = _temp.value,
-        .throttlingThreshold =
-            _hotThrottlingThresholds[static_cast<std::underlying_type_t<ThrottlingSeverity>>(
-                ThrottlingSeverity::SEVERE)],
-        .shutdownThreshold =
-            _hotThrottlingThresholds[static_cast<std::underlying_type_t<ThrottlingSeverity>>(
-                ThrottlingSeverity::SHUTDOWN)],
-        .vrThrottlingThreshold = _vrThrottlingThreshold};
+ThermalZone::ThermalZone(std::string&& iHwmonDirName, unsigned iChannel) noexcept
+    : ThermalDeviceDir(std::move(iHwmonDirName), _sysHwmonPath), _hwmonChannel(iChannel) {
+    const std::string channel = std::string("temp").append(std::to_string(iChannel));
+    std::string chipName, label;
+
+    getInputStream("name") >> chipName;
+    // Labels are free text, while sensor names must be single words for ThermalConfig
+    std::getline(getInputStream(channel + "_label"), label);
+    std::replace(label.begin(), label.end(), ' ', '_');
+
+    _temp.name = chipName.append("-").append(label.empty() ? channel : label);
+    _temp.type = mapSysfsToTemperatureType(_temp.name);
+    _temp.value = -1;
+    _temp.throttlingStatus = ThrottlingSeverity::NONE;
+    _tempFd = openFile(std::string(channel).append("_input").c_str());
+}
+
+android::base::unique_fd ThermalDeviceDir::openFile(const char* iFileName) const {
+    android::base::unique_fd fd(
+        open(std::string(_sysDirPath).append(iFileName).c_str(), O_RDONLY | O_CLOEXEC));
+
+    if (fd < 0)
+        LOG(ERROR) << __FUNCTION__ << " - Unable to open " << _sysDirPath << iFileName << "("
+                   << strerror(errno) << ")\n";
+    return fd;
+}
+
+bool ThermalDeviceDir::readValue(int iFd, int64_t* oValue) {
+    char buffer[24];
+    // sysfs regenerates the attribute content upon each read from offset 0
+    ssize_t len = TEMP_FAILURE_RETRY(pread(iFd, buffer, sizeof(buffer) - 1, 0));
+
+    if (len <= 0) return false;
+    buffer[len] = '\0';
+
+    char* end;
+    errno = 0;
+    long long value = strtoll(buffer, &end, 10);
+    if (errno || end == buffer) return false;
+
+    *oValue = value;
+    return true;
+}
+
+bool ThermalDeviceDir::parseIndexedName(const char* iName, const char* iPrefix,
+                                        const char* iSuffix, unsigned* oIndex) {
+    const size_t prefixLength = strlen(iPrefix);
+
+    if (strncmp(iName, iPrefix, prefixLength) || !isdigit(iName[prefixLength])) return false;
+
+    char* end;
+    unsigned long index = strtoul(iName + prefixLength, &end, 10);
+    if (strcmp(end, iSuffix)) return false;
+
+    *oIndex = index;
+    return true;
 }
 
 // Reads sensor's static data
 bool ThermalZone::init() {
+    if (_hwmonChannel) return initHwmon();
+
     std::unique_ptr<DIR, int (*)(DIR*)> thermalPath{opendir(_sysDirPath.c_str()), closedir};
 
     if (!thermalPath) {
@@ -64,8 +113,7 @@ bool ThermalZone::init() {
 
     errno = 0;
     dirent* tz = nullptr;
-    const std::regex tzTripTypePat("trip_point_[0-9]+_type$");
-    const std::regex tzTripTempPat("_type$");
+    unsigned tripPoint;
     bool ok = true;
 
     while ((tz = readdir(thermalPath.get())) && !errno) {
@@ -75,13 +123,13 @@ bool ThermalZone::init() {
             ok = false;
             break;
         }
-        if (std::regex_search(tz->d_name, tzTripTypePat)) {
+        if (parseIndexedName(tz->d_name, "trip_point_", "_type", &tripPoint)) {
             // Found a trip_pointX_type file
             std::string tripPointType;
 
             getInputStream(tz->d_name) >> tripPointType;
             auto tempFile =
-                getInputStream(regex_replace(std::string(tz->d_name), tzTripTempPat, "_temp"));
+                getInputStream("trip_point_" + std::to_string(tripPoint) + "_temp");
             float temp;
 
             tempFile >> temp;
@@ -109,6 +157,31 @@ bool ThermalZone::init() {
     return ok;
 }
 
+bool ThermalZone::initHwmon() {
+    const std::string channel = std::string("temp").append(std::to_string(_hwmonChannel));
+    /* Like for trip points, the association between a hwmon limit and a ThrottlingSeverity value
+       is arbitrary, but the critical limit is the shutdown one for both backends, as
+       getTemperatureThresholds() only reports the zones having one. The emergency limit, above
+       the critical one, only stands in for it when the chip has none: it's read first so that
+       _crit overrides it */
+    static const std::pair<const char*, ThrottlingSeverity> limits[] = {
+        {"_max", ThrottlingSeverity::SEVERE},
+        {"_emergency", ThrottlingSeverity::SHUTDOWN},
+        {"_crit", ThrottlingSeverity::SHUTDOWN}};
+
+    for (const auto& [suffix, severity] : limits) {
+        auto limitFile = getInputStream(channel + suffix);
+        float temp;
+
+        // Every limit is optional
+        if (limitFile >> temp)
+            _hotThrottlingThresholds[static_cast<std::underlying_type_t<ThrottlingSeverity>>(
+                severity)] = temp / 1000;
+    }
+
+    return true;
+}
+
 TemperatureType ThermalZone::mapSysfsToTemperatureType(const std::string& sysTypeName) {
     static const std::unordered_map<std::string, TemperatureType> sysTypeNameMap = {
         {"main0-thermal", TemperatureType::CPU},  // The one from our .dtsi
@@ -120,20 +193,4 @@ TemperatureType ThermalZone::mapSysfsToTemperatureType(const std::string& sysTyp
     return (foundTemp != sysTypeNameMap.end() ? foundTemp->second : TemperatureType::UNKNOWN);
 }
 
-// Sets the throttling status based on the current temperature and the throttling thresholds.
-void ThermalZone::getThrottlingStatus() {
-    constexpr size_t severityCount = decltype(_hotThrottlingThresholds)::size();
-
-    _temp.throttlingStatus = ThrottlingSeverity::NONE;
-
-    for (auto i = 0; i < severityCount; ++i) {
-        if (_hotThrottlingThresholds[i] != -1) {
-            if (_temp.value >= _hotThrottlingThresholds[i])
-                _temp.throttlingStatus = static_cast<ThrottlingSeverity>(i);
-            else
-                break;
-        }
-    }
-}
-
 }  // namespace android::hardware::thermal::V2_0::implementation
@@ -18,6 +18,7 @@
 #ifndef __THERMAL_ZONE_CPP__
 #define __THERMAL_ZONE_CPP__
 
+#include <android-base/unique_fd.h>
 #include <android/hardware/thermal/2.0/IThermal.h>
 
 #include <fstream>
@@ -44,21 +45,34 @@ static_assert(static_cast<std::underlying_type_t<TemperatureType_1_0>>(Temperatu
 class ThermalDeviceDir {
    public:
     static constexpr char _sysThermalPath[] = "/sys/class/thermal/";
+    static constexpr char _sysHwmonPath[] = "/sys/class/hwmon/";
 
-    // Full path of thermalzone[0-9]+/ or cooling_device[0-9]+/ directory
+    // Full path of thermalzone[0-9]+/, cooling_device[0-9]+/ or hwmon[0-9]+/ directory
     const std::string _sysDirPath;
 
+    /* Reads the integer an opened sysfs file starts with. Neither allocates nor reopens the file,
+       which makes it fit for periodic readings */
+    static bool readValue(int iFd, int64_t* oValue);
+
+    // Tells whether a name is iPrefix, a number and iSuffix, e.g thermal_zone3, and gets the number
+    static bool parseIndexedName(const char* iName, const char* iPrefix, const char* iSuffix,
+                                 unsigned* oIndex);
+
    protected:
-    ThermalDeviceDir(std::string&& iSysDirName)
-        : _sysDirPath(std::string(_sysThermalPath).append(std::move(iSysDirName)).append("/")) {}
+    ThermalDeviceDir(std::string&& iSysDirName, const char* iBasePath = _sysThermalPath)
+        : _sysDirPath(std::string(iBasePath).append(std::move(iSysDirName)).append("/")) {}
 
     // Gets a input stream from a file inside the sensor directory(i.e _sysFileName)
     std::ifstream getInputStream(std::string&& iFileName) const {
         return std::ifstream(std::string(_sysDirPath).append(std::move(iFileName)));
     }
+
+    // Opens a file inside the sensor directory, to be read repeatedly with readValue()
+    android::base::unique_fd openFile(const char* iFileName) const;
 };
 
-// Describes thermal zones as defined in V 2.0.
+/* Describes thermal zones as defined in V 2.0, backed by either a thermal class zone or a hwmon
+   temperature channel. Only holds the static data, the readings are kept by ZoneTable */
 class ThermalZone : public ThermalDeviceDir {
    private:
     // trip point levels as defined in trip_point_X_type files
@@ -72,7 +86,11 @@ class ThermalZone : public ThermalDeviceDir {
     static TemperatureType mapSysfsToTemperatureType(const std::string& sysTypeName);
 
    public:
-    ThermalZone(std::string&& iSysFileName) noexcept;
+    // Thermal zone <iBasePath><iSysFileName>, the benchmarks using their own mock sysfs
+    ThermalZone(std::string&& iSysFileName, const char* iBasePath = _sysThermalPath) noexcept;
+    /* Temperature channel iChannel of /sys/class/hwmon/<iHwmonDirName>, named after the chip and
+       the channel label, e.g "tps6594-temp1" */
+    ThermalZone(std::string&& iHwmonDirName, unsigned iChannel) noexcept;
 
     Temperature _temp;  // Unfortunately, Temperature struct is 'final'
     /* The current thermal zone static data, read from the system file trip points.
@@ -85,23 +103,19 @@ class ThermalZone : public ThermalDeviceDir {
         {-1, -1, -1, -1, -1, -1, -1}};
     float _vrThrottlingThreshold = -1;
 
-    // Temperature_1_0 conversion operator. Cannot handle some v2.0 temperature types
-    operator Temperature_1_0() const;
-
     // Reads sensor's static data
     bool init();
 
-    // Gets the current zone's temperature
-    void readTemp() {
-        getInputStream("temp") >> _temp.value;
-        _temp.value /= 1000;
-
-        getThrottlingStatus();
-    }
+    int getTempFd() const { return _tempFd; }
 
    protected:
-    // Sets the throttling status based on the current temperature and the throttling thresholds
-    void getThrottlingStatus();
+    // Kept opened for periodic readings
+    android::base::unique_fd _tempFd;
+    // hwmon temperature channel, 0 for a thermal class zone
+    unsigned _hwmonChannel = 0;
+
+    // Reads the hwmon channel limits as thresholds
+    bool initHwmon();
 };
 
 }  // namespace android::hardware::thermal::V2_0::implementation
@@ -15,12 +15,18 @@
  * limitations under the License.
  */
 
+#include <android-base/chrono_utils.h>
 #include <android-base/logging.h>
+#include <android-base/properties.h>
 #include <hidl/HidlTransportSupport.h>
 
+#include <algorithm>
+#include <chrono>
 #include <memory>
+#include <thread>
 
 #include "Thermal.h"
+#include "ThermalExt.h"
 
 using ::android::OK;
 using ::android::status_t;
@@ -32,6 +38,20 @@ using ::android::hardware::joinRpcThreadpool;
 // Generated HIDL files:
 using ::android::hardware::thermal::V2_0::IThermal;
 using ::android::hardware::thermal::V2_0::implementation::Thermal;
+using ::android::hardware::thermal::V2_0::implementation::ThreadScheduling;
+using ::vendor::ti::hardware::thermal::V1_0::implementation::ThermalExt;
+
+// Number of threads serving the HAL clients
+static constexpr char kBinderThreadsProperty[] = "ro.vendor.thermal.binder_threads";
+// Prefix of the binder threads scheduling properties, cf ThreadScheduling
+static constexpr char kBinderSchedulingPrefix[] = "ro.vendor.thermal.binder";
+
+// Time elapsed since iStart, in ms
+static long long elapsedMs(android::base::boot_clock::time_point iStart) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               android::base::boot_clock::now() - iStart)
+        .count();
+}
 
 static int shutdown() {
     LOG(ERROR) << "Thermal Service is shutting down.";
@@ -39,22 +59,43 @@ static int shutdown() {
 }
 
 int main(int /* argc */, char** /* argv */) {
+    const android::base::boot_clock::time_point start = android::base::boot_clock::now();
     LOG(INFO) << "TI Thermal HAL Service2.0 starting...";
 
     std::shared_ptr<Thermal> service = std::make_shared<Thermal>();
 
-    configureRpcThreadpool(2, true /* callerWillJoin */);
-
-    service->loadDevices();
+    const size_t binderThreads =
+        std::max<size_t>(android::base::GetUintProperty<size_t>(kBinderThreadsProperty, 2, 16), 1);
+    configureRpcThreadpool(binderThreads, true /* callerWillJoin */);
 
+    /* Registers before the devices are loaded, so that clients looking the HAL up during the boot
+       aren't held by the sysfs scan: HAL calls wait for it instead, for a much shorter time */
     status_t status = service->registerAsService();
     if (status != OK) {
         LOG(ERROR) << "Could not register service for ThermalHAL (" << status << ")";
         return shutdown();
     }
+    LOG(INFO) << "Thermal Service registered in " << elapsedMs(start) << "ms, "
+              << elapsedMs(android::base::boot_clock::time_point()) << "ms after boot";
+
+    std::thread([service, start]() {
+        service->loadDevices();
+        // Notifies the registered clients from now on
+        service->run().detach();
+        LOG(INFO) << "Thermal devices ready " << elapsedMs(start) << "ms after start";
+    }).detach();
+
+    // Extensions are optional, the service goes on without them
+    android::sp<ThermalExt> extService = new ThermalExt(service);
+    if (extService->registerAsService() != OK)
+        LOG(ERROR) << "Could not register service for ThermalHAL extensions";
 
     LOG(INFO) << "Thermal Service started successfully.";
 
+    /* Set last, so that only the binder threads get it: the caller joins the pool, which spawns the
+       other threads from its own ones */
+    ThreadScheduling::fromProperties("binder", kBinderSchedulingPrefix).apply();
+
     joinRpcThreadpool();
     // We should not get past the joinRpcThreadpool().
     return shutdown();
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <dlfcn.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+
+#include "ThermalTestUtils.h"
+
+/* Counts the heap allocations of the thread which enabled it, the other service threads(CPU
+   sampler, metrics exporter, ...) allocating on their own schedule */
+static thread_local bool tCounting = false;
+static thread_local size_t tAllocations = 0;
+
+template <typename F>
+static F nextSymbol(const char* name) {
+    return reinterpret_cast<F>(dlsym(RTLD_NEXT, name));
+}
+
+extern "C" void* malloc(size_t size) {
+    static auto next = nextSymbol<void* (*)(size_t)>("malloc");
+
+    if (tCounting) tAllocations++;
+    return next(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) {
+    static auto next = nextSymbol<void* (*)(size_t, size_t)>("calloc");
+
+    if (tCounting) tAllocations++;
+    return next(count, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size) {
+    static auto next = nextSymbol<void* (*)(void*, size_t)>("realloc");
+
+    if (tCounting) tAllocations++;
+    return next(ptr, size);
+}
+
+namespace android::hardware::thermal::V2_0::implementation {
+namespace {
+
+using namespace std::chrono_literals;
+using ::android::hardware::thermal::V1_0::ThermalStatus;
+using ::android::hardware::thermal::V1_0::ThermalStatusCode;
+
+// Counts the allocations of the calls between its construction and count()
+class AllocationCounter {
+   public:
+    AllocationCounter() {
+        tAllocations = 0;
+        tCounting = true;
+    }
+    ~AllocationCounter() { tCounting = false; }
+
+    size_t count() {
+        tCounting = false;
+        return tAllocations;
+    }
+};
+
+class NotificationCounter : public IThermalChangedCallback {
+   public:
+    Return<void> notifyThrottling(const Temperature&) override {
+        _count++;
+        return Void();
+    }
+
+    size_t _count = 0;
+};
+
+class AllocationTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        _thermal = getTestThermal();
+        _thermal->getCurrentTemperatures(
+            false, TemperatureType::UNKNOWN,
+            [this](const ThermalStatus&, const hidl_vec<Temperature>& temps) {
+                _zoneCount = temps.size();
+                if (_zoneCount) _zoneType = temps[0].type;
+            });
+        if (!_zoneCount) GTEST_SKIP() << "No thermal zone";
+    }
+
+    Thermal* _thermal = nullptr;
+    size_t _zoneCount = 0;
+    TemperatureType _zoneType = TemperatureType::UNKNOWN;
+};
+
+TEST_F(AllocationTest, MonitorTickDoesNotAllocate) {
+    sp<NotificationCounter> listener = new NotificationCounter();
+    bool registered = false;
+
+    _thermal->registerThermalChangedCallback(
+        listener, false, TemperatureType::UNKNOWN,
+        [&registered](const ThermalStatus& status) {
+            registered = ThermalStatusCode::SUCCESS == status.code;
+        });
+    ASSERT_TRUE(registered);
+
+    const SampleQueue* queue = _thermal->getSampleQueue();
+    ASSERT_NE(queue, nullptr);
+    SampleQueue reader(*queue->getDesc());
+    ASSERT_TRUE(_thermal->setStreamInterval(listener, 10ms));
+
+    for (int i = 0; i < 3; ++i) _thermal->monitorTick(getNextTickTime());
+
+    const size_t notified = listener->_count;
+    size_t allocations;
+    {
+        AllocationCounter counter;
+
+        for (int i = 0; i < 100; ++i) _thermal->monitorTick(getNextTickTime());
+        allocations = counter.count();
+    }
+    EXPECT_EQ(allocations, 0u);
+    EXPECT_EQ(listener->_count - notified, 100 * _zoneCount);
+    EXPECT_GE(reader.availableToRead(), _zoneCount);
+
+    _thermal->setStreamInterval(listener, 0ms);
+    _thermal->unregisterThermalChangedCallback(listener, [](const ThermalStatus&) {});
+}
+
+TEST_F(AllocationTest, GettersDoNotAllocate) {
+    size_t replies = 0;
+    // Built before counting, like the binder threads do once per transaction
+    const IThermal::getTemperatures_cb onTemperatures =
+        [&replies](const ThermalStatus&, const hidl_vec<Temperature_1_0>&) { replies++; };
+    const IThermal::getCpuUsages_cb onCpuUsages =
+        [&replies](const ThermalStatus&, const hidl_vec<CpuUsage>&) { replies++; };
+    const IThermal::getCoolingDevices_cb onCoolingDevices =
+        [&replies](const ThermalStatus&, const hidl_vec<CoolingDevice_1_0>&) { replies++; };
+    const IThermal::getCurrentTemperatures_cb onCurrentTemperatures =
+        [&replies](const ThermalStatus&, const hidl_vec<Temperature>&) { replies++; };
+    const IThermal::getTemperatureThresholds_cb onThresholds =
+        [&replies](const ThermalStatus&, const hidl_vec<TemperatureThreshold>&) { replies++; };
+    const IThermal::getCurrentCoolingDevices_cb onCurrentCoolingDevices =
+        [&replies](const ThermalStatus&, const hidl_vec<CoolingDevice>&) { replies++; };
+    const IThermalExt::getCpuUtilization_cb onCpuUtilization =
+        [&replies](bool, const hidl_vec<uint32_t>&, const hidl_vec<CpuUtilization>&) {
+            replies++;
+        };
+
+    auto callGetters = [&] {
+        _thermal->getTemperatures(onTemperatures);
+        _thermal->getCpuUsages(onCpuUsages);
+        _thermal->getCurrentTemperatures(false, TemperatureType::UNKNOWN, onCurrentTemperatures);
+        _thermal->getCurrentTemperatures(true, _zoneType, onCurrentTemperatures);
+        _thermal->getTemperatureThresholds(false, TemperatureType::UNKNOWN, onThresholds);
+        _thermal->getCpuUtilization(onCpuUtilization);
+        _thermal->getCoolingDevices(onCoolingDevices);
+        _thermal->getCurrentCoolingDevices(false, CoolingType::CPU, onCurrentCoolingDevices);
+        // Fails on most boards, failures must not allocate either
+        _thermal->getCurrentCoolingDevices(true, CoolingType::FAN, onCurrentCoolingDevices);
+    };
+
+    callGetters();
+    replies = 0;
+
+    size_t allocations;
+    {
+        AllocationCounter counter;
+
+        for (int i = 0; i < 100; ++i) callGetters();
+        allocations = counter.count();
+    }
+    EXPECT_EQ(allocations, 0u);
+    EXPECT_EQ(replies, 100u * 9);
+}
+
+}  // namespace
+}  // namespace android::hardware::thermal::V2_0::implementation
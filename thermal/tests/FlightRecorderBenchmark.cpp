@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android-base/file.h>
+#include <benchmark/benchmark.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "FlightRecorder.h"
+
+namespace android::hardware::thermal::V2_0::implementation {
+namespace {
+
+// The service default size
+constexpr size_t kFileSize = 256 * 1024;
+
+/* Records one sample per iteration, like the monitoring thread each period. The periodic
+   msync(MS_ASYNC) is included, the flushes on a severity change are not */
+void BM_FlightRecorderRecord(benchmark::State& state) {
+    const size_t channelCount = state.range(0);
+    TemporaryDir dir;
+    std::string path = std::string(dir.path) + "/flight_recorder.bin";
+    std::vector<FlightRecorderChannel> channels(channelCount);
+    std::vector<int32_t> values(channelCount);
+    FlightRecorder recorder;
+
+    for (size_t i = 0; i < channelCount; ++i) {
+        std::string name = "zone" + std::to_string(i);
+
+        channels[i].kind = FlightRecorderChannelKind::TEMPERATURE;
+        strncpy(channels[i].name, name.c_str(), sizeof(channels[i].name) - 1);
+    }
+    if (!recorder.open(path.c_str(), kFileSize, channels)) {
+        state.SkipWithError("open failed");
+        return;
+    }
+
+    int64_t timeMs = 1650000000000;
+    int32_t step = 0;
+    for (auto _ : state) {
+        // Temperatures move by a few tenths of a degree between two readings
+        for (size_t i = 0; i < channelCount; ++i) values[i] = 45000 + (step + i) % 7 * 100;
+        step++;
+        recorder.record(timeMs, values.data(), false);
+        timeMs += 5000;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_FlightRecorderRecord)->Arg(4)->Arg(16)->Arg(64);
+
+}  // namespace
+}  // namespace android::hardware::thermal::V2_0::implementation
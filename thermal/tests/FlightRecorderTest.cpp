@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FlightRecorder.h"
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace android::hardware::thermal::V2_0::implementation {
+namespace {
+
+// Header page plus the blocks of the ring
+constexpr size_t kBlockCount = 4;
+constexpr size_t kFileSize = (kBlockCount + 1) * kFlightRecorderBlockSize;
+constexpr int64_t kPeriodMs = 5000;
+
+struct Sample {
+    int64_t timeMs;
+    std::vector<int64_t> values;
+
+    bool operator==(const Sample& other) const {
+        return timeMs == other.timeMs && values == other.values;
+    }
+};
+
+FlightRecorderChannel makeChannel(FlightRecorderChannelKind kind, int8_t type, const char* name) {
+    FlightRecorderChannel channel = {};
+
+    channel.kind = kind;
+    channel.type = type;
+    strncpy(channel.name, name, sizeof(channel.name) - 1);
+    return channel;
+}
+
+const std::vector<FlightRecorderChannel> kChannels = {
+    makeChannel(FlightRecorderChannelKind::TEMPERATURE, 0, "main0-thermal"),
+    makeChannel(FlightRecorderChannelKind::TEMPERATURE, 0, "main1-thermal"),
+    makeChannel(FlightRecorderChannelKind::COOLING, 0, "cooling_device0"),
+};
+
+class FlightRecorderTest : public ::testing::Test {
+   protected:
+    std::string path() const { return std::string(_dir.path) + "/flight_recorder.bin"; }
+
+    /* Records count samples of channels over one boot, temperatures moving up and down like on
+       the SoC. The recorder is destroyed on return, like on a shutdown */
+    void record(const std::vector<FlightRecorderChannel>& channels, size_t count) {
+        FlightRecorder recorder;
+        ASSERT_TRUE(recorder.open(path().c_str(), kFileSize, channels));
+
+        for (size_t i = 0; i < count; ++i) {
+            int32_t values[] = {
+                45000 + static_cast<int32_t>(_recorded.size() % 97) * 100,
+                52000 - static_cast<int32_t>(_recorded.size() % 31) * 250,
+                static_cast<int32_t>(_recorded.size() / 50 % 3),
+            };
+            int64_t timeMs = kStartMs + _recorded.size() * kPeriodMs;
+
+            recorder.record(timeMs, values, false);
+            _recorded.push_back({timeMs, {values, values + channels.size()}});
+        }
+    }
+
+    // Decodes the file like thermal_flight_recorder_decode does
+    void decode() {
+        std::string data;
+
+        _samples.clear();
+        _sequences.clear();
+        ASSERT_TRUE(android::base::ReadFileToString(path(), &data));
+        const uint8_t* image = reinterpret_cast<const uint8_t*>(data.data());
+        ASSERT_TRUE(readFlightRecorderHeader(image, data.size(), &_header));
+
+        size_t truncated = decodeFlightRecorder(
+            image, _header,
+            [this](uint64_t sequence, int64_t timeMs, const std::vector<int64_t>& values) {
+                _samples.push_back({timeMs, values});
+                if (_sequences.empty() || _sequences.back() != sequence)
+                    _sequences.push_back(sequence);
+            });
+        EXPECT_EQ(0u, truncated);
+    }
+
+    // Checks the decoded samples are the most recent ones recorded, in order
+    void expectMostRecent() const {
+        ASSERT_LE(_samples.size(), _recorded.size());
+        EXPECT_TRUE(std::equal(_samples.begin(), _samples.end(),
+                               _recorded.end() - _samples.size()));
+    }
+
+    static constexpr int64_t kStartMs = 1650000000000;
+    TemporaryDir _dir;
+    std::vector<Sample> _recorded;
+    FlightRecorderHeader _header;
+    std::vector<Sample> _samples;
+    // Blocks the samples were decoded from, in order
+    std::vector<uint64_t> _sequences;
+};
+
+TEST_F(FlightRecorderTest, WrapsTheRing) {
+    // Samples take a few bytes each, this fills the ring several times
+    record(kChannels, 10000);
+    decode();
+
+    EXPECT_EQ(kBlockCount, _header.blockCount);
+    EXPECT_EQ(kChannels.size(), _header.channelCount);
+    EXPECT_EQ(10000u, _header.tickCount);
+    EXPECT_LE(_header.tickTotalNs / _header.tickCount, _header.tickMaxNs);
+
+    // The oldest blocks were overwritten, the remaining ones follow each other
+    ASSERT_EQ(kBlockCount, _sequences.size());
+    EXPECT_GT(_sequences.front(), 1u);
+    for (size_t i = 1; i < _sequences.size(); ++i) EXPECT_EQ(_sequences[i - 1] + 1, _sequences[i]);
+    EXPECT_LT(_samples.size(), _recorded.size());
+    expectMostRecent();
+}
+
+TEST_F(FlightRecorderTest, ResumesAfterAReopen) {
+    record(kChannels, 10000);
+    decode();
+    uint64_t lastSequence = _sequences.back();
+
+    // A new boot starts a new block over the oldest one, the previous readings are kept
+    record(kChannels, 100);
+    decode();
+
+    ASSERT_EQ(kBlockCount, _sequences.size());
+    EXPECT_EQ(lastSequence + 1, _sequences.back());
+    EXPECT_EQ(100u, _header.tickCount);
+    EXPECT_GT(_samples.size(), 100u);
+    expectMostRecent();
+}
+
+TEST_F(FlightRecorderTest, ResetsOnOtherChannels) {
+    record(kChannels, 1000);
+
+    // A zone less after an update of the thermal sensors configuration
+    std::vector<FlightRecorderChannel> channels(kChannels.begin(), kChannels.begin() + 2);
+    record(channels, 0);
+    decode();
+
+    EXPECT_EQ(channels.size(), _header.channelCount);
+    EXPECT_EQ(0, memcmp(_header.channels, channels.data(),
+                        channels.size() * sizeof(FlightRecorderChannel)));
+    EXPECT_TRUE(_samples.empty());
+
+    // Renaming a channel resets the file as well
+    record(kChannels, 10);
+    channels = kChannels;
+    strncpy(channels[2].name, "cooling_device1", sizeof(channels[2].name) - 1);
+    record(channels, 0);
+    decode();
+
+    EXPECT_STREQ("cooling_device1", _header.channels[2].name);
+    EXPECT_TRUE(_samples.empty());
+}
+
+TEST_F(FlightRecorderTest, RejectsUnsupportedGeometries) {
+    FlightRecorder recorder;
+
+    EXPECT_FALSE(recorder.open(path().c_str(), 2 * kFlightRecorderBlockSize, kChannels));
+    EXPECT_FALSE(recorder.open(path().c_str(), kFileSize, {}));
+    EXPECT_FALSE(recorder.isOpen());
+}
+
+}  // namespace
+}  // namespace android::hardware::thermal::V2_0::implementation
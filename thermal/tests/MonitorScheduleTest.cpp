@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MonitorSchedule.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace android::hardware::thermal::V2_0::implementation {
+namespace {
+
+using namespace std::chrono_literals;
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+
+// CLOCK_BOOTTIME range the SoC spends suspended
+struct Suspend {
+    nanoseconds start;
+    nanoseconds end;
+};
+
+/* An hour of CLOCK_BOOTTIME the monitoring thread schedule is replayed over, from boot. Readers
+   and zones don't change over the hour */
+struct Timeline {
+    nanoseconds duration = 1h;
+    std::vector<Suspend> suspends;
+    // Anyone reads the polled values: listeners, flight recorder, ...
+    bool polling = true;
+    // Every zone is far below its thresholds
+    bool idle = false;
+    milliseconds streamInterval = 0ms;
+
+    // Time the thread runs at for a timer expiring at t: non-alarm timers wait for the resume
+    nanoseconds fire(nanoseconds t) const {
+        for (const auto& suspend : suspends) {
+            if (t >= suspend.start && t < suspend.end) return suspend.end;
+        }
+        return t;
+    }
+
+    // Gets the times the monitoring thread wakes up at
+    std::vector<nanoseconds> run(MonitorSchedule schedule) const {
+        std::vector<nanoseconds> wakeups;
+        nanoseconds now = 0ns;
+
+        while (true) {
+            if (schedule.isPollDue(polling, now)) schedule.polled(now, idle);
+
+            const nanoseconds wait = schedule.getWait(polling, streamInterval, now);
+            // Sleeps until a reader shows up
+            if (!wait.count()) break;
+
+            now = fire(now + wait);
+            if (now >= duration) break;
+            wakeups.push_back(now);
+        }
+        return wakeups;
+    }
+
+    /* Gets the times the former monitoring thread woke up at: it slept 5s on CLOCK_MONOTONIC, which
+       stops while suspended, whether anyone read or not */
+    std::vector<nanoseconds> runLegacy() const {
+        std::vector<nanoseconds> wakeups;
+        nanoseconds now = 0ns;
+
+        while (true) {
+            nanoseconds left = 5s;
+
+            for (const auto& suspend : suspends) {
+                if (suspend.start < now || suspend.start >= now + left) continue;
+                left -= suspend.start - now;
+                now = suspend.end;
+            }
+            now += left;
+            if (now >= duration) break;
+            wakeups.push_back(now);
+        }
+        return wakeups;
+    }
+};
+
+MonitorSchedule defaultSchedule() {
+    MonitorSchedule schedule;
+
+    schedule._pollInterval = 5s;
+    schedule._idleInterval = 60s;
+    return schedule;
+}
+
+TEST(MonitorScheduleTest, NoWakeupWithoutReaders) {
+    Timeline timeline;
+
+    timeline.polling = false;
+    EXPECT_EQ(timeline.runLegacy().size(), 719u);
+    EXPECT_TRUE(timeline.run(defaultSchedule()).empty());
+}
+
+TEST(MonitorScheduleTest, PollsEveryPollIntervalWhenBusy) {
+    Timeline timeline;
+    const auto wakeups = timeline.run(defaultSchedule());
+
+    EXPECT_EQ(wakeups.size(), timeline.runLegacy().size());
+    for (size_t i = 1; i < wakeups.size(); ++i) EXPECT_EQ(wakeups[i] - wakeups[i - 1], 5s);
+}
+
+TEST(MonitorScheduleTest, PollsEveryIdleIntervalWhenIdle) {
+    Timeline timeline;
+
+    timeline.idle = true;
+    EXPECT_EQ(timeline.runLegacy().size(), 719u);
+    EXPECT_EQ(timeline.run(defaultSchedule()).size(), 59u);
+
+    // Without an idle interval, idle zones are polled like busy ones
+    MonitorSchedule schedule = defaultSchedule();
+    schedule._idleInterval = 0ms;
+    EXPECT_EQ(timeline.run(schedule).size(), 719u);
+}
+
+TEST(MonitorScheduleTest, NoWakeupWhileSuspendedAndPollsUponResume) {
+    Timeline timeline;
+    const Suspend suspend{10min + 2500ms, 40min};
+
+    timeline.suspends.push_back(suspend);
+    const auto wakeups = timeline.run(defaultSchedule());
+    const auto legacyWakeups = timeline.runLegacy();
+
+    for (nanoseconds wakeup : wakeups) {
+        EXPECT_FALSE(wakeup > suspend.start && wakeup < suspend.end);
+    }
+    // The poll due while suspended runs upon resume, then the period restarts from there
+    auto resumed = std::find(wakeups.begin(), wakeups.end(), suspend.end);
+    ASSERT_NE(resumed, wakeups.end());
+    ASSERT_NE(resumed + 1, wakeups.end());
+    EXPECT_EQ(*(resumed + 1), suspend.end + 5s);
+
+    // The former thread finished its sleep first, serving values read before the suspend
+    auto legacyResumed = std::find_if(legacyWakeups.begin(), legacyWakeups.end(),
+                                      [&](nanoseconds wakeup) { return wakeup >= suspend.end; });
+    ASSERT_NE(legacyResumed, legacyWakeups.end());
+    EXPECT_EQ(*legacyResumed, suspend.end + 2500ms);
+}
+
+TEST(MonitorScheduleTest, StreamsEveryStreamInterval) {
+    Timeline timeline;
+
+    timeline.polling = false;
+    timeline.streamInterval = 100ms;
+    EXPECT_EQ(timeline.run(defaultSchedule()).size(), 35999u);
+
+    // The polls due in between streaming periods don't add wakeups
+    timeline.polling = true;
+    timeline.idle = true;
+    EXPECT_EQ(timeline.run(defaultSchedule()).size(), 35999u);
+}
+
+TEST(MonitorScheduleTest, PollNowMakesThePollDue) {
+    MonitorSchedule schedule = defaultSchedule();
+
+    schedule.polled(10s, false);
+    EXPECT_FALSE(schedule.isPollDue(true, 11s));
+    EXPECT_EQ(schedule.getWait(true, 0ms, 11s), 4s);
+
+    schedule.pollNow();
+    EXPECT_TRUE(schedule.isPollDue(true, 11s));
+    EXPECT_FALSE(schedule.isPollDue(false, 11s));
+    // Due polls keep the timer armed
+    EXPECT_EQ(schedule.getWait(true, 0ms, 11s), 1ns);
+}
+
+}  // namespace
+}  // namespace android::hardware::thermal::V2_0::implementation
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "Thermal.h"
+
+namespace android::hardware::thermal::V2_0::implementation {
+namespace {
+
+// Sampling periods the queue holds, the service default
+constexpr size_t kQueuePeriods = 128;
+
+std::vector<ZoneSample> makePeriod(size_t zones) {
+    std::vector<ZoneSample> samples(zones);
+
+    for (size_t i = 0; i < zones; ++i) {
+        samples[i].zoneIndex = i;
+        samples[i].zoneCount = zones;
+        samples[i].type = TemperatureType::CPU;
+        samples[i].value = 42;
+        samples[i].throttlingStatus = ThrottlingSeverity::NONE;
+    }
+    return samples;
+}
+
+// Writes one sampling period per iteration, like the monitoring thread while streaming
+void BM_SampleQueueWrite(benchmark::State& state) {
+    const size_t zones = state.range(0);
+    SampleQueue queue(kQueuePeriods * zones);
+    std::vector<ZoneSample> samples = makePeriod(zones);
+    uint32_t period = 0;
+
+    for (auto _ : state) {
+        for (ZoneSample& sample : samples) sample.period = period;
+        period++;
+        if (!queue.write(samples.data(), samples.size())) state.SkipWithError("write failed");
+    }
+    state.SetItemsProcessed(state.iterations() * zones);
+}
+BENCHMARK(BM_SampleQueueWrite)->Arg(4)->Arg(16)->Arg(64);
+
+/* Streams sampling periods to readers attached to the queue descriptor, like the IThermalExt
+   clients, each period being written once every reader got the previous one. The time per
+   iteration is the one a period takes from the write to the last reader, which bounds the
+   streaming rate readers keep up with */
+void BM_SampleQueueStream(benchmark::State& state) {
+    const size_t zones = state.range(0);
+    const size_t readerCount = state.range(1);
+    SampleQueue queue(kQueuePeriods * zones);
+    std::vector<ZoneSample> samples = makePeriod(zones);
+    std::atomic<bool> stop{false};
+    // Periods read by all the readers together
+    std::atomic<uint64_t> readPeriods{0};
+    std::atomic<uint64_t> lostPeriods{0};
+    std::vector<std::thread> readers;
+    std::atomic<size_t> attached{0};
+
+    for (size_t r = 0; r < readerCount; ++r) {
+        readers.emplace_back([&] {
+            SampleQueue reader(*queue.getDesc());
+            std::vector<ZoneSample> period(zones);
+            uint32_t expected = 0;
+
+            attached++;
+            while (!stop.load(std::memory_order_relaxed)) {
+                if (reader.availableToRead() < zones) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                // Fails after an overrun, the reader then resumes from the latest records
+                if (!reader.read(period.data(), zones)) continue;
+                if (period[0].period != expected) lostPeriods += period[0].period - expected;
+                expected = period[0].period + 1;
+                readPeriods++;
+            }
+        });
+    }
+    while (attached < readerCount) std::this_thread::yield();
+
+    uint32_t period = 0;
+    for (auto _ : state) {
+        for (ZoneSample& sample : samples) sample.period = period;
+        period++;
+        if (!queue.write(samples.data(), samples.size())) state.SkipWithError("write failed");
+        while (readPeriods.load() < static_cast<uint64_t>(period) * readerCount)
+            std::this_thread::yield();
+    }
+
+    stop = true;
+    for (std::thread& reader : readers) reader.join();
+
+    state.SetItemsProcessed(state.iterations() * zones);
+    state.counters["lost_periods"] = lostPeriods.load();
+}
+BENCHMARK(BM_SampleQueueStream)
+    ->ArgsProduct({{4, 16, 64}, {1, 4}})
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace android::hardware::thermal::V2_0::implementation
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "ThermalTestUtils.h"
+
+namespace android::hardware::thermal::V2_0::implementation {
+namespace {
+
+using namespace std::chrono_literals;
+using std::chrono::nanoseconds;
+using ::android::hardware::thermal::V1_0::ThermalStatus;
+
+// Periods measured per configuration, and their length
+constexpr size_t kPeriods = 500;
+constexpr nanoseconds kPeriod = 10ms;
+
+// Records when the first notification of each period arrives
+class NotificationClock : public IThermalChangedCallback {
+   public:
+    Return<void> notifyThrottling(const Temperature&) override {
+        if (!_notified.count()) _notified = getBootTime();
+        return Void();
+    }
+
+    nanoseconds _notified{0};
+};
+
+/* Latency from the expiry of the polling timer to the listeners notification, for a monitoring
+   thread with the given SCHED_FIFO priority(0 for SCHED_OTHER) while hogs spin on every CPU or
+   not. Reports the median, 99th percentile and maximum, in us */
+void BM_NotificationLatency(benchmark::State& state) {
+    const bool hogs = state.range(0);
+    ThreadScheduling scheduling{.name = "monitor", .rtPriority = static_cast<int>(state.range(1))};
+    Thermal* thermal = getTestThermal();
+    sp<NotificationClock> listener = new NotificationClock();
+    bool registered = false;
+
+    thermal->registerThermalChangedCallback(
+        listener, false, TemperatureType::UNKNOWN,
+        [&registered](const ThermalStatus& status) {
+            registered = V1_0::ThermalStatusCode::SUCCESS == status.code;
+        });
+    if (!registered) {
+        state.SkipWithError("No thermal zone");
+        return;
+    }
+
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> hogThreads;
+    if (hogs) {
+        for (long cpu = 0; cpu < sysconf(_SC_NPROCESSORS_ONLN); ++cpu)
+            hogThreads.emplace_back([&stop] {
+                while (!stop.load(std::memory_order_relaxed)) {
+                }
+            });
+    }
+
+    std::vector<nanoseconds> latencies;
+    bool applied = true;
+    for (auto _ : state) {
+        // Like the monitoring thread: the settings apply to it only, on a CLOCK_BOOTTIME timer
+        std::thread([&] {
+            if (!(applied = scheduling.apply())) return;
+
+            const int timerFd = timerfd_create(CLOCK_BOOTTIME, TFD_CLOEXEC);
+            nanoseconds expiry = getBootTime();
+
+            for (size_t i = 0; i < kPeriods; ++i) {
+                itimerspec spec{};
+                uint64_t count;
+
+                expiry += kPeriod;
+                spec.it_value.tv_sec = expiry.count() / 1000000000;
+                spec.it_value.tv_nsec = expiry.count() % 1000000000;
+                timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+                if (read(timerFd, &count, sizeof(count)) != sizeof(count)) continue;
+
+                listener->_notified = 0ns;
+                thermal->monitorTick(getNextTickTime());
+                latencies.push_back(listener->_notified - expiry);
+            }
+            close(timerFd);
+        }).join();
+    }
+
+    stop = true;
+    for (std::thread& hog : hogThreads) hog.join();
+    thermal->unregisterThermalChangedCallback(listener, [](const ThermalStatus&) {});
+
+    if (!applied || latencies.empty()) {
+        state.SkipWithError("Unable to apply the scheduling, CAP_SYS_NICE missing?");
+        return;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto us = [](nanoseconds latency) { return latency.count() / 1000.; };
+    state.counters["p50_us"] = us(latencies[latencies.size() / 2]);
+    state.counters["p99_us"] = us(latencies[latencies.size() * 99 / 100]);
+    state.counters["max_us"] = us(latencies.back());
+}
+BENCHMARK(BM_NotificationLatency)
+    ->ArgNames({"hogs", "rt_priority"})
+    ->ArgsProduct({{0, 1}, {0, 50}})
+    ->Iterations(1)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace android::hardware::thermal::V2_0::implementation
@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android-base/file.h>
+#include <benchmark/benchmark.h>
+#include <sys/stat.h>
+
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "SensorTable.h"
+
+namespace android::hardware::thermal::V2_0::implementation {
+namespace {
+
+// The zones cycle through these types, filtered queries asking for one of them
+constexpr TemperatureType kZoneTypes[] = {
+    TemperatureType::CPU,      TemperatureType::GPU,             TemperatureType::BATTERY,
+    TemperatureType::SKIN,     TemperatureType::POWER_AMPLIFIER, TemperatureType::BCL_VOLTAGE,
+    TemperatureType::USB_PORT, TemperatureType::NPU};
+constexpr CoolingType kCoolingTypes[] = {CoolingType::FAN, CoolingType::CPU, CoolingType::GPU,
+                                         CoolingType::MODEM};
+
+/* Mock /sys/class/thermal/ of count zones, each having a passive and a critical trip point, and
+   of count cooling devices. Created once per count for the whole run */
+const std::string& mockSysfs(size_t count) {
+    static std::map<size_t, std::pair<std::unique_ptr<TemporaryDir>, std::string>> sysfs;
+    auto& [dir, base] = sysfs[count];
+
+    if (dir) return base;
+
+    dir = std::make_unique<TemporaryDir>();
+    base = std::string(dir->path).append("/");
+    for (size_t i = 0; i < count; ++i) {
+        using android::base::WriteStringToFile;
+        const std::string zone = base + "thermal_zone" + std::to_string(i) + "/";
+        const std::string cooling = base + "cooling_device" + std::to_string(i) + "/";
+
+        mkdir(zone.c_str(), 0700);
+        WriteStringToFile("bench" + std::to_string(i) + "\n", zone + "type");
+        WriteStringToFile(std::to_string(40000 + i * 10) + "\n", zone + "temp");
+        WriteStringToFile("passive\n", zone + "trip_point_0_type");
+        WriteStringToFile("80000\n", zone + "trip_point_0_temp");
+        WriteStringToFile("critical\n", zone + "trip_point_1_type");
+        WriteStringToFile("105000\n", zone + "trip_point_1_temp");
+
+        mkdir(cooling.c_str(), 0700);
+        WriteStringToFile("processor\n", cooling + "type");
+        WriteStringToFile("1\n", cooling + "cur_state");
+    }
+    return base;
+}
+
+std::vector<ThermalZone> makeZones(size_t count) {
+    const std::string& base = mockSysfs(count);
+    std::vector<ThermalZone> zones;
+
+    for (size_t i = 0; i < count; ++i) {
+        zones.emplace_back("thermal_zone" + std::to_string(i), base.c_str());
+        zones.back()._temp.type = kZoneTypes[i % std::size(kZoneTypes)];
+    }
+    return zones;
+}
+
+std::vector<CoolDevice> makeCoolingDevices(size_t count) {
+    const std::string& base = mockSysfs(count);
+    std::vector<CoolDevice> devices;
+
+    for (size_t i = 0; i < count; ++i) {
+        devices.emplace_back("cooling_device" + std::to_string(i), base.c_str());
+        devices.back()._dev.type = kCoolingTypes[i % std::size(kCoolingTypes)];
+    }
+    return devices;
+}
+
+/* The storage the tables replaced: the zones keep their own readings, walked through node-based
+   maps whatever the requested type. The readings already went through readValue() then, so the
+   *MapLayout cases only compare the container layouts */
+using ZoneMap = std::unordered_multimap<TemperatureType, ThermalZone>;
+using CoolingMap = std::unordered_multimap<CoolingType, CoolDevice>;
+
+ZoneMap makeZoneMap(size_t count) {
+    ZoneMap map;
+
+    for (auto& zone : makeZones(count)) {
+        zone.init();
+        map.emplace(zone._temp.type, std::move(zone));
+    }
+    return map;
+}
+
+CoolingMap makeCoolingMap(size_t count) {
+    CoolingMap map;
+
+    for (auto& device : makeCoolingDevices(count)) map.emplace(device._dev.type, std::move(device));
+    return map;
+}
+
+// ThermalZone::getThrottlingStatus(), as it was before the tables
+void getThrottlingStatus(ThermalZone* ioZone) {
+    ioZone->_temp.throttlingStatus = ThrottlingSeverity::NONE;
+
+    for (size_t i = 0; i < kSeverityCount; ++i) {
+        if (ioZone->_hotThrottlingThresholds[i] != -1) {
+            if (ioZone->_temp.value >= ioZone->_hotThrottlingThresholds[i])
+                ioZone->_temp.throttlingStatus = static_cast<ThrottlingSeverity>(i);
+            else
+                break;
+        }
+    }
+}
+
+// ThermalZone::readTemp(), as it was before the tables
+void sampleZone(ThermalZone* ioZone) {
+    int64_t milliCelsius;
+
+    if (ThermalDeviceDir::readValue(ioZone->getTempFd(), &milliCelsius))
+        ioZone->_temp.value = milliCelsius / 1000.f;
+    getThrottlingStatus(ioZone);
+}
+
+/* ThermalZone::readTemp() of the original service: one ifstream per reading, opening and parsing
+   the file each time. Measures the tables together with the opened file descriptors they read */
+void sampleZoneStream(ThermalZone* ioZone) {
+    std::ifstream(ioZone->_sysDirPath + "temp") >> ioZone->_temp.value;
+    ioZone->_temp.value /= 1000;
+    getThrottlingStatus(ioZone);
+}
+
+void BM_ZoneTableSample(benchmark::State& state) {
+    ZoneTable table;
+
+    table.build(makeZones(state.range(0)));
+    table.sample({0, table.size()});
+    for (auto _ : state) table.sample({0, table.size()});
+    state.SetItemsProcessed(state.iterations() * table.size());
+}
+BENCHMARK(BM_ZoneTableSample)->Arg(8)->Arg(64)->Arg(512);
+
+void BM_ZoneMapLayoutSample(benchmark::State& state) {
+    ZoneMap map = makeZoneMap(state.range(0));
+
+    for (auto _ : state) {
+        for (auto& [type, zone] : map) sampleZone(&zone);
+    }
+    state.SetItemsProcessed(state.iterations() * map.size());
+}
+BENCHMARK(BM_ZoneMapLayoutSample)->Arg(8)->Arg(64)->Arg(512);
+
+void BM_ZoneStreamSample(benchmark::State& state) {
+    ZoneMap map = makeZoneMap(state.range(0));
+
+    for (auto _ : state) {
+        for (auto& [type, zone] : map) sampleZoneStream(&zone);
+    }
+    state.SetItemsProcessed(state.iterations() * map.size());
+}
+BENCHMARK(BM_ZoneStreamSample)->Arg(8)->Arg(64)->Arg(512);
+
+// Replies the zones of one type as last sampled, like getCurrentTemperatures() minus the reading
+void BM_ZoneTableQuery(benchmark::State& state) {
+    ZoneTable table;
+    std::vector<Temperature> replies(state.range(0));
+
+    table.build(makeZones(state.range(0)));
+    table.sample({0, table.size()});
+    for (auto _ : state) {
+        const IndexRange range = table.getRange(true, TemperatureType::GPU);
+        hidl_vec<Temperature> temps;
+
+        for (size_t i = range.first; i < range.second; ++i)
+            table.fill(i, &replies[i - range.first]);
+        temps.setToExternal(replies.data(), range.second - range.first);
+        benchmark::DoNotOptimize(temps.data());
+    }
+}
+BENCHMARK(BM_ZoneTableQuery)->Arg(8)->Arg(64)->Arg(512);
+
+void BM_ZoneMapLayoutQuery(benchmark::State& state) {
+    ZoneMap map = makeZoneMap(state.range(0));
+
+    for (auto& [type, zone] : map) sampleZone(&zone);
+    for (auto _ : state) {
+        std::vector<Temperature> temps;
+
+        for (const auto& [type, zone] : map) {
+            if (TemperatureType::GPU != type) continue;
+            temps.push_back(zone._temp);
+        }
+        benchmark::DoNotOptimize(temps.data());
+    }
+}
+BENCHMARK(BM_ZoneMapLayoutQuery)->Arg(8)->Arg(64)->Arg(512);
+
+void BM_CoolingTableSample(benchmark::State& state) {
+    CoolingTable table;
+
+    table.build(makeCoolingDevices(state.range(0)));
+    for (auto _ : state) table.sample({0, table.size()});
+    state.SetItemsProcessed(state.iterations() * table.size());
+}
+BENCHMARK(BM_CoolingTableSample)->Arg(8)->Arg(64)->Arg(512);
+
+void BM_CoolingMapLayoutSample(benchmark::State& state) {
+    CoolingMap map = makeCoolingMap(state.range(0));
+
+    for (auto _ : state) {
+        for (auto& [type, device] : map) {
+            int64_t value;
+
+            if (ThermalDeviceDir::readValue(device.getStateFd(), &value)) device._dev.value = value;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * map.size());
+}
+BENCHMARK(BM_CoolingMapLayoutSample)->Arg(8)->Arg(64)->Arg(512);
+
+// CoolDevice::readValue() of the original service, one ifstream per reading
+void BM_CoolingStreamSample(benchmark::State& state) {
+    CoolingMap map = makeCoolingMap(state.range(0));
+
+    for (auto _ : state) {
+        for (auto& [type, device] : map)
+            std::ifstream(device._sysDirPath + "cur_state") >> device._dev.value;
+    }
+    state.SetItemsProcessed(state.iterations() * map.size());
+}
+BENCHMARK(BM_CoolingStreamSample)->Arg(8)->Arg(64)->Arg(512);
+
+}  // namespace
+}  // namespace android::hardware::thermal::V2_0::implementation
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __THERMAL_TEST_UTILS_CPP__
+#define __THERMAL_TEST_UTILS_CPP__
+
+#include <chrono>
+
+#include "Thermal.h"
+
+namespace android::hardware::thermal::V2_0::implementation {
+
+/* The service of the test process, its devices being the board ones. Never destroyed, like in the
+   service process: its monitoring thread keeps running */
+inline Thermal* getTestThermal() {
+    static Thermal* thermal = [] {
+        Thermal* thermal = new Thermal();
+
+        thermal->loadDevices();
+        thermal->run().detach();
+        return thermal;
+    }();
+    return thermal;
+}
+
+/* Gets a time to call Thermal::monitorTick() at, each call an hour after the previous one. The
+   times are far ahead of the CLOCK_BOOTTIME one of the monitoring thread: every tick is due to
+   poll, stream and notify, while the thread itself finds nothing due */
+inline std::chrono::nanoseconds getNextTickTime() {
+    static std::chrono::nanoseconds time = std::chrono::hours(24 * 365);
+
+    return time += std::chrono::hours(1);
+}
+
+}  // namespace android::hardware::thermal::V2_0::implementation
+
+#endif  // #ifndef __THERMAL_TEST_UTILS_CPP__
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2022 BayLibre SAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host tool turning a thermal flight recorder file (pulled from the device) into CSV.
+
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include "../FlightRecorderFormat.h"
+
+using namespace android::hardware::thermal::V2_0::implementation;
+
+static int usage(const char* name) {
+    fprintf(stderr, "Usage: %s <flight_recorder.bin> > readings.csv\n", name);
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) return usage(argv[0]);
+
+    std::ifstream file(argv[1], std::ios::binary);
+    std::vector<uint8_t> data{std::istreambuf_iterator<char>(file),
+                              std::istreambuf_iterator<char>()};
+
+    if (data.size() < kFlightRecorderBlockSize) {
+        fprintf(stderr, "%s: too short or unreadable\n", argv[1]);
+        return 1;
+    }
+
+    FlightRecorderHeader header;
+    if (!readFlightRecorderHeader(data.data(), data.size(), &header)) {
+        fprintf(stderr, "%s: not a flight recorder file (version %u)\n", argv[1],
+                kFlightRecorderVersion);
+        return 1;
+    }
+
+    if (header.tickCount)
+        fprintf(stderr, "record cost: %" PRIu64 " ticks, mean %" PRIu64 " ns, max %" PRIu64 " ns\n",
+                header.tickCount, header.tickTotalNs / header.tickCount, header.tickMaxNs);
+
+    printf("time_ms,block");
+    for (uint32_t c = 0; c < header.channelCount; ++c) {
+        const FlightRecorderChannel& channel = header.channels[c];
+
+        printf(",%.*s%s", static_cast<int>(sizeof(channel.name)), channel.name,
+               channel.kind == FlightRecorderChannelKind::TEMPERATURE ? "_degC" : "_state");
+    }
+    printf("\n");
+
+    size_t truncated = decodeFlightRecorder(
+        data.data(), header,
+        [&header](uint64_t sequence, int64_t timeMs, const std::vector<int64_t>& values) {
+            printf("%" PRId64 ",%" PRIu64, timeMs, sequence);
+            for (uint32_t c = 0; c < header.channelCount; ++c) {
+                if (header.channels[c].kind == FlightRecorderChannelKind::TEMPERATURE)
+                    printf(",%.3f", values[c] / 1000.0);
+                else
+                    printf(",%" PRId64, values[c]);
+            }
+            printf("\n");
+        });
+    if (truncated) fprintf(stderr, "%zu blocks end with a truncated sample\n", truncated);
+
+    return 0;
+}
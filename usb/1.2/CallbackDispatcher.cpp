@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.usb@1.2-service.generic"
+#define ATRACE_TAG ATRACE_TAG_HAL
+
+#include "CallbackDispatcher.h"
+
+#include <stdio.h>
+#include <utils/Log.h>
+#include <utils/Trace.h>
+
+#include <algorithm>
+
+namespace android {
+namespace hardware {
+namespace usb {
+namespace V1_2 {
+namespace implementation {
+
+CallbackDispatcher::CallbackDispatcher()
+    : mStop(false),
+      mMaxDepth(0),
+      mDelivered(0),
+      mDropped(0),
+      mLastLatency(0),
+      mMaxLatency(0),
+      mTotalLatency(0),
+      mThread(&CallbackDispatcher::run, this) {}
+
+CallbackDispatcher::~CallbackDispatcher() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mStop = true;
+    }
+    mCv.notify_one();
+    mThread.join();
+}
+
+void CallbackDispatcher::post(Notification &&notification) {
+    notification.queueTime = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mQueue.size() >= kCapacity) {
+        auto oldest = std::find_if(mQueue.begin(), mQueue.end(), [](const Notification &queued) {
+            return queued.type == Notification::Type::PORT_STATUS;
+        });
+
+        // Role switch results are only dropped if there is nothing else
+        if (oldest == mQueue.end())
+            oldest = mQueue.begin();
+        ALOGE("callback queue full, dropping a notification");
+        mQueue.erase(oldest);
+        mDropped++;
+    }
+    mQueue.push_back(std::move(notification));
+    mMaxDepth = std::max(mMaxDepth, mQueue.size());
+    ATRACE_INT("usb callback queue", mQueue.size());
+    mCv.notify_one();
+}
+
+void CallbackDispatcher::run() {
+    std::unique_lock<std::mutex> lock(mLock);
+
+    while (true) {
+        mCv.wait(lock, [this] { return mStop || !mQueue.empty(); });
+        if (mStop)
+            break;
+
+        Notification notification = std::move(mQueue.front());
+        mQueue.pop_front();
+        ATRACE_INT("usb callback queue", mQueue.size());
+
+        lock.unlock();
+        deliver(notification);
+        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - notification.queueTime);
+        lock.lock();
+
+        mDelivered++;
+        mLastLatency = latency;
+        mMaxLatency = std::max(mMaxLatency, latency);
+        mTotalLatency += latency;
+    }
+}
+
+void CallbackDispatcher::deliver(const Notification &notification) {
+    ATRACE_CALL();
+    Return<void> ret;
+
+    if (notification.type == Notification::Type::ROLE_SWITCH) {
+        ret = notification.callback_1_0->notifyRoleSwitchStatus(notification.portName,
+                                                                notification.role,
+                                                                notification.status);
+        if (!ret.isOk())
+            ALOGE("RoleSwitchStatus error %s", ret.description().c_str());
+        return;
+    }
+
+    if (notification.type == Notification::Type::LINK_DEGRADED) {
+        ret = notification.extCallback->notifyLinkDegraded(notification.link,
+                                                           notification.degradedCount);
+        if (!ret.isOk())
+            ALOGE("notifyLinkDegraded error %s", ret.description().c_str());
+        return;
+    }
+
+    if (notification.callback_1_2 != NULL) {
+        ret = notification.callback_1_2->notifyPortStatusChange_1_2(notification.portStatus,
+                                                                    notification.status);
+    } else if (notification.callback_1_1 != NULL) {
+        hidl_vec<V1_1::PortStatus_1_1> currentPortStatus_1_1;
+
+        currentPortStatus_1_1.resize(notification.portStatus.size());
+        for (unsigned long i = 0; i < notification.portStatus.size(); i++)
+            currentPortStatus_1_1[i] = notification.portStatus[i].status_1_1;
+        ret = notification.callback_1_1->notifyPortStatusChange_1_1(currentPortStatus_1_1,
+                                                                    notification.status);
+    } else {
+        hidl_vec<V1_0::PortStatus> currentPortStatus;
+
+        currentPortStatus.resize(notification.portStatus.size());
+        for (unsigned long i = 0; i < notification.portStatus.size(); i++)
+            currentPortStatus[i] = notification.portStatus[i].status_1_1.status;
+        ret = notification.callback_1_0->notifyPortStatusChange(currentPortStatus,
+                                                                notification.status);
+    }
+
+    if (!ret.isOk())
+        ALOGE("queryPortStatus_1_2 error %s", ret.description().c_str());
+}
+
+void CallbackDispatcher::dump(int fd) {
+    std::unique_lock<std::mutex> lock(mLock);
+    size_t depth = mQueue.size();
+    size_t maxDepth = mMaxDepth;
+    unsigned long delivered = mDelivered;
+    unsigned long dropped = mDropped;
+    std::chrono::microseconds lastLatency = mLastLatency;
+    std::chrono::microseconds maxLatency = mMaxLatency;
+    std::chrono::microseconds totalLatency = mTotalLatency;
+    // Posting must never wait for the dump client
+    lock.unlock();
+
+    dprintf(fd, "callback queue depth: %zu (max %zu, capacity %zu)\n", depth, maxDepth,
+            kCapacity);
+    dprintf(fd, "callbacks delivered: %lu, dropped: %lu\n", delivered, dropped);
+    dprintf(fd, "delivery latency: last %lldus, average %lldus, max %lldus\n",
+            static_cast<long long>(lastLatency.count()),
+            static_cast<long long>(delivered ? totalLatency.count() / delivered : 0),
+            static_cast<long long>(maxLatency.count()));
+}
+
+}  // namespace implementation
+}  // namespace V1_2
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_USB_V1_2_CALLBACKDISPATCHER_H
+#define ANDROID_HARDWARE_USB_V1_2_CALLBACKDISPATCHER_H
+
+#include <android/hardware/usb/1.2/IUsbCallback.h>
+#include <android/hardware/usb/1.2/types.h>
+#include <vendor/ti/hardware/usb/1.0/IUsbExtCallback.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace android {
+namespace hardware {
+namespace usb {
+namespace V1_2 {
+namespace implementation {
+
+using ::android::sp;
+using ::android::hardware::hidl_string;
+using ::android::hardware::hidl_vec;
+using ::android::hardware::usb::V1_0::PortRole;
+using ::android::hardware::usb::V1_0::Status;
+using ::android::hardware::usb::V1_2::IUsbCallback;
+using ::android::hardware::usb::V1_2::PortStatus;
+using ::vendor::ti::hardware::usb::V1_0::IUsbExtCallback;
+using ::vendor::ti::hardware::usb::V1_0::UsbDeviceLink;
+
+// Notification to the framework, immutable once queued
+struct Notification {
+    enum class Type { PORT_STATUS, ROLE_SWITCH, LINK_DEGRADED };
+
+    Type type;
+    // The callback registered when queuing, the newer versions set if it implements them
+    sp<V1_0::IUsbCallback> callback_1_0;
+    sp<V1_1::IUsbCallback> callback_1_1;
+    sp<IUsbCallback> callback_1_2;
+    Status status;
+    // PORT_STATUS: the older versions are converted from it on delivery
+    hidl_vec<PortStatus> portStatus;
+    // ROLE_SWITCH
+    hidl_string portName;
+    PortRole role;
+    // LINK_DEGRADED, to the extensions callback instead
+    sp<IUsbExtCallback> extCallback;
+    UsbDeviceLink link;
+    uint32_t degradedCount;
+    std::chrono::steady_clock::time_point queueTime;
+};
+
+/*
+ * Delivers the notifications in order from its own thread, so that a slow
+ * framework client blocks neither the uevent thread nor the HAL calls.
+ * Posting never blocks: when the queue is full, the oldest port status is
+ * dropped, the newer ones superseding it.
+ */
+class CallbackDispatcher {
+  public:
+    static constexpr size_t kCapacity = 32;
+
+    CallbackDispatcher();
+    ~CallbackDispatcher();
+
+    void post(Notification &&notification);
+    // Writes the queue depth and delivery latency statistics to fd
+    void dump(int fd);
+
+  private:
+    void run();
+    void deliver(const Notification &notification);
+
+    std::mutex mLock;
+    std::condition_variable mCv;
+    std::deque<Notification> mQueue;
+    bool mStop;
+
+    // Statistics, protected by mLock
+    size_t mMaxDepth;
+    unsigned long mDelivered;
+    unsigned long mDropped;
+    std::chrono::microseconds mLastLatency;
+    std::chrono::microseconds mMaxLatency;
+    std::chrono::microseconds mTotalLatency;
+
+    // Last, started once the above are initialized
+    std::thread mThread;
+};
+
+}  // namespace implementation
+}  // namespace V1_2
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_USB_V1_2_CALLBACKDISPATCHER_H
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define ATRACE_TAG ATRACE_TAG_HAL
+
+#include "EventLog.h"
+
+#include <stdio.h>
+#include <utils/Trace.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace usb {
+namespace V1_2 {
+namespace implementation {
+
+EventLog::EventLog() : mNext(0), mCount(0) {}
+
+void EventLog::record(const std::string &port, const std::string &event) {
+    std::lock_guard<std::mutex> lock(mLock);
+
+    mEntries[mNext] = {std::chrono::steady_clock::now(), port, event};
+    mNext = (mNext + 1) % kCapacity;
+    mCount++;
+}
+
+void EventLog::dump(int fd) {
+    std::vector<Entry> entries;
+    size_t total;
+
+    // Recording must never wait for the dump client
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        size_t count = std::min(mCount, kCapacity);
+
+        entries.reserve(count);
+        for (size_t i = 0; i < count; i++)
+            entries.push_back(mEntries[(mNext + kCapacity - count + i) % kCapacity]);
+        total = mCount;
+    }
+
+    dprintf(fd, "recent events (%zu of %zu):\n", entries.size(), total);
+    for (const Entry &entry : entries) {
+        auto time = std::chrono::duration_cast<std::chrono::milliseconds>(
+            entry.time.time_since_epoch());
+
+        dprintf(fd, "  [%lld.%03lld] %s: %s\n", static_cast<long long>(time.count() / 1000),
+                static_cast<long long>(time.count() % 1000), entry.port.c_str(),
+                entry.event.c_str());
+    }
+}
+
+// Name of the track of the port, e.g "usb port0 role switch"
+static std::string trackName(const char *name, const std::string &port) {
+    return "usb " + port + " " + name;
+}
+
+void traceAsyncBegin(const char *stage, const std::string &port, int32_t cookie) {
+    if (ATRACE_ENABLED())
+        ATRACE_ASYNC_BEGIN(trackName(stage, port).c_str(), cookie);
+}
+
+void traceAsyncEnd(const char *stage, const std::string &port, int32_t cookie) {
+    if (ATRACE_ENABLED())
+        ATRACE_ASYNC_END(trackName(stage, port).c_str(), cookie);
+}
+
+void traceCounter(const char *counter, const std::string &port, int32_t value) {
+    if (ATRACE_ENABLED())
+        ATRACE_INT(trackName(counter, port).c_str(), value);
+}
+
+}  // namespace implementation
+}  // namespace V1_2
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
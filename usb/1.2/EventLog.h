@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_USB_V1_2_EVENTLOG_H
+#define ANDROID_HARDWARE_USB_V1_2_EVENTLOG_H
+
+#include <stdint.h>
+
+#include <chrono>
+#include <mutex>
+#include <string>
+
+namespace android {
+namespace hardware {
+namespace usb {
+namespace V1_2 {
+namespace implementation {
+
+/*
+ * Ring of the recent plug and role switch events of the ports, with their
+ * CLOCK_MONOTONIC time, printed by debug().
+ */
+class EventLog {
+  public:
+    static constexpr size_t kCapacity = 64;
+
+    EventLog();
+
+    void record(const std::string &port, const std::string &event);
+    // Writes the events to fd, oldest first
+    void dump(int fd);
+
+  private:
+    struct Entry {
+        std::chrono::steady_clock::time_point time;
+        std::string port;
+        std::string event;
+    };
+
+    std::mutex mLock;
+    Entry mEntries[kCapacity];
+    // Next entry to write, and number of entries written
+    size_t mNext;
+    size_t mCount;
+};
+
+/*
+ * atrace async events and counters of the HAL tag, on a track per port.
+ * The track names are only built while the tag is traced, so these cost
+ * a flag check otherwise.
+ */
+void traceAsyncBegin(const char *stage, const std::string &port, int32_t cookie);
+void traceAsyncEnd(const char *stage, const std::string &port, int32_t cookie);
+void traceCounter(const char *counter, const std::string &port, int32_t value);
+
+}  // namespace implementation
+}  // namespace V1_2
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_USB_V1_2_EVENTLOG_H
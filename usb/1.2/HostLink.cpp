@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.usb@1.2-service.generic"
+
+#include "HostLink.h"
+
+#include <android-base/file.h>
+#include <android-base/strings.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace android {
+namespace hardware {
+namespace usb {
+namespace V1_2 {
+namespace implementation {
+
+using ::android::base::ReadFileToString;
+using ::android::base::Trim;
+
+// Lowest SuperSpeed, below which devices aren't flagged: USB 2 speeds depend on the device
+constexpr uint32_t kSuperSpeedMbps = 5000;
+constexpr uint32_t kSuperSpeedPlusMbps = 10000;
+
+// Descriptor types and device capabilities of the BOS descriptor, cf USB 3.2, 9.6.2
+constexpr uint8_t kBosDescriptor = 0x0f;
+constexpr uint8_t kDeviceCapabilityDescriptor = 0x10;
+constexpr uint8_t kSuperSpeedCapability = 0x03;
+constexpr uint8_t kSuperSpeedPlusCapability = 0x0a;
+
+static std::string readNode(const std::string &path) {
+    std::string value;
+
+    if (!ReadFileToString(path, &value))
+        return "";
+    return Trim(value);
+}
+
+// Speed in Mbps of the speed node of a device or root hub, "1.5" rounding down
+static uint32_t readSpeedMbps(const std::string &dir) {
+    return strtoul(readNode(dir + "/speed").c_str(), NULL, 10);
+}
+
+// Highest SuperSpeed the capabilities of the BOS descriptor advertise, 0 if none
+static uint32_t bosSpeedMbps(const std::string &bos) {
+    size_t offset = bos.size();
+    uint32_t speed = 0;
+
+    if (bos.size() >= 5 && static_cast<uint8_t>(bos[1]) == kBosDescriptor)
+        offset = static_cast<uint8_t>(bos[0]);
+
+    while (offset + 3 <= bos.size()) {
+        uint8_t length = bos[offset];
+
+        if (length < 3 || bos[offset + 1] != kDeviceCapabilityDescriptor)
+            break;
+        if (bos[offset + 2] == kSuperSpeedCapability)
+            speed = std::max(speed, kSuperSpeedMbps);
+        else if (bos[offset + 2] == kSuperSpeedPlusCapability)
+            speed = std::max(speed, kSuperSpeedPlusMbps);
+        offset += length;
+    }
+    return speed;
+}
+
+/*
+ * Highest speed of the host controller of the device: the USB 2 and USB 3
+ * root hubs of a controller are the usb<bus> siblings of the device's one.
+ */
+static uint32_t controllerSpeedMbps(const std::string &dir, const std::string &name) {
+    std::string rootHub = "/usb" + name.substr(0, name.find('-')) + "/";
+    size_t pos = dir.find(rootHub);
+    uint32_t speed = 0;
+
+    if (pos == std::string::npos)
+        return 0;
+
+    std::string controller = dir.substr(0, pos);
+    DIR *dp = opendir(controller.c_str());
+    if (dp == NULL)
+        return 0;
+
+    struct dirent *ep;
+    while ((ep = readdir(dp))) {
+        if (!strncmp(ep->d_name, "usb", 3))
+            speed = std::max(speed, readSpeedMbps(controller + "/" + ep->d_name));
+    }
+    closedir(dp);
+    return speed;
+}
+
+bool readHostLink(const std::string &dir, UsbDeviceLink *link) {
+    std::string name = dir.substr(dir.find_last_of('/') + 1);
+
+    // Devices are "<bus>-<port>[.<port>...]", root hubs "usb<bus>" and interfaces have a ':'
+    if (name.find('-') == std::string::npos || name.find(':') != std::string::npos ||
+        !strncmp(name.c_str(), "usb", 3))
+        return false;
+
+    link->name = name;
+    link->speed = readNode(dir + "/speed");
+    link->version = readNode(dir + "/version");
+    link->maxChild = strtoul(readNode(dir + "/maxchild").c_str(), NULL, 10);
+
+    // USB 3 devices report USB 2.10 when they fall back to USB 2, the BOS tells them apart
+    uint32_t speed = readSpeedMbps(dir);
+    std::string bos;
+    uint32_t capable = 0;
+    if (ReadFileToString(dir + "/bos_descriptors", &bos))
+        capable = bosSpeedMbps(bos);
+    else if (strtoul(link->version.c_str(), NULL, 10) >= 3)
+        capable = kSuperSpeedMbps;
+    link->capableSpeedMbps = std::max(capable, speed);
+
+    // A USB 3 hub enumerates its USB 2 half apart, at USB 2 speed
+    link->degraded = link->maxChild == 0 && capable >= kSuperSpeedMbps &&
+                     std::min(capable, controllerSpeedMbps(dir, name)) > speed;
+    return true;
+}
+
+std::string rootHubPort(const std::string &name) {
+    size_t dash = name.find('-');
+
+    if (dash == std::string::npos)
+        return "";
+    return "usb" + name.substr(0, dash) + "-port" +
+           name.substr(dash + 1, name.find('.', dash) - dash - 1);
+}
+
+}  // namespace implementation
+}  // namespace V1_2
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_USB_V1_2_HOSTLINK_H
+#define ANDROID_HARDWARE_USB_V1_2_HOSTLINK_H
+
+#include <vendor/ti/hardware/usb/1.0/types.h>
+
+#include <string>
+
+namespace android {
+namespace hardware {
+namespace usb {
+namespace V1_2 {
+namespace implementation {
+
+using ::vendor::ti::hardware::usb::V1_0::UsbDeviceLink;
+
+/*
+ * Reads the speed, version and number of ports of the USB device whose
+ * sysfs directory is dir, and whether it negotiated a lower speed than it
+ * and the host controller support. Leaves the port name to the caller.
+ * Returns false if dir isn't a USB device, e.g a root hub or an interface.
+ */
+bool readHostLink(const std::string &dir, UsbDeviceLink *link);
+
+// Root hub port a device is attached through, e.g "usb1-port2" for "1-2.4", empty if none
+std::string rootHubPort(const std::string &name);
+
+}  // namespace implementation
+}  // namespace V1_2
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_USB_V1_2_HOSTLINK_H
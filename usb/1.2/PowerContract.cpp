@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.usb@1.2-service.generic"
+
+#include "PowerContract.h"
+
+#include <android-base/file.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace usb {
+namespace V1_2 {
+namespace implementation {
+
+using ::android::base::ReadFileToString;
+
+// Best contract without USB PD, 3 A at 5 V with Type-C current
+constexpr uint32_t kTypecPowerMw = 15000;
+// Share of the best contract's power below which a contract counts as below it, in percent.
+// The supplies report the measured voltage, below the negotiated one.
+constexpr uint32_t kBelowBestPercent = 90;
+// Tolerance of USB PD source voltages, in percent
+constexpr uint32_t kVoltageTolerancePercent = 5;
+
+// Reads a number from a sysfs node, ignoring its unit suffix, e.g "5000mV". 0 if unreadable.
+static uint64_t readValue(const std::string &path) {
+    std::string value;
+
+    if (!ReadFileToString(path, &value))
+        return 0;
+    return strtoull(value.c_str(), NULL, 10);
+}
+
+/*
+ * Reads the PDOs of a capabilities directory of a usb_power_delivery
+ * device, named "<position>:<kind>", in their position order.
+ */
+static std::vector<Pdo> readPdos(const std::string &dir) {
+    std::vector<std::pair<unsigned long, Pdo>> pdos;
+    std::vector<Pdo> ordered;
+    DIR *dp = opendir(dir.c_str());
+
+    if (dp == NULL)
+        return ordered;
+
+    struct dirent *ep;
+    while ((ep = readdir(dp))) {
+        char *kind;
+        unsigned long position = strtoul(ep->d_name, &kind, 10);
+        std::string node = dir + "/" + ep->d_name + "/";
+        Pdo pdo = {};
+
+        if (kind == ep->d_name || *kind++ != ':')
+            continue;
+
+        if (!strcmp(kind, "fixed_supply")) {
+            pdo.type = PdoType::FIXED;
+            pdo.minVoltageMv = pdo.maxVoltageMv = readValue(node + "voltage");
+        } else if (!strcmp(kind, "variable_supply")) {
+            pdo.type = PdoType::VARIABLE;
+        } else if (!strcmp(kind, "battery")) {
+            pdo.type = PdoType::BATTERY;
+        } else if (!strcmp(kind, "programmable_supply")) {
+            pdo.type = PdoType::PPS;
+        } else {
+            continue;
+        }
+
+        if (pdo.type != PdoType::FIXED) {
+            pdo.minVoltageMv = readValue(node + "minimum_voltage");
+            pdo.maxVoltageMv = readValue(node + "maximum_voltage");
+        }
+        if (pdo.type == PdoType::BATTERY) {
+            pdo.maxPowerMw = readValue(node + "maximum_power");
+        } else {
+            pdo.maxCurrentMa = readValue(node + "maximum_current");
+            pdo.maxPowerMw = static_cast<uint64_t>(pdo.maxVoltageMv) * pdo.maxCurrentMa / 1000;
+        }
+        pdos.push_back({position, pdo});
+    }
+    closedir(dp);
+
+    std::sort(pdos.begin(), pdos.end(),
+              [](const auto &a, const auto &b) { return a.first < b.first; });
+    for (const auto &pdo : pdos)
+        ordered.push_back(pdo.second);
+    return ordered;
+}
+
+// Power of the best contract a sink with these capabilities could get from the source
+static uint32_t bestPowerMw(const std::vector<Pdo> &source, const std::vector<Pdo> &sink) {
+    uint32_t sinkVoltageMv = UINT32_MAX;
+    uint32_t sinkPowerMw = UINT32_MAX;
+    uint32_t best = 0;
+
+    // Without its capabilities, the sink is assumed to take anything
+    if (!sink.empty()) {
+        sinkVoltageMv = sinkPowerMw = 0;
+        for (const Pdo &pdo : sink) {
+            sinkVoltageMv = std::max(sinkVoltageMv, pdo.maxVoltageMv);
+            sinkPowerMw = std::max(sinkPowerMw, pdo.maxPowerMw);
+        }
+    }
+
+    if (source.empty())
+        return std::min(kTypecPowerMw, sinkPowerMw);
+
+    for (const Pdo &pdo : source) {
+        uint32_t powerMw = pdo.maxPowerMw;
+
+        if (pdo.minVoltageMv > sinkVoltageMv)
+            continue;
+        if (pdo.type != PdoType::BATTERY)
+            powerMw = static_cast<uint64_t>(std::min(pdo.maxVoltageMv, sinkVoltageMv)) *
+                      pdo.maxCurrentMa / 1000;
+        best = std::max(best, std::min(powerMw, sinkPowerMw));
+    }
+    return best;
+}
+
+// Position of the PDO whose voltage range holds the voltage, -1 if none
+static int32_t selectedPdo(const std::vector<Pdo> &source, uint32_t voltageMv) {
+    for (size_t i = 0; i < source.size(); i++) {
+        uint64_t low = static_cast<uint64_t>(source[i].minVoltageMv) *
+                       (100 - kVoltageTolerancePercent) / 100;
+        uint64_t high = static_cast<uint64_t>(source[i].maxVoltageMv) *
+                        (100 + kVoltageTolerancePercent) / 100;
+
+        if (voltageMv >= low && voltageMv <= high)
+            return i;
+    }
+    return -1;
+}
+
+void readPowerContract(const PowerContractPaths &paths, bool connected, bool sinking,
+                       PowerContract *contract) {
+    contract->connected = connected;
+    contract->sinking = connected && sinking;
+    contract->sourceCapabilities.resize(0);
+    contract->selectedPdo = -1;
+    contract->voltageMv = 0;
+    contract->currentMaxMa = 0;
+    contract->contractPowerMw = 0;
+    contract->bestPowerMw = 0;
+    if (!contract->sinking)
+        return;
+
+    std::vector<Pdo> source = readPdos(paths.partnerPd + "/source-capabilities");
+    std::vector<Pdo> sink = readPdos(paths.portPd + "/sink-capabilities");
+
+    // In uV and uA
+    contract->voltageMv = readValue(paths.supply + "/voltage_now") / 1000;
+    contract->currentMaxMa = readValue(paths.supply + "/current_max") / 1000;
+    contract->contractPowerMw =
+        static_cast<uint64_t>(contract->voltageMv) * contract->currentMaxMa / 1000;
+    contract->selectedPdo = selectedPdo(source, contract->voltageMv);
+    contract->bestPowerMw = bestPowerMw(source, sink);
+    contract->sourceCapabilities = source;
+}
+
+bool PortPower::update(PowerContract &&newContract, std::chrono::steady_clock::time_point now) {
+    bool changed = newContract.connected != contract.connected ||
+                   newContract.sinking != contract.sinking ||
+                   newContract.voltageMv != contract.voltageMv ||
+                   newContract.currentMaxMa != contract.currentMaxMa ||
+                   newContract.bestPowerMw != contract.bestPowerMw ||
+                   newContract.selectedPdo != contract.selectedPdo ||
+                   newContract.sourceCapabilities != contract.sourceCapabilities;
+    bool below = newContract.sinking && static_cast<uint64_t>(newContract.contractPowerMw) * 100 <
+                                            static_cast<uint64_t>(newContract.bestPowerMw) *
+                                                kBelowBestPercent;
+
+    if (below && !belowBest) {
+        belowBest = true;
+        belowBestSince = now;
+        belowBestCount++;
+    } else if (!below) {
+        stop(now);
+    }
+    contract = std::move(newContract);
+    return changed;
+}
+
+void PortPower::stop(std::chrono::steady_clock::time_point now) {
+    if (!belowBest)
+        return;
+    belowBestTime += std::chrono::duration_cast<std::chrono::milliseconds>(now - belowBestSince);
+    belowBest = false;
+}
+
+PowerContract PortPower::snapshot(std::chrono::steady_clock::time_point now) const {
+    PowerContract current = contract;
+    std::chrono::milliseconds time = belowBestTime;
+
+    if (belowBest)
+        time += std::chrono::duration_cast<std::chrono::milliseconds>(now - belowBestSince);
+    current.belowBestMs = time.count();
+    current.belowBestCount = belowBestCount;
+    return current;
+}
+
+}  // namespace implementation
+}  // namespace V1_2
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
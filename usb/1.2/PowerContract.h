@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_USB_V1_2_POWERCONTRACT_H
+#define ANDROID_HARDWARE_USB_V1_2_POWERCONTRACT_H
+
+#include <vendor/ti/hardware/usb/1.0/types.h>
+
+#include <chrono>
+#include <string>
+
+namespace android {
+namespace hardware {
+namespace usb {
+namespace V1_2 {
+namespace implementation {
+
+using ::vendor::ti::hardware::usb::V1_0::Pdo;
+using ::vendor::ti::hardware::usb::V1_0::PdoType;
+using ::vendor::ti::hardware::usb::V1_0::PowerContract;
+
+// sysfs nodes the contract of a port is read from
+struct PowerContractPaths {
+    // usb_power_delivery devices of the partner and of the port, linked from their typec devices
+    std::string partnerPd;
+    std::string portPd;
+    // power_supply device the port sinks through
+    std::string supply;
+};
+
+/*
+ * Reads the contract the port sinks power through: the source capabilities
+ * of the partner, the voltage and current limit of the supply, and the best
+ * contract the capabilities of both ends allow. Sets everything but the port
+ * name and the time below the best contract, only the connection state if
+ * the port doesn't sink power.
+ */
+void readPowerContract(const PowerContractPaths &paths, bool connected, bool sinking,
+                       PowerContract *contract);
+
+// Contract of a port, and the time it spent below its best one
+struct PortPower {
+    // belowBestMs and belowBestCount aren't maintained, cf snapshot()
+    PowerContract contract;
+    unsigned belowBestCount = 0;
+    std::chrono::milliseconds belowBestTime = std::chrono::milliseconds(0);
+    // The contract is below the best one since belowBestSince
+    bool belowBest = false;
+    std::chrono::steady_clock::time_point belowBestSince;
+
+    // Replaces the contract, returns whether it changed
+    bool update(PowerContract &&newContract, std::chrono::steady_clock::time_point now);
+    // Stops counting the time below the best contract, e.g while the port isn't monitored
+    void stop(std::chrono::steady_clock::time_point now);
+    // The contract with the time below the best one until now
+    PowerContract snapshot(std::chrono::steady_clock::time_point now) const;
+};
+
+}  // namespace implementation
+}  // namespace V1_2
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_USB_V1_2_POWERCONTRACT_H
@@ -0,0 +1,299 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.usb@1.2-service.generic"
+
+#include "Uevent.h"
+
+#include <errno.h>
+#include <linux/filter.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <utils/Log.h>
+
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace usb {
+namespace V1_2 {
+namespace implementation {
+
+using std::string_view_literals::operator""sv;
+
+// Subsystems of the uevents the HAL handles, the socket filter drops the others
+static constexpr std::string_view kUeventSubsystems[] = {"typec"sv, "power_supply"sv,
+                                                          "usb_power_delivery"sv, "usb"sv};
+
+/*
+ * The kernel starts uevents with "ACTION@DEVPATH\0ACTION=..\0DEVPATH=..\0",
+ * so the SUBSYSTEM key follows at twice the header length plus this offset.
+ */
+static constexpr uint32_t kSubsystemOffset = 17;
+static constexpr std::string_view kSubsystemKey = "SUBSYSTEM="sv;
+
+/*
+ * Longest header the socket filter looks for the SUBSYSTEM key after, longer
+ * ones are passed. Each byte costs 4 instructions, and the kernel charges the
+ * program on the socket option memory once converted to eBPF: optmem_max
+ * is only 20 KB on older kernels.
+ */
+static constexpr uint32_t kFilterWindow = 128;
+static constexpr uint32_t kFilterAccept = 0xffffffff;
+static constexpr uint32_t kFilterDrop = 0;
+
+// Stores the value of field in value if field is "<key><value>"
+static bool matchKey(std::string_view field, std::string_view key, std::string_view *value) {
+    if (field.substr(0, key.size()) != key)
+        return false;
+    *value = field.substr(key.size());
+    return true;
+}
+
+bool UeventRecord::parse(const char *msg, size_t len, UeventRecord *record) {
+    const char *end = msg + len;
+    const char *next = static_cast<const char *>(memchr(msg, '\0', len));
+    std::string_view header(msg, (next ? next : end) - msg);
+    size_t at = header.find('@');
+
+    *record = UeventRecord();
+    // Kernel uevents start with "ACTION@DEVPATH", the keys below repeat both
+    if (at == std::string_view::npos)
+        return false;
+    record->action = header.substr(0, at);
+    record->devPath = header.substr(at + 1);
+
+    while (next && ++next < end) {
+        const char *field = next;
+        std::string_view value;
+
+        next = static_cast<const char *>(memchr(field, '\0', end - field));
+        value = std::string_view(field, (next ? next : end) - field);
+
+        // Dispatching on the first character keeps it to one comparison for most fields
+        switch (value.empty() ? '\0' : value.front()) {
+            case 'A':
+                matchKey(value, "ACTION="sv, &record->action);
+                break;
+            case 'D':
+                matchKey(value, "DEVPATH="sv, &record->devPath) ||
+                    matchKey(value, "DEVTYPE="sv, &record->devType);
+                break;
+            case 'S':
+                matchKey(value, "SUBSYSTEM="sv, &record->subsystem);
+                break;
+            case 'P':
+                if (value.substr(0, "POWER_SUPPLY_MOISTURE_DETECTED"sv.size()) ==
+                    "POWER_SUPPLY_MOISTURE_DETECTED"sv)
+                    record->moistureDetected = true;
+                break;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Appends the BPF comparison of bytes with the message at offset from the X
+ * register, the positions of the jumps taken on mismatch in mismatchJumps.
+ */
+static void appendCompare(std::vector<sock_filter> *prog, uint32_t offset, std::string_view bytes,
+                          std::vector<size_t> *mismatchJumps) {
+    while (!bytes.empty()) {
+        // BPF loads read in network order
+        uint16_t size = bytes.size() >= 4 ? BPF_W : bytes.size() >= 2 ? BPF_H : BPF_B;
+        size_t length = size == BPF_W ? 4 : size == BPF_H ? 2 : 1;
+        uint32_t value = 0;
+
+        for (size_t i = 0; i < length; i++)
+            value = value << 8 | static_cast<uint8_t>(bytes[i]);
+        prog->push_back(BPF_STMT(BPF_LD | size | BPF_IND, offset));
+        mismatchJumps->push_back(prog->size());
+        prog->push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, value, 0, 0));
+        offset += length;
+        bytes.remove_prefix(length);
+    }
+}
+
+// Points the conditional jumps at target, false if it's out of their range
+static bool patchJumps(std::vector<sock_filter> *prog, const std::vector<size_t> &jumps,
+                       size_t target) {
+    for (size_t jump : jumps) {
+        if (target - jump - 1 > UINT8_MAX)
+            return false;
+        (*prog)[jump].jf = target - jump - 1;
+    }
+    return true;
+}
+
+bool attachUeventFilter(int fd) {
+    std::vector<sock_filter> prog;
+    std::vector<size_t> verifyJumps;
+    std::vector<size_t> acceptJumps;
+    bool ok = true;
+
+    // Unrolled scan for the end of the header, which locates the SUBSYSTEM key in X
+    for (uint32_t length = 1; length < kFilterWindow; length++) {
+        prog.push_back(BPF_STMT(BPF_LD | BPF_B | BPF_ABS, length));
+        prog.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 2));
+        prog.push_back(BPF_STMT(BPF_LDX | BPF_IMM, 2 * length + kSubsystemOffset));
+        verifyJumps.push_back(prog.size());
+        prog.push_back(BPF_STMT(BPF_JMP | BPF_JA, 0));
+    }
+    prog.push_back(BPF_STMT(BPF_RET | BPF_K, kFilterAccept));
+
+    for (size_t jump : verifyJumps)
+        prog[jump].k = prog.size() - jump - 1;
+    // Not the expected layout, let the HAL look at it
+    appendCompare(&prog, 0, kSubsystemKey, &acceptJumps);
+
+    for (std::string_view subsystem : kUeventSubsystems) {
+        std::vector<size_t> nextJumps;
+
+        // Including the terminating NUL
+        appendCompare(&prog, kSubsystemKey.size(),
+                      std::string_view(subsystem.data(), subsystem.size() + 1), &nextJumps);
+        prog.push_back(BPF_STMT(BPF_RET | BPF_K, kFilterAccept));
+        ok &= patchJumps(&prog, nextJumps, prog.size());
+    }
+    prog.push_back(BPF_STMT(BPF_RET | BPF_K, kFilterDrop));
+    ok &= patchJumps(&prog, acceptJumps, prog.size());
+    prog.push_back(BPF_STMT(BPF_RET | BPF_K, kFilterAccept));
+
+    if (!ok || prog.size() > BPF_MAXINSNS) {
+        ALOGE("uevent filter: invalid program of %zu instructions", prog.size());
+        return false;
+    }
+
+    struct sock_fprog fprog = {.len = static_cast<unsigned short>(prog.size()),
+                               .filter = prog.data()};
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog))) {
+        ALOGE("uevent filter: SO_ATTACH_FILTER failed: %s", strerror(errno));
+        return false;
+    }
+
+    ALOGI("uevent filter attached, %zu instructions", prog.size());
+    return true;
+}
+
+UeventBatch::UeventBatch(bool kernelOnly) : mSize(0), mKernelOnly(kernelOnly) {
+    for (unsigned i = 0; i < kSize; i++) {
+        mIovecs[i] = {.iov_base = mBuffers[i], .iov_len = sizeof(mBuffers[i])};
+        mHeaders[i].msg_hdr = {.msg_name = &mAddresses[i],
+                               .msg_namelen = sizeof(mAddresses[i]),
+                               .msg_iov = &mIovecs[i],
+                               .msg_iovlen = 1,
+                               .msg_control = mControls[i],
+                               .msg_controllen = sizeof(mControls[i]),
+                               .msg_flags = 0};
+    }
+}
+
+// Whether the message was multicast by the kernel, with root credentials
+static bool isKernelUevent(const struct msghdr &hdr, const struct sockaddr_nl &address) {
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+
+    if (cmsg == NULL || cmsg->cmsg_type != SCM_CREDENTIALS)
+        return false;
+    if (reinterpret_cast<struct ucred *>(CMSG_DATA(cmsg))->uid != 0)
+        return false;
+    return address.nl_groups != 0 && address.nl_pid == 0;
+}
+
+bool UeventBatch::receive(int fd, bool *lost) {
+    int count;
+
+    mSize = 0;
+    for (unsigned i = 0; i < kSize; i++) {
+        // Reset by every reception
+        mHeaders[i].msg_hdr.msg_namelen = sizeof(mAddresses[i]);
+        mHeaders[i].msg_hdr.msg_controllen = sizeof(mControls[i]);
+    }
+
+    count = TEMP_FAILURE_RETRY(recvmmsg(fd, mHeaders, kSize, MSG_DONTWAIT, NULL));
+    if (count < 0) {
+        if (errno == ENOBUFS) {
+            // Reported once per overrun, the messages queued since can still be read
+            ALOGE("uevent socket overrun, uevents were lost");
+            *lost = true;
+            return true;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            ALOGE("uevent recvmmsg failed: %s", strerror(errno));
+        return false;
+    }
+
+    for (int i = 0; i < count; i++) {
+        const struct msghdr &hdr = mHeaders[i].msg_hdr;
+
+        if (hdr.msg_flags & MSG_TRUNC) {
+            ALOGE("uevent longer than %d bytes dropped", UEVENT_MSG_LEN);
+            *lost = true;
+            continue;
+        }
+        if (mKernelOnly && !isKernelUevent(hdr, mAddresses[i]))
+            continue;
+        if (UeventRecord::parse(mBuffers[i], mHeaders[i].msg_len, &mRecords[mSize]))
+            mSize++;
+    }
+
+    // A short batch drained the socket
+    return count == static_cast<int>(kSize);
+}
+
+bool UeventRecord::isPartnerAdded() const {
+    constexpr std::string_view kPartnerSuffix = "-partner"sv;
+
+    return action == "add"sv && devPath.size() >= kPartnerSuffix.size() &&
+           devPath.substr(devPath.size() - kPartnerSuffix.size()) == kPartnerSuffix;
+}
+
+bool UeventRecord::isPortChange() const {
+    return devType.substr(0, "typec_"sv.size()) == "typec_"sv || moistureDetected;
+}
+
+bool UeventRecord::isPowerChange(std::string_view supply) const {
+    if (subsystem == "usb_power_delivery"sv)
+        return true;
+    if (subsystem != "power_supply"sv || devPath.size() <= supply.size())
+        return false;
+
+    std::string_view name = devPath.substr(devPath.size() - supply.size());
+    return name == supply && devPath[devPath.size() - supply.size() - 1] == '/';
+}
+
+bool UeventRecord::isUsbDevice() const {
+    return subsystem == "usb"sv && devType == "usb_device"sv;
+}
+
+std::string_view UeventRecord::typecPort() const {
+    // Ports are the class devices right under the typec directory of their parent
+    constexpr std::string_view kTypecDir = "/typec/"sv;
+    size_t start = devPath.find(kTypecDir);
+
+    if (start == std::string_view::npos)
+        return std::string_view();
+
+    std::string_view port = devPath.substr(start + kTypecDir.size());
+    return port.substr(0, port.find('/'));
+}
+
+}  // namespace implementation
+}  // namespace V1_2
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_USB_V1_2_UEVENT_H
+#define ANDROID_HARDWARE_USB_V1_2_UEVENT_H
+
+#include <linux/netlink.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+#include <string_view>
+
+#define UEVENT_MSG_LEN 2048
+
+namespace android {
+namespace hardware {
+namespace usb {
+namespace V1_2 {
+namespace implementation {
+
+/*
+ * Fields of a kernel uevent the HAL acts on. The views point into the
+ * received message, which must outlive the record: parsing neither
+ * copies nor allocates.
+ */
+struct UeventRecord {
+    std::string_view action;
+    std::string_view devPath;
+    std::string_view subsystem;
+    std::string_view devType;
+    // POWER_SUPPLY_MOISTURE_DETECTED is present
+    bool moistureDetected = false;
+
+    /*
+     * Tokenizes the NUL separated "ACTION@DEVPATH\0KEY=VALUE\0..." message
+     * of len bytes in a single pass. Returns false if msg isn't a uevent.
+     */
+    static bool parse(const char *msg, size_t len, UeventRecord *record);
+
+    // A Type-C partner was registered, e.g. after a port type switch
+    bool isPartnerAdded() const;
+    // The state of a Type-C port, partner or cable, or the moisture state changed
+    bool isPortChange() const;
+    // The contract of a port may have changed: the power supply named supply or a USB PD
+    // device changed
+    bool isPowerChange(std::string_view supply) const;
+    // A USB device, root hubs included, enumerated or went away
+    bool isUsbDevice() const;
+    // Name of the Type-C port the uevent is about, e.g "port0", empty if none
+    std::string_view typecPort() const;
+};
+
+/*
+ * Attaches a socket filter to the uevent socket fd, so that the kernel drops
+ * the uevents of the subsystems the HAL ignores instead of queuing them and
+ * waking the worker thread up. The HAL keeps working unfiltered on failure.
+ */
+bool attachUeventFilter(int fd);
+
+/*
+ * Receives the uevents pending on a non-blocking uevent socket kSize at a
+ * time with a single recvmmsg(2), into buffers allocated once. Messages
+ * which aren't from the kernel are dropped, as uevent_kernel_multicast_recv()
+ * does.
+ */
+class UeventBatch {
+  public:
+    static constexpr unsigned kSize = 16;
+
+    // kernelOnly: drop the messages not multicast by the kernel, fd is the kernel uevent socket
+    explicit UeventBatch(bool kernelOnly = true);
+
+    /*
+     * Receives up to kSize uevents, parsed into records(). Sets *lost when
+     * uevents were lost since the last call: the receive buffer overran, or
+     * a message didn't fit in UEVENT_MSG_LEN. Returns false once fd has no
+     * more pending uevents, or on error.
+     */
+    bool receive(int fd, bool *lost);
+
+    const UeventRecord *records() const { return mRecords; }
+    size_t size() const { return mSize; }
+
+  private:
+    char mBuffers[kSize][UEVENT_MSG_LEN];
+    char mControls[kSize][CMSG_SPACE(sizeof(struct ucred))];
+    struct sockaddr_nl mAddresses[kSize];
+    struct iovec mIovecs[kSize];
+    struct mmsghdr mHeaders[kSize];
+    UeventRecord mRecords[kSize];
+    size_t mSize;
+    bool mKernelOnly;
+};
+
+}  // namespace implementation
+}  // namespace V1_2
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_USB_V1_2_UEVENT_H
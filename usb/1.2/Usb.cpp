@@ -15,28 +15,41 @@
  */
 
 #define LOG_TAG "android.hardware.usb@1.2-service.generic"
+#define ATRACE_TAG ATRACE_TAG_HAL
 
 #include <android-base/logging.h>
 #include <android-base/properties.h>
+#include <android-base/stringprintf.h>
 #include <assert.h>
 #include <dirent.h>
+#include <limits.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <algorithm>
 #include <chrono>
-#include <regex>
+#include <deque>
+#include <map>
+#include <memory>
+#include <set>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include <cutils/uevent.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <utils/Errors.h>
 #include <utils/StrongPointer.h>
+#include <utils/Trace.h>
 
+#include "PropertyCache.h"
+#include "Uevent.h"
 #include "Usb.h"
 
 using android::base::GetProperty;
+using android::base::StringPrintf;
 
 namespace android {
 namespace hardware {
@@ -44,15 +57,40 @@ namespace usb {
 namespace V1_2 {
 namespace implementation {
 
-// Set by the signal handler to destroy the thread
-volatile bool destroyThread;
-
 constexpr char kEnabledPath[] = "/sys/class/power_supply/usb/moisture_detection_enabled";
 constexpr char kConsole[] = "init.svc.console";
 constexpr char kDisableContatminantDetection[] = "vendor.usb.contaminantdisable";
+// Forces the ports to be reported as legacy USB ports, without Type-C
+constexpr char kTypecLegacy[] = "vendor.typec.legacy";
+// Time the port status is left to settle after a uevent, before notifying it
+constexpr char kSettleTime[] = "ro.vendor.usb.status_settle_ms";
+constexpr unsigned kDefaultSettleMs = 100;
+// Name of the power supply the ports sink power through
+constexpr char kPowerSupply[] = "ro.vendor.usb.power_supply";
+constexpr char kDefaultPowerSupply[] = "usb";
+
+// Control messages of the worker thread, or'ed into Usb::mControl
+// mRoleSwitchRequests changed
+constexpr unsigned kControlRoleSwitch = 1 << 0;
+// The ports may have changed without uevents, rescan them
+constexpr unsigned kControlRescan = 1 << 1;
+// A callback was registered, it gets the whole status at once
+constexpr unsigned kControlCallback = 1 << 2;
+// The worker thread exits, when the Usb instance is destroyed
+constexpr unsigned kControlExit = 1 << 3;
+
+// Path of a sysfs node under the root of the environment, e.g "/sys/bus/usb/devices"
+static std::string sysfsPath(const Usb *usb, const std::string &path) {
+    return usb->mEnvironment.sysfsRoot + path;
+}
+
+// Path of a node of the typec class, e.g "port0/data_role"
+static std::string typecPath(const Usb *usb, const std::string &node) {
+    return sysfsPath(usb, "/sys/class/typec/" + node);
+}
 
 void queryVersionHelper(android::hardware::usb::V1_2::implementation::Usb *usb,
-                        hidl_vec<PortStatus> *currentPortStatus_1_2);
+                        hidl_vec<PortStatus> *currentPortStatus_1_2, bool onlyIfChanged = false);
 
 int32_t readFile(const std::string &filename, std::string *contents) {
     FILE *fp;
@@ -100,11 +138,12 @@ Status queryMoistureDetectionStatus(hidl_vec<PortStatus> * /*currentPortStatus_1
 Return<void> Usb::enableContaminantPresenceDetection(const hidl_string & /*portName*/,
                                                      bool enable) {
 
-    std::string status = GetProperty(kConsole, "");
-    std::string disable = GetProperty(kDisableContatminantDetection, "");
+    static const CachedProperty &status = PropertyCache::instance().watch(kConsole);
+    static const CachedProperty &disable =
+        PropertyCache::instance().watch(kDisableContatminantDetection);
 
-    if (status != "running" && disable != "true")
-        writeFile(kEnabledPath, enable ? "1" : "0");
+    if (status.get() != "running" && disable.get() != "true")
+        writeFile(sysfsPath(this, kEnabledPath), enable ? "1" : "0");
 
     hidl_vec<PortStatus> currentPortStatus_1_2;
 
@@ -120,8 +159,8 @@ Return<void> Usb::enableContaminantPresenceProtection(const hidl_string & /*port
     return Void();
 }
 
-std::string appendRoleNodeHelper(const std::string &portName, PortRoleType type) {
-    std::string node("/sys/class/typec/" + portName);
+std::string appendRoleNodeHelper(const Usb *usb, const std::string &portName, PortRoleType type) {
+    std::string node(typecPath(usb, portName));
 
     switch (type) {
         case PortRoleType::DATA_ROLE:
@@ -155,6 +194,20 @@ std::string convertRoletoString(PortRole role) {
     return "none";
 }
 
+// Describes the role for the event log, e.g "data role host"
+static std::string describeRole(const PortRole &role) {
+    switch (role.type) {
+        case PortRoleType::DATA_ROLE:
+            return "data role " + convertRoletoString(role);
+        case PortRoleType::POWER_ROLE:
+            return "power role " + convertRoletoString(role);
+        case PortRoleType::MODE:
+            return "port type " + convertRoletoString(role);
+        default:
+            return "invalid role";
+    }
+}
+
 void extractRole(std::string *roleName) {
     std::size_t first, last;
 
@@ -166,8 +219,8 @@ void extractRole(std::string *roleName) {
     }
 }
 
-void switchToDrp(const std::string &portName) {
-    std::string filename = appendRoleNodeHelper(std::string(portName.c_str()), PortRoleType::MODE);
+void switchToDrp(const Usb *usb, const std::string &portName) {
+    std::string filename = appendRoleNodeHelper(usb, portName, PortRoleType::MODE);
     FILE *fp;
 
     if (filename != "") {
@@ -185,138 +238,135 @@ void switchToDrp(const std::string &portName) {
     }
 }
 
-bool switchMode(const hidl_string &portName, const PortRole &newRole, struct Usb *usb) {
-    std::string filename = appendRoleNodeHelper(std::string(portName.c_str()), newRole.type);
-    std::string written;
-    FILE *fp;
-    bool roleSwitch = false;
+// Writes the role to its sysfs node, the kernel carrying the switch out
+static bool writeRoleHelper(const std::string &filename, const PortRole &newRole) {
+    ATRACE_CALL();
+    FILE *fp = fopen(filename.c_str(), "w");
 
-    if (filename == "") {
-        ALOGE("Fatal: invalid node type");
+    if (fp == NULL) {
+        ALOGE("fopen failed");
         return false;
     }
 
-    fp = fopen(filename.c_str(), "w");
-    if (fp != NULL) {
-        // Hold the lock here to prevent loosing connected signals
-        // as once the file is written the partner added signal
-        // can arrive anytime.
-        pthread_mutex_lock(&usb->mPartnerLock);
-        usb->mPartnerUp = false;
-        int ret = fputs(convertRoletoString(newRole).c_str(), fp);
-        fclose(fp);
+    int ret = fputs(convertRoletoString(newRole).c_str(), fp);
+    fclose(fp);
+    return ret != EOF;
+}
 
-        if (ret != EOF) {
-            struct timespec to;
-            struct timespec now;
-
-        wait_again:
-            clock_gettime(CLOCK_MONOTONIC, &now);
-            to.tv_sec = now.tv_sec + PORT_TYPE_TIMEOUT;
-            to.tv_nsec = now.tv_nsec;
-
-            int err = pthread_cond_timedwait(&usb->mPartnerCV, &usb->mPartnerLock, &to);
-            // There are no uevent signals which implies role swap timed out.
-            if (err == ETIMEDOUT) {
-                ALOGI("uevents wait timedout");
-                // Sanity check.
-            } else if (!usb->mPartnerUp) {
-                goto wait_again;
-                // Role switch succeeded since usb->mPartnerUp is true.
-            } else {
-                roleSwitch = true;
-            }
-        } else {
-            ALOGI("Role switch failed while wrting to file");
-        }
-        pthread_mutex_unlock(&usb->mPartnerLock);
-    }
+void *work(void *param);
 
-    if (!roleSwitch)
-        switchToDrp(std::string(portName.c_str()));
+// Wakes the worker thread up to handle the control messages. Called with mLock held.
+static void signalWorkerHelper(Usb *usb, unsigned control) {
+    uint64_t one = 1;
 
-    return roleSwitch;
+    usb->mControl |= control;
+    if (write(usb->mControlFd, &one, sizeof(one)) != sizeof(one))
+        ALOGE("Control eventfd write failed: %s", strerror(errno));
 }
 
-Usb::Usb()
-    : mLock(PTHREAD_MUTEX_INITIALIZER),
-      mRoleSwitchLock(PTHREAD_MUTEX_INITIALIZER),
-      mPartnerLock(PTHREAD_MUTEX_INITIALIZER),
-      mPartnerUp(false) {
-    pthread_condattr_t attr;
-    if (pthread_condattr_init(&attr)) {
-        ALOGE("pthread_condattr_init failed: %s", strerror(errno));
-        abort();
-    }
-    if (pthread_condattr_setclock(&attr, CLOCK_MONOTONIC)) {
-        ALOGE("pthread_condattr_setclock failed: %s", strerror(errno));
-        abort();
-    }
-    if (pthread_cond_init(&mPartnerCV, &attr)) {
-        ALOGE("pthread_cond_init failed: %s", strerror(errno));
+Usb::Usb(UsbEnvironment environment)
+    : mEnvironment(std::move(environment)),
+      mLock(PTHREAD_MUTEX_INITIALIZER),
+      mNextTraceCookie(0),
+      mControl(0),
+      mPortsStatus(Status::SUCCESS),
+      mPortsValid(false),
+      mLastNotifiedStatus(Status::SUCCESS),
+      mLastNotifiedValid(false),
+      mNotifyCount(0),
+      mNotifySkipCount(0),
+      mPortUeventCount(0) {
+    mControlFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mControlFd < 0) {
+        ALOGE("eventfd failed: %s", strerror(errno));
         abort();
     }
-    if (pthread_condattr_destroy(&attr)) {
-        ALOGE("pthread_condattr_destroy failed: %s", strerror(errno));
+    // Switching the legacy mode doesn't send any uevent
+    mLegacyListener = PropertyCache::instance().addListener(kTypecLegacy, [this] {
+        pthread_mutex_lock(&mLock);
+        signalWorkerHelper(this, kControlRescan);
+        pthread_mutex_unlock(&mLock);
+    });
+
+    // Monitors the ports from now on, whether a callback is registered or not
+    if (pthread_create(&mPoll, NULL, work, this)) {
+        ALOGE("pthread creation failed %d", errno);
         abort();
     }
 }
 
-Return<void> Usb::switchRole(const hidl_string &portName, const V1_0::PortRole &newRole) {
-    std::string filename = appendRoleNodeHelper(std::string(portName.c_str()), newRole.type);
-    std::string written;
-    FILE *fp;
-    bool roleSwitch = false;
+Usb::~Usb() {
+    PropertyCache::instance().removeListener(mLegacyListener);
 
-    if (filename == "") {
-        ALOGE("Fatal: invalid node type");
-        return Void();
+    pthread_mutex_lock(&mLock);
+    signalWorkerHelper(this, kControlExit);
+    pthread_mutex_unlock(&mLock);
+    pthread_join(mPoll, NULL);
+    close(mControlFd);
+}
+
+// Captures the registered callback into the notification. Called with mLock held.
+static Notification newNotification(Usb *usb, Notification::Type type, Status status) {
+    Notification notification;
+
+    notification.type = type;
+    notification.callback_1_0 = usb->mCallback_1_0;
+    notification.callback_1_1 = usb->mCallback_1_1;
+    notification.callback_1_2 = usb->mCallback_1_2;
+    notification.status = status;
+    return notification;
+}
+
+// Reports the outcome of a role switch. Called with mLock held.
+static void notifyRoleSwitchHelper(Usb *usb, const std::string &portName, const PortRole &role,
+                                   bool success) {
+    if (usb->mCallback_1_0 == NULL) {
+        ALOGE("Not notifying the userspace. Callback is not set");
+        return;
     }
 
-    pthread_mutex_lock(&mRoleSwitchLock);
+    Notification notification = newNotification(usb, Notification::Type::ROLE_SWITCH,
+                                                success ? Status::SUCCESS : Status::ERROR);
+    notification.portName = portName;
+    notification.role = role;
+    usb->mDispatcher.post(std::move(notification));
+}
 
-    ALOGI("filename write: %s role:%s", filename.c_str(), convertRoletoString(newRole).c_str());
+/*
+ * Only queues the request for the worker thread, which reports the outcome
+ * through notifyRoleSwitchStatus(). A request replaces the one queued or
+ * running on the same port, which fails. Without a callback, the switch still
+ * happens and only its outcome goes unreported.
+ */
+Return<void> Usb::switchRole(const hidl_string &portName, const V1_0::PortRole &newRole) {
+    ATRACE_CALL();
+    std::string name(portName.c_str());
 
-    if (newRole.type == PortRoleType::MODE) {
-        roleSwitch = switchMode(portName, newRole, this);
-    } else {
-        fp = fopen(filename.c_str(), "w");
-        if (fp != NULL) {
-            int ret = fputs(convertRoletoString(newRole).c_str(), fp);
-            fclose(fp);
-            if ((ret != EOF) && !readFile(filename, &written)) {
-                extractRole(&written);
-                ALOGI("written: %s", written.c_str());
-                if (written == convertRoletoString(newRole)) {
-                    roleSwitch = true;
-                } else {
-                    ALOGE("Role switch failed");
-                }
-            } else {
-                ALOGE("failed to update the new role");
-            }
-        } else {
-            ALOGE("fopen failed");
-        }
+    if (appendRoleNodeHelper(this, name, newRole.type) == "") {
+        ALOGE("Fatal: invalid node type");
+        return Void();
     }
 
     pthread_mutex_lock(&mLock);
-    if (mCallback_1_0 != NULL) {
-        Return<void> ret = mCallback_1_0->notifyRoleSwitchStatus(
-            portName, newRole, roleSwitch ? Status::SUCCESS : Status::ERROR);
-        if (!ret.isOk())
-            ALOGE("RoleSwitchStatus error %s", ret.description().c_str());
-    } else {
-        ALOGE("Not notifying the userspace. Callback is not set");
+    auto queued = mRoleSwitchRequests.find(name);
+    if (queued != mRoleSwitchRequests.end()) {
+        ALOGI("%s: pending role switch cancelled", name.c_str());
+        mEventLog.record(name, describeRole(queued->second.role) + " cancelled, not started");
+        traceAsyncEnd("role switch", name, queued->second.cookie);
+        notifyRoleSwitchHelper(this, name, queued->second.role, false);
     }
+    int32_t cookie = mNextTraceCookie++;
+    mRoleSwitchRequests[name] = {newRole, cookie};
+    traceAsyncBegin("role switch", name, cookie);
+    mEventLog.record(name, describeRole(newRole) + " requested");
+    signalWorkerHelper(this, kControlRoleSwitch);
     pthread_mutex_unlock(&mLock);
-    pthread_mutex_unlock(&mRoleSwitchLock);
 
     return Void();
 }
 
-Status getAccessoryConnected(const std::string &portName, std::string *accessory) {
-    std::string filename = "/sys/class/typec/" + portName + "-partner/accessory_mode";
+Status getAccessoryConnected(const Usb *usb, const std::string &portName, std::string *accessory) {
+    std::string filename = typecPath(usb, portName + "-partner/accessory_mode");
 
     if (readFile(filename, accessory)) {
         ALOGE("getAccessoryConnected: Failed to open filesystem node: %s", filename.c_str());
@@ -326,8 +376,8 @@ Status getAccessoryConnected(const std::string &portName, std::string *accessory
     return Status::SUCCESS;
 }
 
-Status getCurrentRoleHelper(const std::string &portName, bool connected, PortRoleType type,
-                            uint32_t *currentRole) {
+Status getCurrentRoleHelper(const Usb *usb, const std::string &portName, bool connected,
+                            PortRoleType type, uint32_t *currentRole) {
     std::string filename;
     std::string roleName;
     std::string accessory;
@@ -335,13 +385,13 @@ Status getCurrentRoleHelper(const std::string &portName, bool connected, PortRol
     // Mode
 
     if (type == PortRoleType::POWER_ROLE) {
-        filename = "/sys/class/typec/" + portName + "/power_role";
+        filename = typecPath(usb, portName + "/power_role");
         *currentRole = static_cast<uint32_t>(PortPowerRole::NONE);
     } else if (type == PortRoleType::DATA_ROLE) {
-        filename = "/sys/class/typec/" + portName + "/data_role";
+        filename = typecPath(usb, portName + "/data_role");
         *currentRole = static_cast<uint32_t>(PortDataRole::NONE);
     } else if (type == PortRoleType::MODE) {
-        filename = "/sys/class/typec/" + portName + "/data_role";
+        filename = typecPath(usb, portName + "/data_role");
         *currentRole = static_cast<uint32_t>(PortMode_1_1::NONE);
     } else {
         return Status::ERROR;
@@ -351,7 +401,7 @@ Status getCurrentRoleHelper(const std::string &portName, bool connected, PortRol
         return Status::SUCCESS;
 
     if (type == PortRoleType::MODE) {
-        if (getAccessoryConnected(portName, &accessory) != Status::SUCCESS) {
+        if (getAccessoryConnected(usb, portName, &accessory) != Status::SUCCESS) {
             return Status::ERROR;
         }
         if (accessory == "analog_audio") {
@@ -394,14 +444,15 @@ Status getCurrentRoleHelper(const std::string &portName, bool connected, PortRol
     return Status::SUCCESS;
 }
 
-Status getTypeCPortNamesHelper(std::unordered_map<std::string, bool> *names) {
+Status getTypeCPortNamesHelper(const Usb *usb, std::unordered_map<std::string, bool> *names) {
+    static const CachedProperty &legacy = PropertyCache::instance().watch(kTypecLegacy);
     DIR *dp;
     /* Enable Typ USB Legacy Support via vendor.typec.legacy property */
-    if (property_get_bool("vendor.typec.legacy", false)) {
+    if (legacy.getBool(false)) {
 	    ALOGE("Force Legacy device enabled");
 	    return Status::ERROR;
     }
-    dp = opendir("/sys/class/typec");
+    dp = opendir(typecPath(usb, "").c_str());
     if (dp != NULL) {
         struct dirent *ep;
 
@@ -426,8 +477,8 @@ Status getTypeCPortNamesHelper(std::unordered_map<std::string, bool> *names) {
     return Status::ERROR;
 }
 
-bool canSwitchRoleHelper(const std::string &portName, PortRoleType /*type*/) {
-    std::string filename = "/sys/class/typec/" + portName + "-partner/supports_usb_power_delivery";
+bool canSwitchRoleHelper(const Usb *usb, const std::string &portName, PortRoleType /*type*/) {
+    std::string filename = typecPath(usb, portName + "-partner/supports_usb_power_delivery");
     std::string supportsPD;
 
     if (!readFile(filename, &supportsPD)) {
@@ -439,123 +490,169 @@ bool canSwitchRoleHelper(const std::string &portName, PortRoleType /*type*/) {
     return false;
 }
 
-/*
- * Reuse the same method for both V1_0 and V1_1 callback objects.
- * The caller of this method would reconstruct the V1_0::PortStatus
- * object if required.
- */
-Status getPortStatusHelper(hidl_vec<PortStatus> *currentPortStatus_1_2, HALVersion version) {
-    std::unordered_map<std::string, bool> names;
-    Status result = getTypeCPortNamesHelper(&names);
-    int i = -1;
+// Identifies the partner from its PD identity, empty if it doesn't report one
+static std::string getPartnerIdHelper(const Usb *usb, const std::string &portName) {
+    std::string identity = typecPath(usb, portName + "-partner/identity/");
+    std::string idHeader;
+    std::string product;
+
+    if (readFile(identity + "id_header", &idHeader) || readFile(identity + "product", &product))
+        return "";
+    // Not discovered (yet)
+    if (strtoul(idHeader.c_str(), NULL, 0) == 0)
+        return "";
+    return idHeader + ":" + product;
+}
 
-    if (result == Status::SUCCESS) {
-        currentPortStatus_1_2->resize(names.size());
-        for (std::pair<std::string, bool> port : names) {
-            i++;
-            ALOGI("%s", port.first.c_str());
-            (*currentPortStatus_1_2)[i].status_1_1.status.portName = port.first;
-
-            uint32_t currentRole;
-            if (getCurrentRoleHelper(port.first, port.second, PortRoleType::POWER_ROLE,
-                                     &currentRole) == Status::SUCCESS) {
-                (*currentPortStatus_1_2)[i].status_1_1.status.currentPowerRole =
-                    static_cast<PortPowerRole>(currentRole);
-            } else {
-                ALOGE("Error while retreiving portNames");
-                goto done;
-            }
+// Rereads the roles of a port, and the state of its partner when partnerChanged
+static void refreshPortHelper(const Usb *usb, const std::string &portName, bool partnerChanged,
+                              PortState *port) {
+    uint32_t currentRole;
+
+    port->status = Status::SUCCESS;
+    if (partnerChanged) {
+        std::string partner = typecPath(usb, portName + "-partner");
+
+        port->connected = !access(partner.c_str(), F_OK);
+        port->accessory.clear();
+        port->canSwitchRole = false;
+        port->partnerId.clear();
+        if (port->connected) {
+            if (getAccessoryConnected(usb, portName, &port->accessory) != Status::SUCCESS)
+                port->status = Status::ERROR;
+            port->canSwitchRole = canSwitchRoleHelper(usb, portName, PortRoleType::DATA_ROLE);
+            if (port->canSwitchRole)
+                port->partnerId = getPartnerIdHelper(usb, portName);
+        }
+    }
 
-            if (getCurrentRoleHelper(port.first, port.second, PortRoleType::DATA_ROLE,
-                                     &currentRole) == Status::SUCCESS) {
-                (*currentPortStatus_1_2)[i].status_1_1.status.currentDataRole =
-                    static_cast<PortDataRole>(currentRole);
-            } else {
-                ALOGE("Error while retreiving current port role");
-                goto done;
-            }
+    if (getCurrentRoleHelper(usb, portName, port->connected, PortRoleType::POWER_ROLE,
+                             &currentRole) == Status::SUCCESS) {
+        port->powerRole = static_cast<PortPowerRole>(currentRole);
+    } else {
+        ALOGE("Error while retreiving portNames");
+        port->status = Status::ERROR;
+    }
 
-            if (getCurrentRoleHelper(port.first, port.second, PortRoleType::MODE, &currentRole) ==
-                Status::SUCCESS) {
-                (*currentPortStatus_1_2)[i].status_1_1.currentMode =
-                    static_cast<PortMode_1_1>(currentRole);
-                (*currentPortStatus_1_2)[i].status_1_1.status.currentMode =
-                    static_cast<V1_0::PortMode>(currentRole);
-            } else {
-                ALOGE("Error while retreiving current data role");
-                goto done;
-            }
+    if (getCurrentRoleHelper(usb, portName, port->connected, PortRoleType::DATA_ROLE,
+                             &currentRole) == Status::SUCCESS) {
+        port->dataRole = static_cast<PortDataRole>(currentRole);
+    } else {
+        ALOGE("Error while retreiving current port role");
+        port->status = Status::ERROR;
+    }
 
-            (*currentPortStatus_1_2)[i].status_1_1.status.canChangeMode = true;
-            (*currentPortStatus_1_2)[i].status_1_1.status.canChangeDataRole =
-                port.second ? canSwitchRoleHelper(port.first, PortRoleType::DATA_ROLE) : false;
-            (*currentPortStatus_1_2)[i].status_1_1.status.canChangePowerRole =
-                port.second ? canSwitchRoleHelper(port.first, PortRoleType::POWER_ROLE) : false;
+    // As getCurrentRoleHelper() would for PortRoleType::MODE, without reading sysfs again
+    if (port->accessory == "analog_audio")
+        port->mode = PortMode_1_1::AUDIO_ACCESSORY;
+    else if (port->accessory == "debug")
+        port->mode = PortMode_1_1::DEBUG_ACCESSORY;
+    else if (port->dataRole == PortDataRole::HOST)
+        port->mode = PortMode_1_1::DFP;
+    else if (port->dataRole == PortDataRole::DEVICE)
+        port->mode = PortMode_1_1::UFP;
+    else
+        port->mode = PortMode_1_1::NONE;
+}
 
-            if (version == HALVersion::V1_0) {
-                ALOGI("HAL version V1_0");
-                (*currentPortStatus_1_2)[i].status_1_1.status.supportedModes = V1_0::PortMode::DRP;
-            } else {
-		if (version == HALVersion::V1_1)
-                    ALOGI("HAL version V1_1");
-		else
-                    ALOGI("HAL version V1_2");
-                (*currentPortStatus_1_2)[i].status_1_1.supportedModes = 0 | PortMode_1_1::DRP;
-                (*currentPortStatus_1_2)[i].status_1_1.status.supportedModes = V1_0::PortMode::NONE;
-                (*currentPortStatus_1_2)[i].status_1_1.status.currentMode = V1_0::PortMode::NONE;
-            }
+// Rebuilds the whole port table from sysfs. Called with mLock held.
+static void refreshAllPortsHelper(Usb *usb) {
+    std::unordered_map<std::string, bool> names;
+
+    usb->mPorts.clear();
+    usb->mPortsStatus = getTypeCPortNamesHelper(usb, &names);
+    for (const auto &name : names)
+        refreshPortHelper(usb, name.first, true, &usb->mPorts[name.first]);
+    usb->mPortsValid = true;
+}
+
+/*
+ * Reuse the same method for both V1_0 and V1_1 callback objects.
+ * The caller of this method would reconstruct the V1_0::PortStatus
+ * object if required. Serves the port table, without reading sysfs
+ * unless it wasn't built yet. Called with mLock held.
+ */
+Status getPortStatusHelper(Usb *usb, hidl_vec<PortStatus> *currentPortStatus_1_2,
+                           HALVersion version) {
+    Status result;
+    int i = -1;
 
-            ALOGI(
-                "%d:%s connected:%d canChangeMode:%d canChagedata:%d canChangePower:%d "
-                "supportedModes:%d",
-                i, port.first.c_str(), port.second,
-                (*currentPortStatus_1_2)[i].status_1_1.status.canChangeMode,
-                (*currentPortStatus_1_2)[i].status_1_1.status.canChangeDataRole,
-                (*currentPortStatus_1_2)[i].status_1_1.status.canChangePowerRole,
-                (*currentPortStatus_1_2)[i].status_1_1.supportedModes);
+    if (!usb->mPortsValid)
+        refreshAllPortsHelper(usb);
+
+    result = usb->mPortsStatus;
+    currentPortStatus_1_2->resize(usb->mPorts.size());
+    for (const auto &port : usb->mPorts) {
+        i++;
+        (*currentPortStatus_1_2)[i].status_1_1.status.portName = port.first;
+        (*currentPortStatus_1_2)[i].status_1_1.status.currentPowerRole = port.second.powerRole;
+        (*currentPortStatus_1_2)[i].status_1_1.status.currentDataRole = port.second.dataRole;
+        (*currentPortStatus_1_2)[i].status_1_1.currentMode = port.second.mode;
+        (*currentPortStatus_1_2)[i].status_1_1.status.currentMode =
+            static_cast<V1_0::PortMode>(port.second.mode);
+        if (port.second.status != Status::SUCCESS)
+            result = Status::ERROR;
+
+        (*currentPortStatus_1_2)[i].status_1_1.status.canChangeMode = true;
+        (*currentPortStatus_1_2)[i].status_1_1.status.canChangeDataRole =
+            port.second.canSwitchRole;
+        (*currentPortStatus_1_2)[i].status_1_1.status.canChangePowerRole =
+            port.second.canSwitchRole;
+
+        if (version == HALVersion::V1_0) {
+            (*currentPortStatus_1_2)[i].status_1_1.status.supportedModes = V1_0::PortMode::DRP;
+        } else {
+            (*currentPortStatus_1_2)[i].status_1_1.supportedModes = 0 | PortMode_1_1::DRP;
+            (*currentPortStatus_1_2)[i].status_1_1.status.supportedModes = V1_0::PortMode::NONE;
+            (*currentPortStatus_1_2)[i].status_1_1.status.currentMode = V1_0::PortMode::NONE;
         }
-        return Status::SUCCESS;
+
+        ALOGI(
+            "%d:%s connected:%d canChangeMode:%d canChagedata:%d canChangePower:%d "
+            "supportedModes:%d",
+            i, port.first.c_str(), port.second.connected,
+            (*currentPortStatus_1_2)[i].status_1_1.status.canChangeMode,
+            (*currentPortStatus_1_2)[i].status_1_1.status.canChangeDataRole,
+            (*currentPortStatus_1_2)[i].status_1_1.status.canChangePowerRole,
+            (*currentPortStatus_1_2)[i].status_1_1.supportedModes);
     }
-done:
-    return Status::ERROR;
+
+    return result;
 }
 
 void queryVersionHelper(android::hardware::usb::V1_2::implementation::Usb *usb,
-                        hidl_vec<PortStatus> *currentPortStatus_1_2) {
-    hidl_vec<V1_1::PortStatus_1_1> currentPortStatus_1_1;
-    hidl_vec<V1_0::PortStatus> currentPortStatus;
+                        hidl_vec<PortStatus> *currentPortStatus_1_2, bool onlyIfChanged) {
+    ATRACE_CALL();
     Status status;
-    sp<V1_1::IUsbCallback> callback_V1_1 = V1_1::IUsbCallback::castFrom(usb->mCallback_1_0);
-    sp<IUsbCallback> callback_V1_2 = IUsbCallback::castFrom(usb->mCallback_1_0);
 
     pthread_mutex_lock(&usb->mLock);
     if (usb->mCallback_1_0 != NULL) {
-        if (callback_V1_2 != NULL) {
-            status = getPortStatusHelper(currentPortStatus_1_2, HALVersion::V1_2);
+        if (usb->mCallback_1_2 != NULL) {
+            status = getPortStatusHelper(usb, currentPortStatus_1_2, HALVersion::V1_2);
             queryMoistureDetectionStatus(currentPortStatus_1_2);
-        } else if (callback_V1_1 != NULL) {
-            status = getPortStatusHelper(currentPortStatus_1_2, HALVersion::V1_1);
-            currentPortStatus_1_1.resize(currentPortStatus_1_2->size());
-            for (unsigned long i = 0; i < currentPortStatus_1_2->size(); i++)
-                currentPortStatus_1_1[i] = (*currentPortStatus_1_2)[i].status_1_1;
+        } else if (usb->mCallback_1_1 != NULL) {
+            status = getPortStatusHelper(usb, currentPortStatus_1_2, HALVersion::V1_1);
         } else {
-            status = getPortStatusHelper(currentPortStatus_1_2, HALVersion::V1_0);
-            currentPortStatus.resize(currentPortStatus_1_2->size());
-            for (unsigned long i = 0; i < currentPortStatus_1_2->size(); i++)
-                currentPortStatus[i] = (*currentPortStatus_1_2)[i].status_1_1.status;
+            status = getPortStatusHelper(usb, currentPortStatus_1_2, HALVersion::V1_0);
         }
 
-        Return<void> ret;
+        // The V1_2 status holds the older ones
+        if (onlyIfChanged && usb->mLastNotifiedValid && status == usb->mLastNotifiedStatus &&
+            *currentPortStatus_1_2 == usb->mLastNotifiedPortStatus) {
+            usb->mNotifySkipCount++;
+            pthread_mutex_unlock(&usb->mLock);
+            return;
+        }
 
-        if (callback_V1_2 != NULL)
-            ret = callback_V1_2->notifyPortStatusChange_1_2(*currentPortStatus_1_2, status);
-        else if (callback_V1_1 != NULL)
-            ret = callback_V1_1->notifyPortStatusChange_1_1(currentPortStatus_1_1, status);
-        else
-            ret = usb->mCallback_1_0->notifyPortStatusChange(currentPortStatus, status);
+        Notification notification =
+            newNotification(usb, Notification::Type::PORT_STATUS, status);
+        notification.portStatus = *currentPortStatus_1_2;
+        usb->mDispatcher.post(std::move(notification));
 
-        if (!ret.isOk())
-            ALOGE("queryPortStatus_1_2 error %s", ret.description().c_str());
+        usb->mLastNotifiedPortStatus = *currentPortStatus_1_2;
+        usb->mLastNotifiedStatus = status;
+        usb->mLastNotifiedValid = true;
+        usb->mNotifyCount++;
     } else {
         ALOGI("Notifying userspace skipped. Callback is NULL");
     }
@@ -569,82 +666,794 @@ Return<void> Usb::queryPortStatus() {
     return Void();
 }
 
+Return<void> Usb::debug(const hidl_handle &handle, const hidl_vec<hidl_string> & /*options*/) {
+    const native_handle_t *native = handle.getNativeHandle();
+
+    if (native == NULL || native->numFds < 1) {
+        ALOGE("debug: no file descriptor to write to");
+        return Void();
+    }
+
+    int fd = native->data[0];
+    auto now = std::chrono::steady_clock::now();
+    std::vector<std::pair<std::string, PowerContract>> contracts;
+
+    // The client may read slowly or not at all: copies the state, and writes it unlocked
+    pthread_mutex_lock(&mLock);
+    unsigned long notifyCount = mNotifyCount;
+    unsigned long notifySkipCount = mNotifySkipCount;
+    unsigned long portUeventCount = mPortUeventCount;
+    for (const auto &power : mPortPower)
+        contracts.emplace_back(power.first, power.second.snapshot(now));
+    std::map<std::string, unsigned> degradedLinkCount = mDegradedLinkCount;
+    std::map<std::string, UsbDeviceLink> hostLinks = mHostLinks;
+    pthread_mutex_unlock(&mLock);
+
+    dprintf(fd, "port status notifications: %lu queued, %lu unchanged skipped, "
+            "%lu port uevents\n", notifyCount, notifySkipCount, portUeventCount);
+    for (const auto &[port, contract] : contracts) {
+        // PDO positions count from 1, 0 if the PDO isn't known
+        if (contract.sinking) {
+            dprintf(fd, "%s power: %umV %umA (%umW), best %umW, PDO %d of %zu",
+                    port.c_str(), contract.voltageMv, contract.currentMaxMa,
+                    contract.contractPowerMw, contract.bestPowerMw, contract.selectedPdo + 1,
+                    contract.sourceCapabilities.size());
+        } else {
+            dprintf(fd, "%s power: %s", port.c_str(),
+                    contract.connected ? "not sinking" : "disconnected");
+        }
+        dprintf(fd, ", below best %llums (%u times)\n",
+                static_cast<unsigned long long>(contract.belowBestMs), contract.belowBestCount);
+    }
+    for (const auto &count : degradedLinkCount) {
+        dprintf(fd, "%s degraded host links: %u\n",
+                count.first.empty() ? "unknown port" : count.first.c_str(), count.second);
+    }
+    for (const auto &link : hostLinks) {
+        dprintf(fd, "usb device %s%s%s: %sMbps of %uMbps, USB %s, %u ports%s\n",
+                link.first.c_str(), link.second.portName.empty() ? "" : " on ",
+                link.second.portName.c_str(), link.second.speed.c_str(),
+                link.second.capableSpeedMbps, link.second.version.c_str(), link.second.maxChild,
+                link.second.degraded ? ", degraded" : "");
+    }
+    mDispatcher.dump(fd);
+    mEventLog.dump(fd);
+    return Void();
+}
+
+bool Usb::getPowerContracts(hidl_vec<PowerContract> *contracts) {
+    auto now = std::chrono::steady_clock::now();
+    size_t i = 0;
+
+    pthread_mutex_lock(&mLock);
+    bool valid = mPortsValid;
+    contracts->resize(mPortPower.size());
+    for (const auto &power : mPortPower)
+        (*contracts)[i++] = power.second.snapshot(now);
+    pthread_mutex_unlock(&mLock);
+    return valid;
+}
+
+bool Usb::getHostLinks(hidl_vec<UsbDeviceLink> *links) {
+    size_t i = 0;
+
+    pthread_mutex_lock(&mLock);
+    bool valid = mPortsValid;
+    links->resize(mHostLinks.size());
+    for (const auto &link : mHostLinks)
+        (*links)[i++] = link.second;
+    pthread_mutex_unlock(&mLock);
+    return valid;
+}
+
+void Usb::setExtCallback(const sp<IUsbExtCallback> &callback) {
+    pthread_mutex_lock(&mLock);
+    mExtCallback = callback;
+    pthread_mutex_unlock(&mLock);
+}
+
+// What a burst of uevents changed about a port
+struct PortUpdate {
+    bool partnerChanged = false;
+    bool removed = false;
+};
+
+// Port type switch waiting for the partner to come back
+struct RoleSwitch {
+    PortRole role;
+    // Of the async trace events of the switch
+    int32_t cookie;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point deadline;
+    // Key of the history the outcome goes to
+    std::string historyKey;
+};
+
+// Recent role switches of a kind with a partner, to fail the hopeless ones fast
+struct SwitchHistory {
+    // Consecutive failures, and the time of the last one
+    unsigned failures = 0;
+    std::chrono::steady_clock::time_point lastFailure;
+    // Latencies of the last successful port type switches, oldest first
+    std::deque<std::chrono::milliseconds> latencies;
+};
+
+// Failures in a row after which the switches fail at once, for kFailFastPeriod after the last
+constexpr unsigned kFailFastCount = 2;
+constexpr std::chrono::seconds kFailFastPeriod(60);
+// Port type switch latencies the timeout adapts to, which is twice the longest one
+constexpr size_t kSwitchLatencyCount = 4;
+constexpr std::chrono::seconds kMinSwitchTimeout(2);
+
 struct data {
     int uevent_fd;
     android::hardware::usb::V1_2::implementation::Usb *usb;
+    UeventBatch *batch;
+    // Ports changed by the uevents received since the last notification
+    std::map<std::string, PortUpdate> updates;
+    // A port status notification is due at notifyTime
+    bool notifyPending;
+    std::chrono::steady_clock::time_point notifyTime;
+    std::chrono::milliseconds settleTime;
+    // Port type switches in progress, by port name. The ports switch concurrently.
+    std::map<std::string, RoleSwitch> roleSwitches;
+    // By partner, or port for partners without PD identity, and role type
+    std::map<std::string, SwitchHistory> switchHistory;
+    // Name of the power supply the ports sink power through
+    std::string powerSupply;
+    // Set by kControlExit, the worker thread exits
+    bool exit;
 };
 
-static void uevent_event(uint32_t /*epevents*/, struct data *payload) {
-    char msg[UEVENT_MSG_LEN + 2];
-    char *cp;
-    int n;
+// Records the change the uevent makes to its port, if any
+static void addPortUpdate(const UeventRecord &uevent, std::map<std::string, PortUpdate> *updates) {
+    std::string_view portName = uevent.typecPort();
+
+    if (portName.empty())
+        return;
+
+    // Roles change with typec_port events, alternate modes, cables and plugs change nothing
+    if (uevent.devType == "typec_port") {
+        PortUpdate &update = (*updates)[std::string(portName)];
+
+        update.removed = uevent.action == "remove";
+        update.partnerChanged |= uevent.action == "add";
+    } else if (uevent.devType == "typec_partner") {
+        (*updates)[std::string(portName)].partnerChanged = true;
+    }
+}
+
+// Rereads the ports the uevents changed, the others are left as they are
+static void updatePortsHelper(Usb *usb, const std::map<std::string, PortUpdate> &updates) {
+    pthread_mutex_lock(&usb->mLock);
+    if (usb->mPortsValid) {
+        for (const auto &update : updates) {
+            auto port = usb->mPorts.find(update.first);
+
+            if (update.second.removed) {
+                if (port != usb->mPorts.end())
+                    usb->mPorts.erase(port);
+            } else if (port == usb->mPorts.end()) {
+                refreshPortHelper(usb, update.first, true, &usb->mPorts[update.first]);
+            } else {
+                refreshPortHelper(usb, update.first, update.second.partnerChanged, &port->second);
+            }
+        }
+    }
+    pthread_mutex_unlock(&usb->mLock);
+}
+
+// Rebuilds the port table, e.g. after uevents were lost
+static void resyncPortsHelper(Usb *usb) {
+    pthread_mutex_lock(&usb->mLock);
+    refreshAllPortsHelper(usb);
+    pthread_mutex_unlock(&usb->mLock);
+}
+
+// Rereads the power contract of the ports, counting the time they spend below their best one
+static void updatePowerHelper(struct data *payload) {
+    struct PowerPort {
+        std::string name;
+        bool connected;
+        bool sinking;
+        PowerContract contract;
+    };
+    Usb *usb = payload->usb;
+    std::vector<PowerPort> ports;
+    std::vector<std::pair<std::string, std::string>> changes;
+
+    pthread_mutex_lock(&usb->mLock);
+    for (const auto &port : usb->mPorts) {
+        ports.push_back({port.first, port.second.connected,
+                         port.second.powerRole == PortPowerRole::SINK, PowerContract()});
+    }
+    pthread_mutex_unlock(&usb->mLock);
+
+    // Outside of the lock, the HAL calls don't wait for sysfs
+    for (PowerPort &port : ports) {
+        PowerContractPaths paths = {
+                typecPath(usb, port.name + "-partner/usb_power_delivery"),
+                typecPath(usb, port.name + "/usb_power_delivery"),
+                sysfsPath(usb, "/sys/class/power_supply/" + payload->powerSupply)};
+
+        readPowerContract(paths, port.connected, port.sinking, &port.contract);
+        port.contract.portName = port.name;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    pthread_mutex_lock(&usb->mLock);
+    for (auto power = usb->mPortPower.begin(); power != usb->mPortPower.end();) {
+        if (usb->mPorts.count(power->first))
+            ++power;
+        else
+            power = usb->mPortPower.erase(power);
+    }
+    for (PowerPort &port : ports) {
+        const PowerContract &contract = port.contract;
+        std::string change = contract.sinking
+            ? StringPrintf("power contract %umV %umA, best %umW", contract.voltageMv,
+                           contract.currentMaxMa, contract.bestPowerMw)
+            : "power contract none";
+
+        traceCounter("contract mW", port.name, contract.contractPowerMw);
+        if (usb->mPortPower[port.name].update(std::move(port.contract), now))
+            changes.push_back({port.name, change});
+    }
+    pthread_mutex_unlock(&usb->mLock);
 
-    n = uevent_kernel_multicast_recv(payload->uevent_fd, msg, UEVENT_MSG_LEN);
-    if (n <= 0)
+    for (const auto &change : changes)
+        usb->mEventLog.record(change.first, change.second);
+}
+
+// Stops counting the time below the best contracts, the ports not being monitored anymore
+static void stopPowerHelper(Usb *usb) {
+    auto now = std::chrono::steady_clock::now();
+
+    pthread_mutex_lock(&usb->mLock);
+    for (auto &power : usb->mPortPower)
+        power.second.stop(now);
+    pthread_mutex_unlock(&usb->mLock);
+}
+
+// Type-C port a USB device is attached through, the ports linking to their root hub ports
+static std::string hostLinkPortHelper(Usb *usb, const std::string &name) {
+    std::string rootPort = rootHubPort(name);
+    std::vector<std::string> ports;
+
+    pthread_mutex_lock(&usb->mLock);
+    for (const auto &port : usb->mPorts)
+        ports.push_back(port.first);
+    pthread_mutex_unlock(&usb->mLock);
+
+    for (const std::string &port : ports) {
+        if (!rootPort.empty() && !access(typecPath(usb, port + "/" + rootPort).c_str(), F_OK))
+            return port;
+    }
+    // Without the links, a single port is the only one the device can be attached through
+    return ports.size() == 1 ? ports[0] : "";
+}
+
+// Adds the USB device in sysfs directory dir, counting and notifying it if its link is degraded
+static void hostLinkAdded(Usb *usb, const std::string &dir) {
+    UsbDeviceLink link;
+
+    if (!readHostLink(dir, &link))
         return;
-    if (n >= UEVENT_MSG_LEN) /* overflow -- discard */
+    link.portName = hostLinkPortHelper(usb, link.name);
+
+    std::string name(link.name);
+    std::string port(link.portName);
+    std::string event = StringPrintf("usb device %s added, %sMbps of %uMbps, USB %s", name.c_str(),
+                                     link.speed.c_str(), link.capableSpeedMbps,
+                                     link.version.c_str());
+    unsigned count = 0;
+
+    pthread_mutex_lock(&usb->mLock);
+    auto known = usb->mHostLinks.find(name);
+    bool added = known == usb->mHostLinks.end();
+    bool degraded = link.degraded && (added || !known->second.degraded);
+    if (degraded) {
+        count = ++usb->mDegradedLinkCount[port];
+        if (usb->mExtCallback != NULL) {
+            Notification notification;
+
+            notification.type = Notification::Type::LINK_DEGRADED;
+            notification.extCallback = usb->mExtCallback;
+            notification.link = link;
+            notification.degradedCount = count;
+            usb->mDispatcher.post(std::move(notification));
+        }
+    }
+    usb->mHostLinks[name] = std::move(link);
+    pthread_mutex_unlock(&usb->mLock);
+
+    if (degraded) {
+        ALOGE("%s: USB device %s link degraded", port.c_str(), name.c_str());
+        event += ", degraded";
+        traceCounter("degraded links", port, count);
+    }
+    if (added || degraded)
+        usb->mEventLog.record(port.empty() ? "usb" : port, event);
+}
+
+static void hostLinkRemoved(Usb *usb, const std::string &name) {
+    std::string port;
+    bool removed = false;
+
+    pthread_mutex_lock(&usb->mLock);
+    auto link = usb->mHostLinks.find(name);
+    if (link != usb->mHostLinks.end()) {
+        port = link->second.portName;
+        usb->mHostLinks.erase(link);
+        removed = true;
+    }
+    pthread_mutex_unlock(&usb->mLock);
+
+    if (removed)
+        usb->mEventLog.record(port.empty() ? "usb" : port, "usb device " + name + " removed");
+}
+
+// Rebuilds the USB devices attached from sysfs, only counting the links newly degraded
+static void resyncHostLinksHelper(Usb *usb) {
+    std::string devices = sysfsPath(usb, "/sys/bus/usb/devices");
+    std::set<std::string> present;
+    DIR *dp = opendir(devices.c_str());
+
+    if (dp == NULL)
         return;
 
-    msg[n] = '\0';
-    msg[n + 1] = '\0';
-    cp = msg;
-
-    while (*cp) {
-        if (std::regex_match(cp, std::regex("(add)(.*)(-partner)"))) {
-            ALOGI("partner added");
-            pthread_mutex_lock(&payload->usb->mPartnerLock);
-            payload->usb->mPartnerUp = true;
-            pthread_cond_signal(&payload->usb->mPartnerCV);
-            pthread_mutex_unlock(&payload->usb->mPartnerLock);
-        } else if (!strncmp(cp, "DEVTYPE=typec_", strlen("DEVTYPE=typec_")) ||
-                   !strncmp(cp, "POWER_SUPPLY_MOISTURE_DETECTED",
-                            strlen("POWER_SUPPLY_MOISTURE_DETECTED"))) {
-            hidl_vec<PortStatus> currentPortStatus_1_2;
-            queryVersionHelper(payload->usb, &currentPortStatus_1_2);
-
-            // Role switch is not in progress and port is in disconnected state
-            if (!pthread_mutex_trylock(&payload->usb->mRoleSwitchLock)) {
-                for (unsigned long i = 0; i < currentPortStatus_1_2.size(); i++) {
-                    DIR *dp =
-                        opendir(std::string("/sys/class/typec/" +
-                                            std::string(currentPortStatus_1_2[i]
-                                                            .status_1_1.status.portName.c_str()) +
-                                            "-partner")
-                                    .c_str());
-                    if (dp == NULL) {
-                        // PortRole role = {.role = static_cast<uint32_t>(PortMode::UFP)};
-                        switchToDrp(currentPortStatus_1_2[i].status_1_1.status.portName);
-                    } else {
-                        closedir(dp);
-                    }
-                }
-                pthread_mutex_unlock(&payload->usb->mRoleSwitchLock);
+    struct dirent *ep;
+    while ((ep = readdir(dp))) {
+        char dir[PATH_MAX];
+
+        // The links are named after the devices, their targets tell the root hubs apart
+        if (ep->d_name[0] != '.' && realpath((devices + "/" + ep->d_name).c_str(), dir)) {
+            present.insert(ep->d_name);
+            hostLinkAdded(usb, dir);
+        }
+    }
+    closedir(dp);
+
+    pthread_mutex_lock(&usb->mLock);
+    for (auto link = usb->mHostLinks.begin(); link != usb->mHostLinks.end();) {
+        if (present.count(link->first))
+            ++link;
+        else
+            link = usb->mHostLinks.erase(link);
+    }
+    pthread_mutex_unlock(&usb->mLock);
+}
+
+static void finishRoleSwitch(Usb *usb, const std::string &portName, const PortRole &role,
+                             int32_t cookie, bool success) {
+    traceAsyncEnd("role switch", portName, cookie);
+    pthread_mutex_lock(&usb->mLock);
+    notifyRoleSwitchHelper(usb, portName, role, success);
+    pthread_mutex_unlock(&usb->mLock);
+}
+
+// Records the outcome of a switch, latency being only set for successful port type ones
+static void recordRoleSwitch(struct data *payload, const std::string &historyKey, bool success,
+                             std::chrono::milliseconds latency = std::chrono::milliseconds(0)) {
+    SwitchHistory &history = payload->switchHistory[historyKey];
+
+    if (!success) {
+        history.failures++;
+        history.lastFailure = std::chrono::steady_clock::now();
+        return;
+    }
+
+    history.failures = 0;
+    if (latency.count()) {
+        history.latencies.push_back(latency);
+        if (history.latencies.size() > kSwitchLatencyCount)
+            history.latencies.pop_front();
+    }
+}
+
+// Time a port type switch is given, adapted to the ones observed with the partner
+static std::chrono::milliseconds switchTimeout(const SwitchHistory &history) {
+    std::chrono::milliseconds timeout = std::chrono::seconds(PORT_TYPE_TIMEOUT);
+
+    if (!history.latencies.empty()) {
+        auto longest = *std::max_element(history.latencies.begin(), history.latencies.end());
+
+        timeout = std::min(timeout, std::max<std::chrono::milliseconds>(2 * longest,
+                                                                        kMinSwitchTimeout));
+    }
+    return timeout;
+}
+
+/*
+ * Checks whether the switch may succeed, from the port table and the
+ * partner history, so that hopeless switches fail without waiting. Sets
+ * the key of the partner history.
+ */
+static bool preflightRoleSwitch(struct data *payload, const std::string &portName,
+                                const PortRole &newRole, std::string *historyKey) {
+    Usb *usb = payload->usb;
+    std::string role = describeRole(newRole);
+    bool connected = false;
+    bool supportsPD = false;
+
+    pthread_mutex_lock(&usb->mLock);
+    auto port = usb->mPorts.find(portName);
+    if (port != usb->mPorts.end()) {
+        connected = port->second.connected;
+        supportsPD = port->second.canSwitchRole;
+        *historyKey = port->second.partnerId;
+    }
+    pthread_mutex_unlock(&usb->mLock);
+
+    if (historyKey->empty())
+        *historyKey = portName;
+    *historyKey += "/" + std::to_string(static_cast<uint32_t>(newRole.type));
+
+    // The partner must come back after a port type switch, it can't without a partner
+    if (!connected) {
+        ALOGE("%s: role switch failed, no partner attached", portName.c_str());
+        usb->mEventLog.record(portName, role + " failed, no partner attached");
+        return false;
+    }
+    // Data and power role swaps are PD messages, port type switches work without PD
+    if (newRole.type != PortRoleType::MODE && !supportsPD) {
+        ALOGE("%s: role switch failed, the partner doesn't support USB PD", portName.c_str());
+        usb->mEventLog.record(portName, role + " failed, the partner doesn't support USB PD");
+        return false;
+    }
+
+    auto history = payload->switchHistory.find(*historyKey);
+    if (history != payload->switchHistory.end() && history->second.failures >= kFailFastCount &&
+        std::chrono::steady_clock::now() - history->second.lastFailure < kFailFastPeriod) {
+        ALOGE("%s: role switch failed, it failed %u times in a row with this partner",
+              portName.c_str(), history->second.failures);
+        usb->mEventLog.record(portName, role + " failed, it failed " +
+                                            std::to_string(history->second.failures) +
+                                            " times in a row with this partner");
+        return false;
+    }
+
+    return true;
+}
+
+// Starts a role switch, which completes at once unless it's a port type one
+static void startRoleSwitch(struct data *payload, const std::string &portName,
+                            const RoleSwitchRequest &request) {
+    ATRACE_CALL();
+    const PortRole &newRole = request.role;
+    std::string filename = appendRoleNodeHelper(payload->usb, portName, newRole.type);
+    std::string historyKey;
+    std::string written;
+    bool roleSwitch = false;
+
+    if (!preflightRoleSwitch(payload, portName, newRole, &historyKey)) {
+        finishRoleSwitch(payload->usb, portName, newRole, request.cookie, false);
+        return;
+    }
+
+    ALOGI("filename write: %s role:%s", filename.c_str(), convertRoletoString(newRole).c_str());
+
+    if (newRole.type == PortRoleType::MODE) {
+        // The port type switched once the partner comes back, cf partnerAdded()
+        if (writeRoleHelper(filename, newRole)) {
+            RoleSwitch &roleSwitch = payload->roleSwitches[portName];
+            std::chrono::milliseconds timeout = switchTimeout(payload->switchHistory[historyKey]);
+
+            roleSwitch.role = newRole;
+            roleSwitch.cookie = request.cookie;
+            roleSwitch.start = std::chrono::steady_clock::now();
+            roleSwitch.deadline = roleSwitch.start + timeout;
+            roleSwitch.historyKey = historyKey;
+            traceAsyncBegin("partner wait", portName, request.cookie);
+            payload->usb->mEventLog.record(portName, describeRole(newRole) + " started, timeout " +
+                                                         std::to_string(timeout.count()) + "ms");
+            return;
+        }
+        ALOGI("Role switch failed while wrting to file");
+        switchToDrp(payload->usb, portName);
+    } else if (writeRoleHelper(filename, newRole) && !readFile(filename, &written)) {
+        extractRole(&written);
+        ALOGI("written: %s", written.c_str());
+        if (written == convertRoletoString(newRole)) {
+            roleSwitch = true;
+        } else {
+            ALOGE("Role switch failed");
+        }
+    } else {
+        ALOGE("failed to update the new role");
+    }
+
+    recordRoleSwitch(payload, historyKey, roleSwitch);
+    payload->usb->mEventLog.record(portName,
+                                   describeRole(newRole) + (roleSwitch ? " done" : " failed"));
+    finishRoleSwitch(payload->usb, portName, newRole, request.cookie, roleSwitch);
+}
+
+// Completes the port type switch of the port, if any
+static void partnerAdded(struct data *payload, const std::string &portName) {
+    auto roleSwitch = payload->roleSwitches.find(portName);
+
+    ALOGI("%s: partner added", portName.c_str());
+    if (roleSwitch == payload->roleSwitches.end())
+        return;
+
+    PortRole role = roleSwitch->second.role;
+    int32_t cookie = roleSwitch->second.cookie;
+    auto latency = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - roleSwitch->second.start);
+
+    ALOGI("%s: port type switched in %lldms", portName.c_str(),
+          static_cast<long long>(latency.count()));
+    traceAsyncEnd("partner wait", portName, cookie);
+    payload->usb->mEventLog.record(
+        portName, describeRole(role) + " done in " + std::to_string(latency.count()) + "ms");
+    recordRoleSwitch(payload, roleSwitch->second.historyKey, true, latency);
+    payload->roleSwitches.erase(roleSwitch);
+    finishRoleSwitch(payload->usb, portName, role, cookie, true);
+}
+
+// Fails the port type switches whose partner didn't come back in time
+static void expireRoleSwitches(struct data *payload) {
+    auto now = std::chrono::steady_clock::now();
+
+    for (auto roleSwitch = payload->roleSwitches.begin();
+         roleSwitch != payload->roleSwitches.end();) {
+        if (roleSwitch->second.deadline > now) {
+            ++roleSwitch;
+            continue;
+        }
+
+        // There are no uevent signals which implies role swap timed out.
+        ALOGI("%s: uevents wait timedout", roleSwitch->first.c_str());
+        traceAsyncEnd("partner wait", roleSwitch->first, roleSwitch->second.cookie);
+        payload->usb->mEventLog.record(roleSwitch->first,
+                                       describeRole(roleSwitch->second.role) +
+                                           " timed out, the partner didn't come back");
+        recordRoleSwitch(payload, roleSwitch->second.historyKey, false);
+        switchToDrp(payload->usb, roleSwitch->first);
+        finishRoleSwitch(payload->usb, roleSwitch->first, roleSwitch->second.role,
+                         roleSwitch->second.cookie, false);
+        roleSwitch = payload->roleSwitches.erase(roleSwitch);
+    }
+}
+
+// Starts the role switches requested since the last call
+static void runRoleSwitchesHelper(struct data *payload) {
+    ATRACE_CALL();
+    std::map<std::string, RoleSwitchRequest> requests;
+
+    pthread_mutex_lock(&payload->usb->mLock);
+    requests.swap(payload->usb->mRoleSwitchRequests);
+    pthread_mutex_unlock(&payload->usb->mLock);
+
+    // The pre-flight checks need the partners attached since the last notification
+    updatePortsHelper(payload->usb, payload->updates);
+    payload->updates.clear();
+
+    for (const auto &request : requests) {
+        auto running = payload->roleSwitches.find(request.first);
+
+        // Superseded by the new request, which writes the port type again
+        if (running != payload->roleSwitches.end()) {
+            ALOGI("%s: running role switch cancelled", request.first.c_str());
+            PortRole role = running->second.role;
+            int32_t cookie = running->second.cookie;
+            traceAsyncEnd("partner wait", request.first, cookie);
+            payload->usb->mEventLog.record(request.first, describeRole(role) + " cancelled");
+            payload->roleSwitches.erase(running);
+            finishRoleSwitch(payload->usb, request.first, role, cookie, false);
+        }
+        startRoleSwitch(payload, request.first, request.second);
+    }
+}
+
+// Time until the next settled notification or role switch timeout, -1 if none
+static int nextTimeoutMs(const struct data &payload) {
+    auto next = std::chrono::steady_clock::time_point::max();
+
+    if (payload.notifyPending)
+        next = payload.notifyTime;
+    for (const auto &roleSwitch : payload.roleSwitches)
+        next = std::min(next, roleSwitch.second.deadline);
+
+    if (next == std::chrono::steady_clock::time_point::max())
+        return -1;
+
+    auto timeout = std::chrono::ceil<std::chrono::milliseconds>(
+        next - std::chrono::steady_clock::now());
+    return std::max<int>(timeout.count(), 0);
+}
+
+// Notifies the status of the ports the uevents changed once they settled
+static void notifyPortChange(struct data *payload) {
+    ATRACE_CALL();
+    hidl_vec<PortStatus> currentPortStatus_1_2;
+    std::vector<std::string> disconnected;
+
+    payload->notifyPending = false;
+    updatePortsHelper(payload->usb, payload->updates);
+    payload->updates.clear();
+
+    queryVersionHelper(payload->usb, &currentPortStatus_1_2, true);
+    updatePowerHelper(payload);
+
+    pthread_mutex_lock(&payload->usb->mLock);
+    for (const auto &port : payload->usb->mPorts) {
+        traceCounter("connected", port.first, port.second.connected);
+        // Role switch is not in progress and port is in disconnected state
+        if (!port.second.connected && !payload->roleSwitches.count(port.first))
+            disconnected.push_back(port.first);
+    }
+    pthread_mutex_unlock(&payload->usb->mLock);
+
+    for (const std::string &portName : disconnected) {
+        // PortRole role = {.role = static_cast<uint32_t>(PortMode::UFP)};
+        switchToDrp(payload->usb, portName);
+    }
+}
+
+static void uevent_event(uint32_t /*epevents*/, struct data *payload) {
+    ATRACE_CALL();
+    bool pending;
+    bool lost = false;
+    bool portChange = false;
+    bool powerChange = false;
+    unsigned long portUevents = 0;
+
+    // Drain the socket, a burst of uevents then costs a single port status query
+    do {
+        pending = payload->batch->receive(payload->uevent_fd, &lost);
+        ATRACE_INT("usb uevent batch", payload->batch->size());
+        for (size_t i = 0; i < payload->batch->size(); i++) {
+            const UeventRecord &uevent = payload->batch->records()[i];
+
+            // Plugs and unplugs of partners and ports
+            if ((uevent.action == "add" || uevent.action == "remove") &&
+                (uevent.devType == "typec_partner" || uevent.devType == "typec_port")) {
+                payload->usb->mEventLog.record(
+                    std::string(uevent.typecPort()),
+                    std::string(uevent.devType.substr(strlen("typec_"))) + " " +
+                        std::string(uevent.action));
+            }
+
+            // Not delayed, a role switch may be waiting for it
+            if (uevent.isPartnerAdded())
+                partnerAdded(payload, std::string(uevent.typecPort()));
+            if (uevent.isPowerChange(payload->powerSupply))
+                powerChange = true;
+            // Only enumerations change the speed of a device, there is no need to settle
+            if (uevent.isUsbDevice() && uevent.action == "add") {
+                hostLinkAdded(payload->usb,
+                              sysfsPath(payload->usb, "/sys" + std::string(uevent.devPath)));
+            } else if (uevent.isUsbDevice() && uevent.action == "remove") {
+                std::string_view devPath = uevent.devPath;
+                hostLinkRemoved(payload->usb,
+                                std::string(devPath.substr(devPath.find_last_of('/') + 1)));
+            }
+            if (uevent.isPortChange()) {
+                portChange = true;
+                portUevents++;
+                addPortUpdate(uevent, &payload->updates);
             }
-            break;
         }
-        /* advance to after the next \0 */
-        while (*cp++) {
+    } while (pending);
+
+    if (lost) {
+        // Any transition may have been missed, resync everything from sysfs
+        ALOGI("uevents lost, resyncing the port status");
+        payload->usb->mEventLog.record("all", "uevents lost, port status resynced");
+        resyncPortsHelper(payload->usb);
+        resyncHostLinksHelper(payload->usb);
+        payload->updates.clear();
+        portChange = true;
+
+        std::vector<std::string> connected;
+        pthread_mutex_lock(&payload->usb->mLock);
+        for (const auto &roleSwitch : payload->roleSwitches) {
+            auto port = payload->usb->mPorts.find(roleSwitch.first);
+            if (port != payload->usb->mPorts.end() && port->second.connected)
+                connected.push_back(roleSwitch.first);
         }
+        pthread_mutex_unlock(&payload->usb->mLock);
+        for (const std::string &portName : connected)
+            partnerAdded(payload, portName);
+    }
+
+    if (portUevents) {
+        pthread_mutex_lock(&payload->usb->mLock);
+        payload->usb->mPortUeventCount += portUevents;
+        pthread_mutex_unlock(&payload->usb->mLock);
+    }
+
+    // The rest of the burst, e.g. partner identity and alternate modes, joins the notification
+    if ((portChange || powerChange) && !payload->notifyPending) {
+        payload->notifyPending = true;
+        payload->notifyTime = std::chrono::steady_clock::now() + payload->settleTime;
+    }
+}
+
+// The ports may have changed without uevents, e.g. with the legacy mode, rescan them now
+static void rescanPortsHelper(struct data *payload) {
+    ATRACE_CALL();
+
+    ALOGI("rescanning the ports");
+    payload->usb->mEventLog.record("all", "ports rescanned");
+    resyncPortsHelper(payload->usb);
+    payload->updates.clear();
+    payload->notifyPending = true;
+    payload->notifyTime = std::chrono::steady_clock::now();
+}
+
+static void control_event(uint32_t /*epevents*/, struct data *payload) {
+    uint64_t count;
+    unsigned control;
+
+    if (read(payload->usb->mControlFd, &count, sizeof(count)) != sizeof(count))
+        return;
+
+    pthread_mutex_lock(&payload->usb->mLock);
+    control = payload->usb->mControl;
+    payload->usb->mControl = 0;
+    pthread_mutex_unlock(&payload->usb->mLock);
+
+    if (control & kControlExit) {
+        payload->exit = true;
+        return;
+    }
+    if (control & kControlRescan)
+        rescanPortsHelper(payload);
+    if (control & kControlRoleSwitch)
+        runRoleSwitchesHelper(payload);
+    if (control & kControlCallback) {
+        payload->notifyPending = true;
+        payload->notifyTime = std::chrono::steady_clock::now();
     }
 }
 
 void *work(void *param) {
     int epoll_fd, uevent_fd;
     struct epoll_event ev;
+    struct epoll_event controlEv;
     int nevents = 0;
     struct data payload;
+    Usb *usb = (android::hardware::usb::V1_2::implementation::Usb *)param;
+    // Only the kernel uevent socket can tell the kernel uevents apart
+    bool kernelSocket = !usb->mEnvironment.openUeventSocket;
+    // Received into once per wakeup, too large for the stack
+    std::unique_ptr<UeventBatch> batch(new UeventBatch(kernelSocket));
 
     ALOGE("creating thread");
 
-    uevent_fd = uevent_open_socket(64 * 1024, true);
+    if (kernelSocket)
+        uevent_fd = uevent_open_socket(64 * 1024, true);
+    else
+        uevent_fd = usb->mEnvironment.openUeventSocket();
 
     if (uevent_fd < 0) {
         ALOGE("uevent_init: uevent_open_socket failed\n");
         return NULL;
     }
 
+    // Only typec and power_supply uevents wake the thread up from now on
+    attachUeventFilter(uevent_fd);
+
     payload.uevent_fd = uevent_fd;
-    payload.usb = (android::hardware::usb::V1_2::implementation::Usb *)param;
+    payload.usb = usb;
+    payload.batch = batch.get();
+    payload.notifyPending = false;
+    payload.exit = false;
+    payload.settleTime = std::chrono::milliseconds(
+        android::base::GetUintProperty<unsigned>(kSettleTime, kDefaultSettleMs));
+    payload.powerSupply = GetProperty(kPowerSupply, kDefaultPowerSupply);
+
+    // The uevents sent before the thread listens are missed, start from sysfs
+    resyncPortsHelper(payload.usb);
+    {
+        hidl_vec<PortStatus> currentPortStatus_1_2;
+        queryVersionHelper(payload.usb, &currentPortStatus_1_2);
+    }
+    updatePowerHelper(&payload);
+    resyncHostLinksHelper(payload.usb);
 
     fcntl(uevent_fd, F_SETFL, O_NONBLOCK);
 
@@ -662,10 +1471,17 @@ void *work(void *param) {
         goto error;
     }
 
-    while (!destroyThread) {
+    controlEv.events = EPOLLIN;
+    controlEv.data.ptr = (void *)control_event;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, payload.usb->mControlFd, &controlEv) == -1) {
+        ALOGE("epoll_ctl failed; errno=%d", errno);
+        goto error;
+    }
+
+    while (!payload.exit) {
         struct epoll_event events[64];
 
-        nevents = epoll_wait(epoll_fd, events, 64, -1);
+        nevents = epoll_wait(epoll_fd, events, 64, nextTimeoutMs(payload));
         if (nevents == -1) {
             if (errno == EINTR)
                 continue;
@@ -678,10 +1494,24 @@ void *work(void *param) {
                 (*(void (*)(int, struct data *payload))events[n].data.ptr)(events[n].events,
                                                                            &payload);
         }
+
+        expireRoleSwitches(&payload);
+        if (payload.notifyPending && std::chrono::steady_clock::now() >= payload.notifyTime)
+            notifyPortChange(&payload);
     }
 
     ALOGI("exiting worker thread");
 error:
+    // Nothing runs the role switches anymore, only leave the ports usable
+    for (const auto &roleSwitch : payload.roleSwitches)
+        switchToDrp(payload.usb, roleSwitch.first);
+    stopPowerHelper(payload.usb);
+    pthread_mutex_lock(&payload.usb->mLock);
+    payload.usb->mRoleSwitchRequests.clear();
+    // Not updated from the uevents anymore
+    payload.usb->mPortsValid = false;
+    pthread_mutex_unlock(&payload.usb->mLock);
+
     close(uevent_fd);
 
     if (epoll_fd >= 0)
@@ -690,15 +1520,6 @@ error:
     return NULL;
 }
 
-void sighandler(int sig) {
-    if (sig == SIGUSR1) {
-        destroyThread = true;
-        ALOGI("destroy set");
-        return;
-    }
-    signal(SIGUSR1, sighandler);
-}
-
 Return<void> Usb::setCallback(const sp<V1_0::IUsbCallback> &callback) {
     sp<V1_1::IUsbCallback> callback_V1_1 = V1_1::IUsbCallback::castFrom(callback);
     sp<IUsbCallback> callback_V1_2 = IUsbCallback::castFrom(callback);
@@ -710,50 +1531,19 @@ Return<void> Usb::setCallback(const sp<V1_0::IUsbCallback> &callback) {
             ALOGI("Registering 1.1 callback");
     }
 
-    pthread_mutex_lock(&mLock);
     /*
-     * When both the old callback and new callback values are NULL,
-     * there is no need to spin off the worker thread.
-     * When both the values are not NULL, we would already have a
-     * worker thread running, so updating the callback object would
-     * be suffice.
+     * The worker thread keeps running, only the callback is swapped.
+     * Always store as V1_0 callback object. Type cast to V1_1
+     * when the callback is actually invoked.
      */
-    if ((mCallback_1_0 == NULL && callback == NULL) ||
-        (mCallback_1_0 != NULL && callback != NULL)) {
-        /*
-         * Always store as V1_0 callback object. Type cast to V1_1
-         * when the callback is actually invoked.
-         */
-        mCallback_1_0 = callback;
-        pthread_mutex_unlock(&mLock);
-        return Void();
-    }
-
+    pthread_mutex_lock(&mLock);
     mCallback_1_0 = callback;
-    ALOGI("registering callback");
-
-    // Kill the worker thread if the new callback is NULL.
-    if (mCallback_1_0 == NULL) {
-        pthread_mutex_unlock(&mLock);
-        if (!pthread_kill(mPoll, SIGUSR1)) {
-            pthread_join(mPoll, NULL);
-            ALOGI("pthread destroyed");
-        }
-        return Void();
-    }
-
-    destroyThread = false;
-    signal(SIGUSR1, sighandler);
-
-    /*
-     * Create a background thread if the old callback value is NULL
-     * and being updated with a new value.
-     */
-    if (pthread_create(&mPoll, NULL, work, this)) {
-        ALOGE("pthread creation failed %d", errno);
-        mCallback_1_0 = NULL;
-    }
-
+    mCallback_1_1 = callback_V1_1;
+    mCallback_1_2 = callback_V1_2;
+    // A new client gets the whole status, even if unchanged
+    mLastNotifiedValid = false;
+    if (callback != NULL)
+        signalWorkerHelper(this, kControlCallback);
     pthread_mutex_unlock(&mLock);
     return Void();
 }
@@ -8,7 +8,15 @@
 #include <hidl/Status.h>
 #include <utils/Log.h>
 
-#define UEVENT_MSG_LEN 2048
+#include <functional>
+#include <map>
+#include <string>
+
+#include "CallbackDispatcher.h"
+#include "EventLog.h"
+#include "HostLink.h"
+#include "PowerContract.h"
+
 // The type-c stack waits for 4.5 - 5.5 secs before declaring a port non-pd.
 // The -partner directory would not be created until this is done.
 // Having a margin of ~3 secs for the directory and other related bookeeping
@@ -23,6 +31,7 @@ namespace implementation {
 
 using ::android::sp;
 using ::android::hardware::hidl_array;
+using ::android::hardware::hidl_handle;
 using ::android::hardware::hidl_memory;
 using ::android::hardware::hidl_string;
 using ::android::hardware::hidl_vec;
@@ -48,28 +57,106 @@ enum class HALVersion{
     V1_2
 };
 
+// State of a Type-C port, as last read from sysfs
+struct PortState {
+    // Status::ERROR if reading any attribute of the port failed
+    Status status = Status::SUCCESS;
+    // A partner is attached
+    bool connected = false;
+    // accessory_mode of the partner
+    std::string accessory;
+    // The partner supports USB power delivery
+    bool canSwitchRole = false;
+    // PD identity of the partner, "<id_header>:<product>", empty if it has none
+    std::string partnerId;
+    PortPowerRole powerRole = PortPowerRole::NONE;
+    PortDataRole dataRole = PortDataRole::NONE;
+    PortMode_1_1 mode = PortMode_1_1::NONE;
+};
+
+/*
+ * Where the HAL finds the Type-C ports and their uevents. The defaults are
+ * the device's, the simulator (cf sim/TypecSimulator.h) overrides them to
+ * run the HAL without Type-C hardware.
+ */
+struct UsbEnvironment {
+    // Prepended to the sysfs paths, e.g "/tmp/sim" for "/tmp/sim/sys/class/typec"
+    std::string sysfsRoot;
+    // Opens the socket the uevents are read from, the kernel uevent socket if unset.
+    // The uevents read from it aren't checked to come from the kernel.
+    std::function<int()> openUeventSocket;
+};
+
+// Role switch requested, with the cookie of its async trace event
+struct RoleSwitchRequest {
+    PortRole role;
+    int32_t cookie;
+};
+
 struct Usb : public IUsb {
-    Usb();
+    explicit Usb(UsbEnvironment environment = UsbEnvironment());
+    ~Usb();
 
     Return<void> switchRole(const hidl_string &portName, const V1_0::PortRole &role) override;
     Return<void> setCallback(const sp<V1_0::IUsbCallback> &callback) override;
     Return<void> queryPortStatus() override;
     Return<void> enableContaminantPresenceDetection(const hidl_string& portName, bool enable);
     Return<void> enableContaminantPresenceProtection(const hidl_string& portName, bool enable);
+    Return<void> debug(const hidl_handle &handle, const hidl_vec<hidl_string> &options) override;
+
+    // Power contract of every port, for IUsbExt. False while the ports aren't monitored.
+    bool getPowerContracts(hidl_vec<PowerContract> *contracts);
+    // USB devices attached in host mode, for IUsbExt. False while the ports aren't monitored.
+    bool getHostLinks(hidl_vec<UsbDeviceLink> *links);
+    void setExtCallback(const sp<IUsbExtCallback> &callback);
 
+    const UsbEnvironment mEnvironment;
     sp<V1_0::IUsbCallback> mCallback_1_0;
+    // mCallback_1_0 cast once, NULL if it doesn't implement these versions
+    sp<V1_1::IUsbCallback> mCallback_1_1;
+    sp<IUsbCallback> mCallback_1_2;
     // Protects mCallback variable
     pthread_mutex_t mLock;
-    // Protects roleSwitch operation
-    pthread_mutex_t mRoleSwitchLock;
-    // Threads waiting for the partner to come back wait here
-    pthread_cond_t mPartnerCV;
-    // lock protecting mPartnerCV
-    pthread_mutex_t mPartnerLock;
-    // Variable to signal partner coming back online after type switch
-    bool mPartnerUp;
+    // Role switches requested, not taken by the worker thread yet. Protected by mLock
+    std::map<std::string, RoleSwitchRequest> mRoleSwitchRequests;
+    // Cookie of the next role switch async trace event. Protected by mLock
+    int32_t mNextTraceCookie;
+    // Wakes the worker thread up to handle mControl
+    int mControlFd;
+    // Control messages pending for the worker thread, e.g. role switches requested.
+    // Protected by mLock
+    unsigned mControl;
+    // Rescans the ports when the legacy mode changes
+    int mLegacyListener;
+    // Type-C ports by name, updated from the uevents. Protected by mLock
+    std::map<std::string, PortState> mPorts;
+    // Result of the last enumeration of the ports
+    Status mPortsStatus;
+    // mPorts is up to date, false until the worker thread resyncs it
+    bool mPortsValid;
+    // Power contract of the ports, updated with mPorts. Protected by mLock
+    std::map<std::string, PortPower> mPortPower;
+    // USB devices attached, by name, and the degraded ones counted by port. Protected by mLock
+    std::map<std::string, UsbDeviceLink> mHostLinks;
+    std::map<std::string, unsigned> mDegradedLinkCount;
+    // Notified of the degraded links. Protected by mLock
+    sp<IUsbExtCallback> mExtCallback;
+    // Last port status notified to mCallback_1_0, uevents notify only changes to it
+    hidl_vec<PortStatus> mLastNotifiedPortStatus;
+    Status mLastNotifiedStatus;
+    bool mLastNotifiedValid;
+    // Port status notifications queued, and skipped as identical to the last one queued
+    unsigned long mNotifyCount;
+    unsigned long mNotifySkipCount;
+    // Uevents received about the ports, cf UeventRecord::isPortChange()
+    unsigned long mPortUeventCount;
+    // Delivers the notifications to the callbacks, without holding any lock
+    CallbackDispatcher mDispatcher;
+    // Recent plug and role switch events, for debug()
+    EventLog mEventLog;
 
   private:
+    // Worker thread, reading the uevents from the constructor to the destructor
     pthread_t mPoll;
 };
 
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.usb@1.2-service.generic"
+
+#include "UsbExt.h"
+
+namespace vendor {
+namespace ti {
+namespace hardware {
+namespace usb {
+namespace V1_0 {
+namespace implementation {
+
+using ::android::hardware::hidl_vec;
+using ::android::hardware::Void;
+
+Return<void> UsbExt::getPowerContracts(getPowerContracts_cb _hidl_cb) {
+    hidl_vec<PowerContract> contracts;
+    bool success = mUsb->getPowerContracts(&contracts);
+
+    _hidl_cb(success, contracts);
+    return Void();
+}
+
+Return<void> UsbExt::getHostLinks(getHostLinks_cb _hidl_cb) {
+    hidl_vec<UsbDeviceLink> links;
+    bool success = mUsb->getHostLinks(&links);
+
+    _hidl_cb(success, links);
+    return Void();
+}
+
+Return<void> UsbExt::setCallback(const sp<IUsbExtCallback> &callback) {
+    mUsb->setExtCallback(callback);
+    return Void();
+}
+
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace usb
+}  // namespace hardware
+}  // namespace ti
+}  // namespace vendor
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_USB_V1_2_USBEXT_H
+#define ANDROID_HARDWARE_USB_V1_2_USBEXT_H
+
+#include <vendor/ti/hardware/usb/1.0/IUsbExt.h>
+
+#include "Usb.h"
+
+namespace vendor {
+namespace ti {
+namespace hardware {
+namespace usb {
+namespace V1_0 {
+namespace implementation {
+
+using ::android::sp;
+using ::android::hardware::Return;
+using ::android::hardware::usb::V1_2::implementation::Usb;
+
+// TI extensions of the USB HAL, backed by the Usb service instance
+struct UsbExt : public IUsbExt {
+    explicit UsbExt(const sp<Usb> &usb) : mUsb(usb) {}
+
+    Return<void> getPowerContracts(getPowerContracts_cb _hidl_cb) override;
+    Return<void> getHostLinks(getHostLinks_cb _hidl_cb) override;
+    Return<void> setCallback(const sp<IUsbExtCallback> &callback) override;
+
+  private:
+    sp<Usb> mUsb;
+};
+
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace usb
+}  // namespace hardware
+}  // namespace ti
+}  // namespace vendor
+
+#endif  // ANDROID_HARDWARE_USB_V1_2_USBEXT_H
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "libusbconfigfs"
+
+#include "include/PropertyCache.h"
+
+#include <android-base/parsebool.h>
+#include <utils/Log.h>
+
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace usb {
+
+using ::android::base::ParseBool;
+using ::android::base::ParseBoolResult;
+
+CachedProperty::CachedProperty(const std::string& name)
+    : mName(name),
+      mInfo(NULL),
+      mSerial(0),
+      mValue(std::make_shared<const std::string>()),
+      mBool(-1) {}
+
+std::string CachedProperty::get(const std::string& defaultValue) const {
+    std::shared_ptr<const std::string> value = std::atomic_load(&mValue);
+
+    return value->empty() ? defaultValue : *value;
+}
+
+bool CachedProperty::getBool(bool defaultValue) const {
+    int value = mBool.load(std::memory_order_relaxed);
+
+    return value < 0 ? defaultValue : value;
+}
+
+bool CachedProperty::refresh() {
+    struct Read {
+        std::string value;
+        uint32_t serial;
+    } read;
+
+    // Properties are never deleted, only the missing ones need to be looked up again
+    if (mInfo == NULL) mInfo = __system_property_find(mName.c_str());
+    if (mInfo == NULL || __system_property_serial(mInfo) == mSerial) return false;
+
+    __system_property_read_callback(
+            mInfo,
+            [](void* cookie, const char*, const char* value, uint32_t serial) {
+                static_cast<Read*>(cookie)->value = value;
+                static_cast<Read*>(cookie)->serial = serial;
+            },
+            &read);
+    mSerial = read.serial;
+    if (read.value == *std::atomic_load(&mValue)) return false;
+
+    ParseBoolResult parsed = ParseBool(read.value);
+    mBool.store(parsed == ParseBoolResult::kError ? -1 : parsed == ParseBoolResult::kTrue,
+                std::memory_order_relaxed);
+    std::atomic_store(&mValue, std::make_shared<const std::string>(std::move(read.value)));
+    return true;
+}
+
+PropertyCache::PropertyCache() : mStarted(false), mNextListener(0) {}
+
+PropertyCache& PropertyCache::instance() {
+    static PropertyCache* cache = new PropertyCache();
+
+    return *cache;
+}
+
+const CachedProperty& PropertyCache::watch(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mLock);
+    std::unique_ptr<CachedProperty>& entry = mEntries[name];
+
+    if (entry == NULL) {
+        entry.reset(new CachedProperty(name));
+        entry->refresh();
+    }
+    if (!mStarted) {
+        mStarted = true;
+        std::thread(&PropertyCache::run, this).detach();
+    }
+    return *entry;
+}
+
+int PropertyCache::addListener(const std::string& name, std::function<void()> listener) {
+    watch(name);
+
+    std::lock_guard<std::mutex> lock(mListenerLock);
+    int id = mNextListener++;
+    mListeners[id] = {name, std::move(listener)};
+    return id;
+}
+
+void PropertyCache::removeListener(int id) {
+    std::lock_guard<std::mutex> lock(mListenerLock);
+
+    mListeners.erase(id);
+}
+
+void PropertyCache::run() {
+    uint32_t serial = 0;
+
+    while (true) {
+        std::vector<std::string> changed;
+
+        // Any property set bumps the serial of the whole area
+        if (!__system_property_wait(NULL, serial, &serial, NULL)) {
+            ALOGE("property wait failed");
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            for (auto& entry : mEntries) {
+                if (entry.second->refresh()) changed.push_back(entry.first);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mListenerLock);
+        for (const std::string& name : changed) {
+            ALOGI("%s changed", name.c_str());
+            for (auto& listener : mListeners) {
+                if (listener.second.first == name) listener.second.second();
+            }
+        }
+    }
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
@@ -16,6 +16,7 @@
 
 #define LOG_TAG "libusbconfigfs"
 
+#include "include/PropertyCache.h"
 #include "include/UsbGadgetCommon.h"
 
 namespace android {
@@ -83,11 +84,19 @@ Status setVidPid(const char* vid, const char* pid) {
 }
 
 std::string getVendorFunctions() {
-    if (GetProperty(kBuildType, "") == "user") return "user";
-
-    std::string bootMode = GetProperty(PERSISTENT_BOOT_MODE, "");
-    std::string persistVendorFunctions = GetProperty(kPersistentVendorConfig, "");
-    std::string vendorFunctions = GetProperty(kVendorConfig, "");
+    // Looked up once, every gadget reconfiguration reads them
+    static const CachedProperty& buildType = PropertyCache::instance().watch(kBuildType);
+    static const CachedProperty& bootModeProp =
+            PropertyCache::instance().watch(PERSISTENT_BOOT_MODE);
+    static const CachedProperty& persistVendorConfig =
+            PropertyCache::instance().watch(kPersistentVendorConfig);
+    static const CachedProperty& vendorConfig = PropertyCache::instance().watch(kVendorConfig);
+
+    if (buildType.get() == "user") return "user";
+
+    std::string bootMode = bootModeProp.get();
+    std::string persistVendorFunctions = persistVendorConfig.get();
+    std::string vendorFunctions = vendorConfig.get();
     std::string ret = "";
 
     if (vendorFunctions != "") {
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HARDWARE_USB_PROPERTYCACHE_H
+#define HARDWARE_USB_PROPERTYCACHE_H
+
+#include <stdint.h>
+#include <sys/system_properties.h>
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace android {
+namespace hardware {
+namespace usb {
+
+// System property read once, then updated by the watcher thread of its PropertyCache.
+class CachedProperty {
+  public:
+    explicit CachedProperty(const std::string& name);
+
+    // Lock-free, defaultValue while the property is unset or empty.
+    std::string get(const std::string& defaultValue = "") const;
+    // Parsed like android::base::GetBoolProperty().
+    bool getBool(bool defaultValue) const;
+
+  private:
+    friend class PropertyCache;
+
+    // Rereads the value if the property changed, returns whether the value did.
+    bool refresh();
+
+    const std::string mName;
+    // Set once the property exists.
+    const prop_info* mInfo;
+    uint32_t mSerial;
+    // Only accessed through std::atomic_load() and std::atomic_store().
+    std::shared_ptr<const std::string> mValue;
+    // 1 or 0 if the value parses as a bool, -1 otherwise.
+    std::atomic<int> mBool;
+};
+
+/*
+ * Process-wide cache of the system properties the USB HALs read on their
+ * hot paths. A watcher thread, started with the first property, waits for
+ * property changes with __system_property_wait() and refreshes the cached
+ * ones, calling their listeners.
+ */
+class PropertyCache {
+  public:
+    // Never destroyed, the watcher thread runs until the process exits.
+    static PropertyCache& instance();
+
+    // The entry of the property, created and read on the first call. Valid forever.
+    const CachedProperty& watch(const std::string& name);
+
+    // Calls listener from the watcher thread whenever the value of the property changes.
+    // Returns an id for removeListener().
+    int addListener(const std::string& name, std::function<void()> listener);
+    // The listener isn't running anymore once it returns.
+    void removeListener(int id);
+
+  private:
+    PropertyCache();
+
+    void run();
+
+    // Protects mEntries and mStarted.
+    std::mutex mLock;
+    std::map<std::string, std::unique_ptr<CachedProperty>> mEntries;
+    bool mStarted;
+
+    // Held while the listeners run. Protects mListeners and mNextListener.
+    std::mutex mListenerLock;
+    std::map<int, std::pair<std::string, std::function<void()>>> mListeners;
+    int mNextListener;
+};
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+
+#endif  // HARDWARE_USB_PROPERTYCACHE_H
@@ -18,6 +18,7 @@
 
 #include <hidl/HidlTransportSupport.h>
 #include "Usb.h"
+#include "UsbExt.h"
 #include "UsbGadget.h"
 
 using android::sp;
@@ -31,12 +32,13 @@ using android::hardware::usb::gadget::V1_1::IUsbGadget;
 using android::hardware::usb::gadget::V1_1::implementation::UsbGadget;
 using android::hardware::usb::V1_2::IUsb;
 using android::hardware::usb::V1_2::implementation::Usb;
+using vendor::ti::hardware::usb::V1_0::implementation::UsbExt;
 
 using android::OK;
 using android::status_t;
 
 int main() {
-    android::sp<IUsb> service = new Usb();
+    android::sp<Usb> service = new Usb();
     android::sp<IUsbGadget> service2 = new UsbGadget();
 
     configureRpcThreadpool(2, true /*callerWillJoin*/);
@@ -54,6 +56,11 @@ int main() {
         return 1;
     }
 
+    // Extensions are optional, the service goes on without them
+    android::sp<UsbExt> extService = new UsbExt(service);
+    if (extService->registerAsService() != OK)
+        ALOGE("Cannot register USB HAL extensions service");
+
     ALOGI("USB HAL Ready.");
     joinRpcThreadpool();
     // Under noraml cases, execution will not reach this line.
@@ -0,0 +1,393 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.usb@1.2-sim"
+
+#include "TypecSimulator.h"
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utils/Log.h>
+
+#include <algorithm>
+
+namespace android {
+namespace hardware {
+namespace usb {
+namespace V1_2 {
+namespace implementation {
+
+using ::android::base::ReadFileToString;
+using ::android::base::StringPrintf;
+using ::android::base::WriteStringToFile;
+
+// Parent of the simulated ports, as a platform device would be
+constexpr char kTypecDevices[] = "/devices/platform/typec-sim/typec/";
+constexpr char kTypecClass[] = "/sys/class/typec/";
+// Role nodes of the ports, the ones the HAL writes
+constexpr const char *kRoleNodes[] = {"data_role", "power_role", "port_type"};
+constexpr const char *kPartnerNodes[] = {"accessory_mode", "supports_usb_power_delivery",
+                                         "identity/id_header", "identity/product"};
+
+// Creates the directory and its missing parents
+static void makeDirs(const std::string &path) {
+    for (size_t slash = path.find('/', 1); slash != std::string::npos;
+         slash = path.find('/', slash + 1))
+        mkdir(path.substr(0, slash).c_str(), 0755);
+    mkdir(path.c_str(), 0755);
+}
+
+/*
+ * Replaces the contents of the node at once, unlike a write in place, which
+ * the HAL could read truncated when it reads a role back. The temporary
+ * file is no node the simulator watches.
+ */
+static void writeNode(const std::string &path, const std::string &contents) {
+    std::string temporary = path + ".new";
+
+    if (!WriteStringToFile(contents + "\n", temporary) ||
+        rename(temporary.c_str(), path.c_str()))
+        ALOGE("Failed to write %s: %s", path.c_str(), strerror(errno));
+}
+
+// Lists the choices of a role node the way the kernel does, the selected one in brackets
+static std::string roleChoices(std::initializer_list<const char *> choices,
+                               const std::string &selected) {
+    std::string node;
+
+    for (const char *choice : choices) {
+        if (!node.empty())
+            node += " ";
+        node += selected == choice ? "[" + selected + "]" : choice;
+    }
+    return node;
+}
+
+TypecSimulator::TypecSimulator(const std::string &root)
+    : mRoot(root), mSeqnum(0), mDropped(0), mStop(false) {
+    makeDirs(mRoot + "/sys/class/typec");
+    makeDirs(mRoot + "/sys" + kTypecDevices);
+
+    mInotifyFd.reset(inotify_init1(IN_NONBLOCK | IN_CLOEXEC));
+    mEventFd.reset(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+    mEpollFd.reset(epoll_create1(EPOLL_CLOEXEC));
+    if (mInotifyFd < 0 || mEventFd < 0 || mEpollFd < 0) {
+        ALOGE("simulator setup failed: %s", strerror(errno));
+        abort();
+    }
+
+    for (int fd : {mInotifyFd.get(), mEventFd.get()}) {
+        struct epoll_event ev = {.events = EPOLLIN, .data = {.fd = fd}};
+
+        if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            ALOGE("epoll_ctl failed: %s", strerror(errno));
+            abort();
+        }
+    }
+
+    mThread = std::thread(&TypecSimulator::run, this);
+}
+
+TypecSimulator::~TypecSimulator() {
+    uint64_t one = 1;
+
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mStop = true;
+    }
+    if (write(mEventFd, &one, sizeof(one)) != sizeof(one))
+        ALOGE("simulator eventfd write failed: %s", strerror(errno));
+    mThread.join();
+}
+
+int TypecSimulator::openUeventSocket() {
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, fds) == -1) {
+        ALOGE("socketpair failed: %s", strerror(errno));
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> lock(mLock);
+    mUeventFd.reset(fds[1]);
+    return fds[0];
+}
+
+std::string TypecSimulator::devPath(const std::string &port) {
+    return kTypecDevices + port;
+}
+
+void TypecSimulator::writeRoles(const std::string &port, const Port &state) {
+    std::string dir = mRoot + "/sys" + devPath(port) + "/";
+
+    writeNode(dir + "data_role", roleChoices({"host", "device"}, state.dataRole));
+    writeNode(dir + "power_role", roleChoices({"source", "sink"}, state.powerRole));
+    writeNode(dir + "port_type", roleChoices({"dual", "source", "sink"}, state.portType));
+}
+
+void TypecSimulator::sendUevent(const char *action, const std::string &devPath,
+                                const char *devType) {
+    // Laid out as the kernel does, the uevent filter of the HAL relies on it
+    std::string message = StringPrintf("%s@%s", action, devPath.c_str());
+
+    mSeqnum++;
+    for (const std::string &variable :
+         {std::string("ACTION=") + action, "DEVPATH=" + devPath, std::string("SUBSYSTEM=typec"),
+          std::string("DEVTYPE=") + devType, StringPrintf("SEQNUM=%lu", mSeqnum)}) {
+        message.push_back('\0');
+        message += variable;
+    }
+    message.push_back('\0');
+
+    if (mUeventFd < 0 ||
+        send(mUeventFd, message.data(), message.size(), MSG_DONTWAIT | MSG_NOSIGNAL) == -1)
+        mDropped++;
+}
+
+// Plugs the partner in, unless the port type forced on the port is one it can't take
+void TypecSimulator::attachPartner(const std::string &port, Port *state) {
+    std::string path = devPath(port) + "/" + port + "-partner";
+    std::string dir = mRoot + "/sys" + path + "/";
+    bool sink = state->partner.source;
+
+    if (state->portType != "dual") {
+        sink = state->portType == "sink";
+        if (sink != state->partner.source && !state->partner.dualRole)
+            return;
+    }
+
+    state->dataRole = sink ? "device" : "host";
+    state->powerRole = sink ? "sink" : "source";
+    writeRoles(port, *state);
+    sendUevent("change", devPath(port), "typec_port");
+
+    makeDirs(dir + "identity");
+    writeNode(dir + "accessory_mode", state->partner.accessory);
+    writeNode(dir + "supports_usb_power_delivery", state->partner.supportsPD ? "yes" : "no");
+    writeNode(dir + "identity/id_header", StringPrintf("0x%08x", state->partner.idHeader));
+    writeNode(dir + "identity/product", StringPrintf("0x%08x", state->partner.product));
+    symlink(("../../devices/platform/typec-sim/typec/" + port + "/" + port + "-partner").c_str(),
+            (mRoot + kTypecClass + port + "-partner").c_str());
+    state->attached = true;
+    sendUevent("add", path, "typec_partner");
+}
+
+void TypecSimulator::detachPartner(const std::string &port, Port *state) {
+    std::string path = devPath(port) + "/" + port + "-partner";
+    std::string dir = mRoot + "/sys" + path + "/";
+
+    if (!state->attached)
+        return;
+
+    unlink((mRoot + kTypecClass + port + "-partner").c_str());
+    for (const char *node : kPartnerNodes)
+        unlink((dir + node).c_str());
+    rmdir((dir + "identity").c_str());
+    rmdir(dir.c_str());
+    state->attached = false;
+    sendUevent("remove", path, "typec_partner");
+}
+
+void TypecSimulator::addPort(const std::string &port) {
+    std::lock_guard<std::mutex> lock(mLock);
+    std::string dir = mRoot + "/sys" + devPath(port);
+
+    if (mPorts.count(port))
+        return;
+
+    Port &state = mPorts[port];
+    makeDirs(dir);
+    writeRoles(port, state);
+    symlink(("../../devices/platform/typec-sim/typec/" + port).c_str(),
+            (mRoot + kTypecClass + port).c_str());
+    state.watch = inotify_add_watch(mInotifyFd, dir.c_str(), IN_CLOSE_WRITE);
+    if (state.watch < 0)
+        ALOGE("inotify_add_watch failed: %s", strerror(errno));
+    sendUevent("add", devPath(port), "typec_port");
+}
+
+void TypecSimulator::removePort(const std::string &port) {
+    std::lock_guard<std::mutex> lock(mLock);
+    auto state = mPorts.find(port);
+    std::string dir = mRoot + "/sys" + devPath(port) + "/";
+
+    if (state == mPorts.end())
+        return;
+
+    detachPartner(port, &state->second);
+    if (state->second.watch >= 0)
+        inotify_rm_watch(mInotifyFd, state->second.watch);
+    unlink((mRoot + kTypecClass + port).c_str());
+    for (const char *node : kRoleNodes)
+        unlink((dir + node).c_str());
+    rmdir(dir.c_str());
+    mPorts.erase(state);
+    sendUevent("remove", devPath(port), "typec_port");
+}
+
+void TypecSimulator::plug(const std::string &port, const SimPartner &partner) {
+    std::lock_guard<std::mutex> lock(mLock);
+    auto state = mPorts.find(port);
+
+    if (state == mPorts.end())
+        return;
+
+    detachPartner(port, &state->second);
+    state->second.partner = partner;
+    state->second.plugged = true;
+    state->second.returning = false;
+    attachPartner(port, &state->second);
+}
+
+void TypecSimulator::unplug(const std::string &port) {
+    std::lock_guard<std::mutex> lock(mLock);
+    auto state = mPorts.find(port);
+
+    if (state == mPorts.end())
+        return;
+
+    detachPartner(port, &state->second);
+    state->second.plugged = false;
+    state->second.returning = false;
+}
+
+unsigned long TypecSimulator::ueventCount() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mSeqnum;
+}
+
+unsigned long TypecSimulator::droppedUeventCount() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mDropped;
+}
+
+// Carries out what the HAL wrote to a role node of the port
+void TypecSimulator::roleWritten(const std::string &port, Port *state, const std::string &node) {
+    std::string dir = mRoot + "/sys" + devPath(port) + "/";
+    std::string role;
+
+    // The nodes rewritten by the simulator list the choices
+    if (!ReadFileToString(dir + node, &role) || role.find('[') != std::string::npos)
+        return;
+    role.erase(role.find_last_not_of(" \n") + 1);
+
+    if (node == "port_type") {
+        if (role != "dual" && role != "source" && role != "sink") {
+            writeRoles(port, *state);
+            return;
+        }
+        state->portType = role;
+        if (role != "dual" && state->plugged) {
+            // The partner is detached, and attaches back in the new port type
+            detachPartner(port, state);
+            state->returning = true;
+            state->returnTime = std::chrono::steady_clock::now() + state->partner.swapDelay;
+        } else if (state->plugged && !state->attached && !state->returning) {
+            attachPartner(port, state);
+        }
+        writeRoles(port, *state);
+        sendUevent("change", devPath(port), "typec_port");
+        return;
+    }
+
+    // Data and power role swaps are PD messages to the partner
+    bool dataRole = node == "data_role";
+    bool valid = dataRole ? role == "host" || role == "device"
+                          : role == "source" || role == "sink";
+    if (valid && state->attached && state->partner.supportsPD) {
+        (dataRole ? state->dataRole : state->powerRole) = role;
+        sendUevent("change", devPath(port), "typec_port");
+    }
+    writeRoles(port, *state);
+}
+
+// Time until the next partner comes back, -1 if none
+int TypecSimulator::nextTimeoutMs() {
+    auto next = std::chrono::steady_clock::time_point::max();
+
+    for (const auto &port : mPorts) {
+        if (port.second.returning)
+            next = std::min(next, port.second.returnTime);
+    }
+    if (next == std::chrono::steady_clock::time_point::max())
+        return -1;
+
+    auto timeout = std::chrono::ceil<std::chrono::milliseconds>(
+        next - std::chrono::steady_clock::now());
+    return std::max<int>(timeout.count(), 0);
+}
+
+void TypecSimulator::run() {
+    std::unique_lock<std::mutex> lock(mLock);
+    // Holds at least one event, whatever the length of its name
+    alignas(struct inotify_event) char buffer[4096];
+
+    while (!mStop) {
+        struct epoll_event events[2];
+        int timeout = nextTimeoutMs();
+
+        lock.unlock();
+        int nevents = epoll_wait(mEpollFd, events, 2, timeout);
+        lock.lock();
+        if (nevents == -1 && errno != EINTR) {
+            ALOGE("simulator epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+
+        ssize_t length;
+        while ((length = read(mInotifyFd, buffer, sizeof(buffer))) > 0) {
+            for (char *next = buffer; next < buffer + length;) {
+                auto event = reinterpret_cast<struct inotify_event *>(next);
+                auto port = std::find_if(mPorts.begin(), mPorts.end(), [event](const auto &port) {
+                    return port.second.watch == event->wd;
+                });
+
+                if (port != mPorts.end() && event->len &&
+                    std::find_if(std::begin(kRoleNodes), std::end(kRoleNodes),
+                                 [event](const char *node) {
+                                     return !strcmp(node, event->name);
+                                 }) != std::end(kRoleNodes))
+                    roleWritten(port->first, &port->second, event->name);
+                next += sizeof(struct inotify_event) + event->len;
+            }
+        }
+
+        uint64_t count;
+        if (read(mEventFd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+            ALOGE("simulator eventfd read failed: %s", strerror(errno));
+
+        auto now = std::chrono::steady_clock::now();
+        for (auto &port : mPorts) {
+            if (port.second.returning && port.second.returnTime <= now) {
+                port.second.returning = false;
+                attachPartner(port.first, &port.second);
+            }
+        }
+    }
+}
+
+}  // namespace implementation
+}  // namespace V1_2
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_USB_V1_2_TYPECSIMULATOR_H
+#define ANDROID_HARDWARE_USB_V1_2_TYPECSIMULATOR_H
+
+#include <android-base/unique_fd.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace android {
+namespace hardware {
+namespace usb {
+namespace V1_2 {
+namespace implementation {
+
+using ::android::base::unique_fd;
+
+// Partner plugged into a simulated port
+struct SimPartner {
+    // Supplies power: the port becomes a sink and a device, otherwise a source and a host
+    bool source = false;
+    // Follows a port type switch of the port, otherwise it never comes back after one
+    // forcing it into its own role
+    bool dualRole = true;
+    bool supportsPD = true;
+    // accessory_mode: "none", "analog_audio" or "debug"
+    std::string accessory = "none";
+    // PD identity, id_header 0 if it reports none
+    uint32_t idHeader = 0;
+    uint32_t product = 0;
+    // Time it takes to come back after a port type switch
+    std::chrono::milliseconds swapDelay = std::chrono::milliseconds(500);
+};
+
+/*
+ * Models Type-C ports for the HAL to run on without Type-C hardware: the
+ * typec class directories under a sysfs root of its own, the -partner
+ * directories created and removed on plugs, and the uevents the kernel
+ * sends for them, through a socketpair. The role nodes the HAL writes are
+ * carried out like the kernel would, a port type switch detaching the
+ * partner for its swapDelay.
+ *
+ * Runs the HAL with
+ *     UsbEnvironment{sim.root(), [&sim] { return sim.openUeventSocket(); }}
+ *
+ * Unlike the kernel, uevents are dropped silently when the HAL doesn't
+ * keep up, so plug storms should leave it the time to drain its socket.
+ */
+class TypecSimulator {
+  public:
+    // root must be an existing, empty directory
+    explicit TypecSimulator(const std::string &root);
+    ~TypecSimulator();
+
+    const std::string &root() const { return mRoot; }
+    // New socket the uevents are sent to from now on, owned by the caller
+    int openUeventSocket();
+
+    void addPort(const std::string &port);
+    void removePort(const std::string &port);
+    // Replaces the partner plugged, if any
+    void plug(const std::string &port, const SimPartner &partner);
+    void unplug(const std::string &port);
+
+    // Uevents sent, and dropped as the socket was full or not open
+    unsigned long ueventCount();
+    unsigned long droppedUeventCount();
+
+  private:
+    struct Port {
+        int watch = -1;
+        // Roles as the kernel reports them
+        std::string dataRole = "host";
+        std::string powerRole = "source";
+        std::string portType = "dual";
+        bool plugged = false;
+        // The partner is attached, false while a port type switch detaches it
+        bool attached = false;
+        SimPartner partner;
+        // When the partner comes back, if a port type switch detached it
+        bool returning = false;
+        std::chrono::steady_clock::time_point returnTime;
+    };
+
+    // Called with mLock held
+    std::string devPath(const std::string &port);
+    void writeRoles(const std::string &port, const Port &state);
+    void attachPartner(const std::string &port, Port *state);
+    void detachPartner(const std::string &port, Port *state);
+    void sendUevent(const char *action, const std::string &devPath, const char *devType);
+    void roleWritten(const std::string &port, Port *state, const std::string &node);
+    int nextTimeoutMs();
+
+    void run();
+
+    const std::string mRoot;
+    unique_fd mInotifyFd;
+    unique_fd mEventFd;
+    unique_fd mEpollFd;
+
+    std::mutex mLock;
+    std::map<std::string, Port> mPorts;
+    unique_fd mUeventFd;
+    unsigned long mSeqnum;
+    unsigned long mDropped;
+    bool mStop;
+
+    // Last, started once the above are initialized
+    std::thread mThread;
+};
+
+}  // namespace implementation
+}  // namespace V1_2
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_USB_V1_2_TYPECSIMULATOR_H
@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "HostLink.h"
+#include "UsbTestUtils.h"
+
+namespace android {
+namespace hardware {
+namespace usb {
+namespace V1_2 {
+namespace implementation {
+namespace {
+
+using ::android::base::WriteStringToFile;
+using namespace std::chrono_literals;
+using namespace std::string_literals;
+
+// BOS descriptors: the header, then a USB 2.0 extension and a SuperSpeed(Plus) capability
+const std::string kBosUsb2 = "\x05\x0f\x0c\x00\x01"s + "\x07\x10\x02\x06\x00\x00\x00"s;
+const std::string kBosSuperSpeed =
+        "\x05\x0f\x16\x00\x02"s + "\x07\x10\x02\x06\x00\x00\x00"s +
+        "\x0a\x10\x03\x00\x0e\x00\x01\x0a\xff\x07"s;
+const std::string kBosSuperSpeedPlus =
+        "\x05\x0f\x2a\x00\x03"s + "\x07\x10\x02\x06\x00\x00\x00"s +
+        "\x0a\x10\x03\x00\x0e\x00\x01\x0a\xff\x07"s +
+        "\x14\x10\x0a\x00\x01\x00\x00\x00\x00\x11\x00\x00\x30\x40\x0a\x00\xb0\x40\x0a\x00"s;
+
+/*
+ * sysfs of an xHCI controller, its USB 2 root hub usb1 and USB 3 root hub
+ * usb2, as the devices/ tree the bus/usb/devices links point into.
+ */
+class HostLinkTest : public ::testing::Test {
+  protected:
+    void SetUp() override { createController(mRoot.path); }
+
+    // Creates the controller and its root hubs in the parent directory
+    void createController(const std::string &parent) {
+        mController = parent + "/xhci-hcd.2.auto";
+        ASSERT_EQ(mkdir(mController.c_str(), 0755), 0);
+        addDevice("usb1", "480", "2.00", 1);
+        addDevice("usb2", "5000", "3.00", 1);
+    }
+
+    // Adds the device under the root hub its name tells, with its bos_descriptors if any
+    std::string addDevice(const std::string &name, const std::string &speed,
+                          const std::string &version, unsigned maxChild,
+                          const std::string &bos = "") {
+        std::string dir = mController;
+
+        if (name.compare(0, 3, "usb"))
+            dir += "/usb" + name.substr(0, name.find('-'));
+        dir += "/" + name;
+        EXPECT_EQ(mkdir(dir.c_str(), 0755), 0) << dir;
+        EXPECT_TRUE(WriteStringToFile(speed + "\n", dir + "/speed"));
+        EXPECT_TRUE(WriteStringToFile(" " + version + "\n", dir + "/version"));
+        EXPECT_TRUE(WriteStringToFile(std::to_string(maxChild) + "\n", dir + "/maxchild"));
+        if (!bos.empty()) {
+            EXPECT_TRUE(WriteStringToFile(bos, dir + "/bos_descriptors"));
+        }
+        return dir;
+    }
+
+    TemporaryDir mRoot;
+    std::string mController;
+};
+
+TEST_F(HostLinkTest, ReadsSuperSpeedDevices) {
+    UsbDeviceLink link;
+
+    ASSERT_TRUE(readHostLink(addDevice("2-1", "5000", "3.20", 0, kBosSuperSpeed), &link));
+    EXPECT_EQ(link.name, "2-1");
+    EXPECT_EQ(link.speed, "5000");
+    EXPECT_EQ(link.version, "3.20");
+    EXPECT_EQ(link.maxChild, 0);
+    EXPECT_EQ(link.capableSpeedMbps, 5000);
+    EXPECT_FALSE(link.degraded);
+}
+
+TEST_F(HostLinkTest, FlagsSuperSpeedDevicesFallenBackToUsb2) {
+    UsbDeviceLink link;
+
+    // USB 3 devices report USB 2.10 on a USB 2 link
+    ASSERT_TRUE(readHostLink(addDevice("1-1", "480", "2.10", 0, kBosSuperSpeed), &link));
+    EXPECT_EQ(link.capableSpeedMbps, 5000);
+    EXPECT_TRUE(link.degraded);
+
+    // Without a BOS descriptor, the version tells
+    ASSERT_TRUE(readHostLink(addDevice("1-2", "480", "3.00", 0), &link));
+    EXPECT_EQ(link.capableSpeedMbps, 5000);
+    EXPECT_TRUE(link.degraded);
+}
+
+TEST_F(HostLinkTest, DoesNotFlagUsb2Devices) {
+    UsbDeviceLink link;
+
+    ASSERT_TRUE(readHostLink(addDevice("1-1", "480", "2.10", 0, kBosUsb2), &link));
+    EXPECT_EQ(link.capableSpeedMbps, 480);
+    EXPECT_FALSE(link.degraded);
+
+    ASSERT_TRUE(readHostLink(addDevice("1-2", "12", "1.10", 0), &link));
+    EXPECT_EQ(link.capableSpeedMbps, 12);
+    EXPECT_FALSE(link.degraded);
+}
+
+TEST_F(HostLinkTest, DoesNotFlagTheUsb2HalfOfHubs) {
+    UsbDeviceLink link;
+
+    ASSERT_TRUE(readHostLink(addDevice("1-1", "480", "2.10", 4, kBosSuperSpeed), &link));
+    EXPECT_EQ(link.maxChild, 4);
+    EXPECT_FALSE(link.degraded);
+}
+
+TEST_F(HostLinkTest, LimitsTheCapabilityToTheController) {
+    UsbDeviceLink link;
+
+    // A SuperSpeedPlus device at SuperSpeed, the most a 5 Gbps controller offers
+    ASSERT_TRUE(readHostLink(addDevice("2-1", "5000", "3.20", 0, kBosSuperSpeedPlus), &link));
+    EXPECT_EQ(link.capableSpeedMbps, 10000);
+    EXPECT_FALSE(link.degraded);
+}
+
+TEST_F(HostLinkTest, SkipsRootHubsAndInterfaces) {
+    std::string device = addDevice("1-1", "480", "2.00", 0);
+    std::string interface = device + "/1-1:1.0";
+    UsbDeviceLink link;
+
+    ASSERT_EQ(mkdir(interface.c_str(), 0755), 0);
+    EXPECT_FALSE(readHostLink(mController + "/usb1", &link));
+    EXPECT_FALSE(readHostLink(interface, &link));
+}
+
+/*
+ * Runs the HAL with the controller under the sysfs root of a simulated
+ * port, the usb uevents being sent by the test.
+ */
+class UsbHostLinkTest : public HostLinkTest {
+  protected:
+    void SetUp() override {
+        // Next to the simulated Type-C controller
+        createController(std::string(mHal.root.path) + "/sys/devices/platform");
+        ASSERT_TRUE(mHal.start(true));
+        mRecorder = new ExtCallbackRecorder();
+        mHal.usb->setExtCallback(mRecorder);
+    }
+
+    // Sends the usb uevent of the device in sysfs directory dir
+    void sendUevent(const std::string &action, const std::string &dir) {
+        std::string devPath = dir.substr(strlen(mHal.root.path) + strlen("/sys"));
+
+        ASSERT_TRUE(mHal.sendUevent(action + "@" + devPath + "\0ACTION="s + action +
+                                    "\0DEVPATH="s + devPath +
+                                    "\0SUBSYSTEM=usb\0DEVTYPE=usb_device\0"s));
+    }
+
+    // Waits for the HAL to list count links, the uevents being handled in order
+    bool waitForHostLinks(size_t count, hidl_vec<UsbDeviceLink> *links) {
+        for (auto end = std::chrono::steady_clock::now() + 5s;
+             std::chrono::steady_clock::now() < end; std::this_thread::sleep_for(10ms)) {
+            if (mHal.usb->getHostLinks(links) && links->size() == count)
+                return true;
+        }
+        return false;
+    }
+
+    SimulatedUsb mHal{1};
+    sp<ExtCallbackRecorder> mRecorder;
+};
+
+TEST_F(UsbHostLinkTest, ReportsDegradedLinks) {
+    hidl_vec<UsbDeviceLink> links;
+
+    sendUevent("add", addDevice("1-1", "480", "2.10", 0, kBosSuperSpeed));
+    sendUevent("add", addDevice("1-2", "480", "2.00", 0, kBosUsb2));
+    sendUevent("add", addDevice("1-3", "480", "3.00", 0));
+    ASSERT_TRUE(waitForHostLinks(3, &links));
+
+    ASSERT_TRUE(mRecorder->waitForLinks(2));
+    std::lock_guard<std::mutex> lock(mRecorder->mLock);
+    ASSERT_EQ(mRecorder->mLinks.size(), 2);
+    EXPECT_EQ(mRecorder->mLinks[0].name, "1-1");
+    EXPECT_EQ(mRecorder->mLinks[1].name, "1-3");
+    // Counted on the only port the devices can be attached through
+    for (size_t i = 0; i < 2; i++) {
+        EXPECT_EQ(mRecorder->mLinks[i].portName, "port0");
+        EXPECT_TRUE(mRecorder->mLinks[i].degraded);
+        EXPECT_EQ(mRecorder->mCounts[i], i + 1);
+    }
+}
+
+TEST_F(UsbHostLinkTest, ForgetsRemovedLinks) {
+    std::string device = addDevice("1-1", "480", "2.10", 0, kBosSuperSpeed);
+    hidl_vec<UsbDeviceLink> links;
+
+    sendUevent("add", device);
+    ASSERT_TRUE(waitForHostLinks(1, &links));
+    EXPECT_EQ(links[0].name, "1-1");
+    EXPECT_EQ(links[0].capableSpeedMbps, 5000);
+
+    sendUevent("remove", device);
+    EXPECT_TRUE(waitForHostLinks(0, &links));
+    // The degraded links stay counted
+    sendUevent("add", device);
+    ASSERT_TRUE(mRecorder->waitForLinks(2));
+    std::lock_guard<std::mutex> lock(mRecorder->mLock);
+    EXPECT_EQ(mRecorder->mCounts[1], 2);
+}
+
+TEST(RootHubPortTest, NamesTheRootHubPort) {
+    EXPECT_EQ(rootHubPort("1-2"), "usb1-port2");
+    EXPECT_EQ(rootHubPort("1-2.4"), "usb1-port2");
+    EXPECT_EQ(rootHubPort("2-1.3.1"), "usb2-port1");
+    EXPECT_EQ(rootHubPort("usb1"), "");
+}
+
+}  // namespace
+}  // namespace implementation
+}  // namespace V1_2
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <string>
+
+#include "PowerContract.h"
+
+namespace android {
+namespace hardware {
+namespace usb {
+namespace V1_2 {
+namespace implementation {
+namespace {
+
+using ::android::base::WriteStringToFile;
+using namespace std::chrono_literals;
+using namespace std::string_literals;
+
+/*
+ * sysfs of a port sinking power: the usb_power_delivery devices of the
+ * partner and of the port, and the power_supply the port sinks through.
+ */
+class PowerContractTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        mPaths.partnerPd = mRoot.path + "/pd1"s;
+        mPaths.portPd = mRoot.path + "/pd0"s;
+        mPaths.supply = mRoot.path + "/tps6598x-source-psy"s;
+        for (const std::string &dir : {mPaths.partnerPd, mPaths.portPd, mPaths.supply})
+            ASSERT_EQ(mkdir(dir.c_str(), 0755), 0);
+    }
+
+    // Adds the fixed supply PDO at position in the capabilities of the pd device
+    void addFixedPdo(const std::string &pd, const std::string &capabilities, unsigned position,
+                     unsigned voltageMv, unsigned currentMa) {
+        std::string dir = pd + "/" + capabilities;
+        mkdir(dir.c_str(), 0755);
+        dir += "/" + std::to_string(position) + ":fixed_supply";
+        mkdir(dir.c_str(), 0755);
+        ASSERT_TRUE(WriteStringToFile(std::to_string(voltageMv) + "mV\n", dir + "/voltage"));
+        ASSERT_TRUE(WriteStringToFile(std::to_string(currentMa) + "mA\n",
+                                      dir + "/maximum_current"));
+    }
+
+    void addSourcePdo(unsigned position, unsigned voltageMv, unsigned currentMa) {
+        addFixedPdo(mPaths.partnerPd, "source-capabilities", position, voltageMv, currentMa);
+    }
+
+    void addSinkPdo(unsigned position, unsigned voltageMv, unsigned currentMa) {
+        addFixedPdo(mPaths.portPd, "sink-capabilities", position, voltageMv, currentMa);
+    }
+
+    // Sets what the supply measures and allows, in uV and uA like the kernel
+    void setSupply(unsigned voltageMv, unsigned currentMaxMa) {
+        ASSERT_TRUE(WriteStringToFile(std::to_string(voltageMv * 1000) + "\n",
+                                      mPaths.supply + "/voltage_now"));
+        ASSERT_TRUE(WriteStringToFile(std::to_string(currentMaxMa * 1000) + "\n",
+                                      mPaths.supply + "/current_max"));
+    }
+
+    PowerContract read() {
+        PowerContract contract = {};
+
+        readPowerContract(mPaths, true, true, &contract);
+        return contract;
+    }
+
+    TemporaryDir mRoot;
+    PowerContractPaths mPaths;
+};
+
+TEST_F(PowerContractTest, CountsANonPdSourceBelowBest) {
+    // A 5 V/0.5 A charger, without source capabilities
+    setSupply(5000, 500);
+    PowerContract contract = read();
+
+    EXPECT_EQ(contract.sourceCapabilities.size(), 0);
+    EXPECT_EQ(contract.selectedPdo, -1);
+    EXPECT_EQ(contract.contractPowerMw, 2500);
+    // What Type-C current allows without PD
+    EXPECT_EQ(contract.bestPowerMw, 15000);
+
+    PortPower power;
+    auto now = std::chrono::steady_clock::now();
+    EXPECT_TRUE(power.update(std::move(contract), now));
+    EXPECT_TRUE(power.belowBest);
+    PowerContract snapshot = power.snapshot(now + 1s);
+    EXPECT_EQ(snapshot.belowBestCount, 1);
+    EXPECT_EQ(snapshot.belowBestMs, 1000);
+
+    // Still the same period below best
+    EXPECT_FALSE(power.update(read(), now + 1s));
+    power.stop(now + 2s);
+    snapshot = power.snapshot(now + 3s);
+    EXPECT_EQ(snapshot.belowBestCount, 1);
+    EXPECT_EQ(snapshot.belowBestMs, 2000);
+}
+
+TEST_F(PowerContractTest, SelectsTheNegotiatedPdo) {
+    addSourcePdo(1, 5000, 3000);
+    addSourcePdo(2, 9000, 3000);
+    addSourcePdo(3, 15000, 3000);
+    // The port sinks up to 9 V, its best contract is 9 V/3 A
+    addSinkPdo(1, 5000, 3000);
+    addSinkPdo(2, 9000, 3000);
+    // Measured, below the negotiated voltage
+    setSupply(8900, 3000);
+    PowerContract contract = read();
+
+    ASSERT_EQ(contract.sourceCapabilities.size(), 3);
+    EXPECT_EQ(contract.sourceCapabilities[1].type, PdoType::FIXED);
+    EXPECT_EQ(contract.sourceCapabilities[1].minVoltageMv, 9000);
+    EXPECT_EQ(contract.sourceCapabilities[1].maxPowerMw, 27000);
+    // PDO 2, counted from 0
+    EXPECT_EQ(contract.selectedPdo, 1);
+    EXPECT_EQ(contract.bestPowerMw, 27000);
+
+    PortPower power;
+    EXPECT_TRUE(power.update(std::move(contract), std::chrono::steady_clock::now()));
+    EXPECT_FALSE(power.belowBest);
+    EXPECT_EQ(power.belowBestCount, 0);
+}
+
+TEST_F(PowerContractTest, ReportsChangedPdosOfTheSameCount) {
+    addSourcePdo(1, 5000, 3000);
+    addSourcePdo(2, 9000, 3000);
+    addSourcePdo(3, 15000, 3000);
+    setSupply(5000, 3000);
+    PortPower power;
+    auto now = std::chrono::steady_clock::now();
+
+    ASSERT_TRUE(power.update(read(), now));
+    EXPECT_FALSE(power.update(read(), now));
+
+    // The charger lowers its 15 V PDO, e.g as another of its ports gets a sink
+    addSourcePdo(3, 15000, 2000);
+    PowerContract contract = read();
+    ASSERT_EQ(contract.sourceCapabilities.size(), 3);
+    EXPECT_TRUE(power.update(std::move(contract), now));
+    EXPECT_EQ(power.contract.sourceCapabilities[2].maxCurrentMa, 2000);
+}
+
+}  // namespace
+}  // namespace implementation
+}  // namespace V1_2
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
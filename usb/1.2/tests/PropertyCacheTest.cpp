@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android-base/properties.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "PropertyCache.h"
+
+namespace android {
+namespace hardware {
+namespace usb {
+namespace {
+
+using ::android::base::SetProperty;
+using namespace std::chrono_literals;
+
+// Settable by the tests, and read by nothing else
+constexpr char kProperty[] = "debug.usb.property_cache_test";
+constexpr auto kWaitTimeout = 5s;
+
+/*
+ * Records the values of kProperty its listener is called with, to be waited
+ * for. The watcher thread may still call it for a change made before it was
+ * added, hence the tests waiting for values rather than for calls.
+ */
+class ListenerRecorder {
+  public:
+    explicit ListenerRecorder(const CachedProperty &property) : mProperty(property) {
+        mId = PropertyCache::instance().addListener(kProperty, [this] {
+            std::lock_guard<std::mutex> lock(mLock);
+            mValues.push_back(mProperty.get());
+            mCalled.notify_all();
+        });
+    }
+
+    ~ListenerRecorder() { remove(); }
+
+    void remove() {
+        if (mId >= 0)
+            PropertyCache::instance().removeListener(mId);
+        mId = -1;
+    }
+
+    // Waits for the listener to be called once the property is value
+    bool waitForValue(const std::string &value) {
+        std::unique_lock<std::mutex> lock(mLock);
+
+        return mCalled.wait_for(lock, kWaitTimeout, [&] {
+            return !mValues.empty() && mValues.back() == value;
+        });
+    }
+
+    std::vector<std::string> values() {
+        std::lock_guard<std::mutex> lock(mLock);
+        return mValues;
+    }
+
+  private:
+    const CachedProperty &mProperty;
+    int mId;
+    std::mutex mLock;
+    std::condition_variable mCalled;
+    std::vector<std::string> mValues;
+};
+
+class PropertyCacheTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        // Unset, as far as the cache tells, whatever the previous tests and runs left
+        if (!mProperty.get().empty()) {
+            ListenerRecorder recorder(mProperty);
+            set(&recorder, "");
+        }
+    }
+
+    // Sets the property and waits for the listener of recorder to be called with the value
+    void set(ListenerRecorder *recorder, const std::string &value) {
+        ASSERT_TRUE(SetProperty(kProperty, value));
+        ASSERT_TRUE(recorder->waitForValue(value)) << value;
+    }
+
+    const CachedProperty &mProperty = PropertyCache::instance().watch(kProperty);
+};
+
+TEST_F(PropertyCacheTest, UpdatesTheValueAndCallsTheListener) {
+    ListenerRecorder recorder(mProperty);
+
+    EXPECT_EQ(mProperty.get("unset"), "unset");
+    set(&recorder, "1");
+    EXPECT_EQ(mProperty.get("unset"), "1");
+
+    // Setting the same value bumps the serial only, the listener isn't called for it
+    ASSERT_TRUE(SetProperty(kProperty, "1"));
+    set(&recorder, "2");
+    std::vector<std::string> values = recorder.values();
+    ASSERT_GE(values.size(), 2);
+    EXPECT_EQ(values[values.size() - 2], "1");
+    EXPECT_EQ(mProperty.get(), "2");
+}
+
+TEST_F(PropertyCacheTest, ParsesBoolsLikeGetBoolProperty) {
+    ListenerRecorder recorder(mProperty);
+
+    // Each value set after another one, for the listener to be called
+    for (const char *value : {"1", "y", "yes", "on", "true"}) {
+        set(&recorder, "reset");
+        set(&recorder, value);
+        EXPECT_TRUE(mProperty.getBool(false)) << value;
+    }
+    for (const char *value : {"0", "n", "no", "off", "false"}) {
+        set(&recorder, "reset");
+        set(&recorder, value);
+        EXPECT_FALSE(mProperty.getBool(true)) << value;
+    }
+    for (const char *value : {"", "2", "enabled"}) {
+        set(&recorder, "reset");
+        set(&recorder, value);
+        EXPECT_TRUE(mProperty.getBool(true)) << value;
+        EXPECT_FALSE(mProperty.getBool(false)) << value;
+    }
+}
+
+TEST_F(PropertyCacheTest, StopsCallingRemovedListeners) {
+    ListenerRecorder removed(mProperty);
+    ListenerRecorder kept(mProperty);
+
+    set(&removed, "1");
+    ASSERT_TRUE(kept.waitForValue("1"));
+    removed.remove();
+    size_t calls = removed.values().size();
+
+    set(&kept, "2");
+    EXPECT_EQ(removed.values().size(), calls);
+}
+
+}  // namespace
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <android-base/unique_fd.h>
+#include <benchmark/benchmark.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Uevent.h"
+#include "UeventCorpus.h"
+
+namespace android {
+namespace hardware {
+namespace usb {
+namespace V1_2 {
+namespace implementation {
+namespace {
+
+using ::android::base::unique_fd;
+using namespace std::string_literals;
+
+// Size of the storm replayed, the uevents of a few seconds of package installs
+constexpr size_t kStormSize = 10000;
+
+/*
+ * Matching of the former uevent_event(): a regex built for every field,
+ * then the port change keys, stopping at the first port change.
+ */
+void BM_UeventRegexMatcher(benchmark::State &state) {
+    const std::vector<std::string> storm = ueventStorm(kStormSize);
+    char msg[UEVENT_MSG_LEN + 2];
+    unsigned long partners = 0;
+    unsigned long portChanges = 0;
+
+    for (auto _ : state) {
+        for (const std::string &uevent : storm) {
+            char *cp = msg;
+
+            memcpy(msg, uevent.data(), uevent.size());
+            msg[uevent.size()] = '\0';
+            msg[uevent.size() + 1] = '\0';
+            while (*cp) {
+                if (std::regex_match(cp, std::regex("(add)(.*)(-partner)"))) {
+                    partners++;
+                } else if (!strncmp(cp, "DEVTYPE=typec_", strlen("DEVTYPE=typec_")) ||
+                           !strncmp(cp, "POWER_SUPPLY_MOISTURE_DETECTED",
+                                    strlen("POWER_SUPPLY_MOISTURE_DETECTED"))) {
+                    portChanges++;
+                    break;
+                }
+                while (*cp++) {
+                }
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * storm.size());
+    state.counters["partners"] = partners / state.iterations();
+    state.counters["port_changes"] = portChanges / state.iterations();
+}
+BENCHMARK(BM_UeventRegexMatcher)->Unit(benchmark::kMillisecond);
+
+// Parsing and classification of uevent_event(), given the power supply of the port
+void BM_UeventRecordMatcher(benchmark::State &state) {
+    const std::vector<std::string> storm = ueventStorm(kStormSize);
+    unsigned long partners = 0;
+    unsigned long portChanges = 0;
+    unsigned long others = 0;
+
+    for (auto _ : state) {
+        for (const std::string &uevent : storm) {
+            UeventRecord record;
+
+            if (!UeventRecord::parse(uevent.data(), uevent.size(), &record))
+                continue;
+            if (record.isPartnerAdded()) {
+                benchmark::DoNotOptimize(record.typecPort());
+                partners++;
+            }
+            if (record.isPowerChange("usb") || record.isUsbDevice())
+                others++;
+            if (record.isPortChange()) {
+                benchmark::DoNotOptimize(record.typecPort());
+                portChanges++;
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * storm.size());
+    state.counters["partners"] = partners / state.iterations();
+    state.counters["port_changes"] = portChanges / state.iterations();
+    benchmark::DoNotOptimize(others);
+}
+BENCHMARK(BM_UeventRecordMatcher)->Unit(benchmark::kMillisecond);
+
+/*
+ * Wakeups of the worker thread while the storm is sent to its socket,
+ * through the socket filter when the argument is 1. The sender yields
+ * after each uevent, as the kernel paces them out of the device probes.
+ */
+void BM_UeventFloodWakeups(benchmark::State &state) {
+    const std::vector<std::string> storm = ueventStorm(kStormSize);
+    // Passed by the filter, tells the worker the storm is over
+    const std::string last = "change@/end\0ACTION=change\0DEVPATH=/end\0SUBSYSTEM=typec\0"s;
+    UeventBatch batch(false);
+    unsigned long wakeups = 0;
+    unsigned long received = 0;
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, fds)) {
+        state.SkipWithError("socketpair failed");
+        return;
+    }
+    unique_fd reader(fds[0]), writer(fds[1]);
+    unique_fd epollFd(epoll_create1(EPOLL_CLOEXEC));
+    struct epoll_event ev = {.events = EPOLLIN, .data = {.u32 = 0}};
+
+    fcntl(reader.get(), F_SETFL, O_NONBLOCK);
+    if (state.range(0) && !attachUeventFilter(reader.get())) {
+        state.SkipWithError("cannot attach the filter");
+        return;
+    }
+    epoll_ctl(epollFd.get(), EPOLL_CTL_ADD, reader.get(), &ev);
+
+    for (auto _ : state) {
+        std::thread sender([&] {
+            for (const std::string &uevent : storm) {
+                send(writer.get(), uevent.data(), uevent.size(), 0);
+                std::this_thread::yield();
+            }
+            send(writer.get(), last.data(), last.size(), 0);
+        });
+        bool done = false;
+
+        while (!done) {
+            bool lost = false;
+            bool pending;
+
+            if (epoll_wait(epollFd.get(), &ev, 1, -1) <= 0)
+                continue;
+            wakeups++;
+            do {
+                pending = batch.receive(reader.get(), &lost);
+                received += batch.size();
+                for (size_t i = 0; i < batch.size(); i++)
+                    done |= batch.records()[i].devPath == "/end";
+            } while (pending);
+        }
+        sender.join();
+    }
+    state.SetItemsProcessed(state.iterations() * storm.size());
+    state.counters["wakeups"] = wakeups / state.iterations();
+    state.counters["received"] = received / state.iterations();
+}
+BENCHMARK(BM_UeventFloodWakeups)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+}  // namespace
+}  // namespace implementation
+}  // namespace V1_2
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_USB_V1_2_UEVENTCORPUS_H
+#define ANDROID_HARDWARE_USB_V1_2_UEVENTCORPUS_H
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace usb {
+namespace V1_2 {
+namespace implementation {
+
+// Device paths of the board Type-C controller, USB host controller and charger
+#define CORPUS_TYPEC "/devices/platform/bus@f0000/f900000.dwc3-usb/typec"
+#define CORPUS_USB "/devices/platform/bus@f0000/f910000.dwc3-usb/31100000.usb/xhci-hcd.2.auto"
+#define CORPUS_SUPPLY "/devices/platform/bus@f0000/20000000.i2c/i2c-0/0-0022/power_supply"
+
+/*
+ * Uevent of an AM62x board, as "ACTION@DEVPATH\0KEY=VALUE\0...\0" without
+ * the SEQNUM key, which ueventStorm() appends. The power supply of the port
+ * is the default "usb" one.
+ */
+struct CannedUevent {
+    std::string message;
+    // From one of the subsystems the socket filter passes
+    bool accepted;
+};
+
+inline const std::vector<CannedUevent> &cannedUevents() {
+    using namespace std::string_literals;
+    static const std::vector<CannedUevent> uevents = {
+            {"add@" CORPUS_TYPEC "/port0/port0-partner\0ACTION=add\0"
+             "DEVPATH=" CORPUS_TYPEC "/port0/port0-partner\0SUBSYSTEM=typec\0"
+             "DEVTYPE=typec_partner\0"s,
+             true},
+            {"change@" CORPUS_TYPEC "/port0\0ACTION=change\0DEVPATH=" CORPUS_TYPEC "/port0\0"
+             "SUBSYSTEM=typec\0DEVTYPE=typec_port\0TYPEC_PORT=port0\0"s,
+             true},
+            {"remove@" CORPUS_TYPEC "/port0/port0-partner\0ACTION=remove\0"
+             "DEVPATH=" CORPUS_TYPEC "/port0/port0-partner\0SUBSYSTEM=typec\0"
+             "DEVTYPE=typec_partner\0"s,
+             true},
+            {"change@" CORPUS_SUPPLY "/usb\0ACTION=change\0"
+             "DEVPATH=" CORPUS_SUPPLY "/usb\0SUBSYSTEM=power_supply\0"
+             "POWER_SUPPLY_NAME=usb\0POWER_SUPPLY_TYPE=USB\0"
+             "POWER_SUPPLY_STATUS=Charging\0POWER_SUPPLY_CHARGE_TYPE=Fast\0"
+             "POWER_SUPPLY_HEALTH=Good\0POWER_SUPPLY_ONLINE=1\0POWER_SUPPLY_PRESENT=1\0"
+             "POWER_SUPPLY_USB_TYPE=C [PD] PD_PPS\0POWER_SUPPLY_CURRENT_MAX=3000000\0"
+             "POWER_SUPPLY_VOLTAGE_MAX=9000000\0POWER_SUPPLY_MOISTURE_DETECTED=0\0"s,
+             true},
+            {"change@/devices/platform/bus@f0000/20000000.i2c/i2c-0/0-0055/power_supply/"
+             "bq27xxx-battery\0ACTION=change\0DEVPATH=/devices/platform/bus@f0000/"
+             "20000000.i2c/i2c-0/0-0055/power_supply/bq27xxx-battery\0"
+             "SUBSYSTEM=power_supply\0POWER_SUPPLY_NAME=bq27xxx-battery\0"
+             "POWER_SUPPLY_STATUS=Discharging\0POWER_SUPPLY_CAPACITY=87\0"s,
+             true},
+            {"add@/devices/virtual/usb_power_delivery/pd0\0ACTION=add\0"
+             "DEVPATH=/devices/virtual/usb_power_delivery/pd0\0"
+             "SUBSYSTEM=usb_power_delivery\0"s,
+             true},
+            {"add@" CORPUS_USB "/usb1/1-1\0ACTION=add\0DEVPATH=" CORPUS_USB "/usb1/1-1\0"
+             "SUBSYSTEM=usb\0MAJOR=189\0MINOR=1\0DEVNAME=bus/usb/001/002\0"
+             "DEVTYPE=usb_device\0DRIVER=usb\0PRODUCT=781/5583/100\0TYPE=0/0/0\0"
+             "BUSNUM=001\0DEVNUM=002\0"s,
+             true},
+            {"add@" CORPUS_USB "/usb1/1-1/1-1:1.0\0ACTION=add\0"
+             "DEVPATH=" CORPUS_USB "/usb1/1-1/1-1:1.0\0SUBSYSTEM=usb\0"
+             "DEVTYPE=usb_interface\0PRODUCT=781/5583/100\0TYPE=0/0/0\0"
+             "INTERFACE=8/6/80\0MODALIAS=usb:v0781p5583d0100dc00dsc00dp00ic08isc06ip50in00\0"s,
+             true},
+            {"add@/devices/virtual/block/loop3\0ACTION=add\0"
+             "DEVPATH=/devices/virtual/block/loop3\0SUBSYSTEM=block\0MAJOR=7\0MINOR=3\0"
+             "DEVNAME=loop3\0DEVTYPE=disk\0DISKSEQ=12\0"s,
+             false},
+            {"change@/devices/virtual/block/dm-4\0ACTION=change\0"
+             "DEVPATH=/devices/virtual/block/dm-4\0SUBSYSTEM=block\0MAJOR=253\0MINOR=4\0"
+             "DEVNAME=dm-4\0DEVTYPE=disk\0DISKSEQ=20\0DM_COOKIE=4194304\0"s,
+             false},
+            {"add@/devices/virtual/net/rmnet_data0\0ACTION=add\0"
+             "DEVPATH=/devices/virtual/net/rmnet_data0\0SUBSYSTEM=net\0"
+             "INTERFACE=rmnet_data0\0IFINDEX=12\0"s,
+             false},
+            {"change@/devices/virtual/thermal/thermal_zone0\0ACTION=change\0"
+             "DEVPATH=/devices/virtual/thermal/thermal_zone0\0SUBSYSTEM=thermal\0"
+             "NAME=main0-thermal\0TEMP=52000\0TRIP=0\0EVENT=2\0"s,
+             false},
+            {"add@/devices/platform/bus@f0000/fa00000.mmc/mmc_host/mmc1/mmc1:aaaa\0"
+             "ACTION=add\0DEVPATH=/devices/platform/bus@f0000/fa00000.mmc/mmc_host/mmc1/"
+             "mmc1:aaaa\0SUBSYSTEM=mmc\0DRIVER=mmcblk\0MMC_TYPE=SD\0MMC_NAME=SC32G\0"
+             "MODALIAS=mmc:block\0"s,
+             false},
+            {"add@/module/zram\0ACTION=add\0DEVPATH=/module/zram\0SUBSYSTEM=module\0"s,
+             false},
+            {"change@/devices/virtual/misc/ashmem\0ACTION=change\0"
+             "DEVPATH=/devices/virtual/misc/ashmem\0SUBSYSTEM=misc\0MAJOR=10\0MINOR=59\0"
+             "DEVNAME=ashmem\0"s,
+             false},
+            {"add@/devices/virtual/input/input7/event7\0ACTION=add\0"
+             "DEVPATH=/devices/virtual/input/input7/event7\0SUBSYSTEM=input\0MAJOR=13\0"
+             "MINOR=71\0DEVNAME=input/event7\0"s,
+             false},
+            {"add@/devices/virtual/bdi/254:9\0ACTION=add\0DEVPATH=/devices/virtual/bdi/254:9\0"
+             "SUBSYSTEM=bdi\0"s,
+             false},
+    };
+    return uevents;
+}
+
+#undef CORPUS_TYPEC
+#undef CORPUS_USB
+#undef CORPUS_SUPPLY
+
+/*
+ * count uevents of a storm going through the canned ones, the uevents of
+ * other subsystems 4 times as often, as while apps install and mount their
+ * images: 1 in 5 only is for the HAL.
+ */
+inline std::vector<std::string> ueventStorm(size_t count) {
+    constexpr unsigned kOtherRepeats = 4;
+    std::vector<const CannedUevent *> round;
+    std::vector<std::string> storm;
+
+    for (unsigned i = 0; i < kOtherRepeats; i++) {
+        for (const CannedUevent &uevent : cannedUevents()) {
+            if (!uevent.accepted || i == 0)
+                round.push_back(&uevent);
+        }
+    }
+    storm.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        std::string message = round[i % round.size()]->message;
+
+        message.append("SEQNUM=").append(std::to_string(4096 + i)).push_back('\0');
+        storm.push_back(std::move(message));
+    }
+    return storm;
+}
+
+}  // namespace implementation
+}  // namespace V1_2
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_USB_V1_2_UEVENTCORPUS_H
@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <android-base/unique_fd.h>
+#include <gtest/gtest.h>
+#include <linux/netlink.h>
+#include <sys/socket.h>
+
+#include <string>
+#include <vector>
+
+#include "Uevent.h"
+#include "UeventCorpus.h"
+
+namespace android {
+namespace hardware {
+namespace usb {
+namespace V1_2 {
+namespace implementation {
+namespace {
+
+using ::android::base::unique_fd;
+using namespace std::string_literals;
+
+UeventRecord parse(const std::string &message) {
+    UeventRecord record;
+
+    EXPECT_TRUE(UeventRecord::parse(message.data(), message.size(), &record)) << message;
+    return record;
+}
+
+// Datagram socket pair standing in for the uevent socket, the HAL reading from the first end
+bool makeSocketPair(unique_fd *reader, unique_fd *writer) {
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds))
+        return false;
+    reader->reset(fds[0]);
+    writer->reset(fds[1]);
+    return true;
+}
+
+// Sends the messages through a filtered socket, returning those the filter passed
+std::vector<std::string> filter(const std::vector<std::string> &messages) {
+    unique_fd reader, writer;
+    std::vector<std::string> passed;
+    char buffer[UEVENT_MSG_LEN];
+    ssize_t len;
+
+    if (!makeSocketPair(&reader, &writer) || !attachUeventFilter(reader.get())) {
+        ADD_FAILURE() << "cannot set up a filtered socket";
+        return passed;
+    }
+    for (const std::string &message : messages)
+        EXPECT_EQ(send(writer.get(), message.data(), message.size(), 0), message.size());
+    while ((len = recv(reader.get(), buffer, sizeof(buffer), 0)) > 0)
+        passed.emplace_back(buffer, len);
+    return passed;
+}
+
+TEST(UeventRecordTest, ParsesCannedUevents) {
+    for (const CannedUevent &uevent : cannedUevents()) {
+        UeventRecord record = parse(uevent.message);
+        std::string header = uevent.message.c_str();
+
+        EXPECT_EQ(std::string(record.action) + "@" + std::string(record.devPath), header);
+        EXPECT_FALSE(record.subsystem.empty()) << header;
+        // The views point into the message
+        EXPECT_GE(record.subsystem.data(), uevent.message.data());
+        EXPECT_LT(record.subsystem.data(), uevent.message.data() + uevent.message.size());
+    }
+}
+
+TEST(UeventRecordTest, ClassifiesTypecUevents) {
+    const std::vector<CannedUevent> &uevents = cannedUevents();
+    UeventRecord partnerAdd = parse(uevents[0].message);
+    UeventRecord portChange = parse(uevents[1].message);
+    UeventRecord partnerRemove = parse(uevents[2].message);
+
+    EXPECT_EQ(partnerAdd.subsystem, "typec");
+    EXPECT_EQ(partnerAdd.devType, "typec_partner");
+    EXPECT_TRUE(partnerAdd.isPartnerAdded());
+    EXPECT_TRUE(partnerAdd.isPortChange());
+    EXPECT_EQ(partnerAdd.typecPort(), "port0");
+
+    EXPECT_FALSE(portChange.isPartnerAdded());
+    EXPECT_TRUE(portChange.isPortChange());
+    EXPECT_EQ(portChange.typecPort(), "port0");
+
+    EXPECT_EQ(partnerRemove.action, "remove");
+    EXPECT_FALSE(partnerRemove.isPartnerAdded());
+    EXPECT_TRUE(partnerRemove.isPortChange());
+}
+
+TEST(UeventRecordTest, ClassifiesOtherUevents) {
+    const std::vector<CannedUevent> &uevents = cannedUevents();
+    UeventRecord supply = parse(uevents[3].message);
+    UeventRecord battery = parse(uevents[4].message);
+    UeventRecord pd = parse(uevents[5].message);
+    UeventRecord device = parse(uevents[6].message);
+    UeventRecord interface = parse(uevents[7].message);
+    UeventRecord block = parse(uevents[8].message);
+
+    EXPECT_TRUE(supply.isPowerChange("usb"));
+    EXPECT_FALSE(supply.isPowerChange("sb"));
+    // Reports the moisture state, as the charger drivers do
+    EXPECT_TRUE(supply.moistureDetected);
+    EXPECT_TRUE(supply.isPortChange());
+    EXPECT_FALSE(battery.isPowerChange("usb"));
+    EXPECT_FALSE(battery.isPortChange());
+    EXPECT_TRUE(pd.isPowerChange("usb"));
+
+    EXPECT_TRUE(device.isUsbDevice());
+    EXPECT_EQ(device.devType, "usb_device");
+    EXPECT_FALSE(interface.isUsbDevice());
+
+    EXPECT_FALSE(block.isPartnerAdded());
+    EXPECT_FALSE(block.isPortChange());
+    EXPECT_FALSE(block.isPowerChange("usb"));
+    EXPECT_FALSE(block.isUsbDevice());
+    EXPECT_TRUE(block.typecPort().empty());
+}
+
+TEST(UeventRecordTest, RejectsOtherMessages) {
+    // udev rebroadcasts start with a binary header instead of "ACTION@DEVPATH"
+    const std::string udev = "libudev\0\xfe\xed\xca\xfe"s;
+    UeventRecord record;
+
+    EXPECT_FALSE(UeventRecord::parse(udev.data(), udev.size(), &record));
+    EXPECT_FALSE(UeventRecord::parse("", 0, &record));
+}
+
+TEST(UeventRecordTest, StopsAtTheMessageLength) {
+    // Without a final NUL, as truncated in a receive buffer
+    const std::string message = "change@/devices/a\0ACTION=change\0SUBSYSTEM=typec\0DEVTYPE=ty"s;
+    UeventRecord record = parse(message);
+
+    EXPECT_EQ(record.subsystem, "typec");
+    EXPECT_EQ(record.devType, "ty");
+    EXPECT_FALSE(record.isPortChange());
+}
+
+TEST(UeventFilterTest, PassesTheHandledSubsystems) {
+    std::vector<std::string> messages;
+    std::vector<std::string> accepted;
+
+    for (const CannedUevent &uevent : cannedUevents()) {
+        messages.push_back(uevent.message);
+        if (uevent.accepted)
+            accepted.push_back(uevent.message);
+    }
+    EXPECT_EQ(filter(messages), accepted);
+}
+
+TEST(UeventFilterTest, ComparesWholeSubsystemNames) {
+    const std::string usbmisc =
+        "add@/devices/virtual/usbmisc/hiddev0\0ACTION=add\0"
+        "DEVPATH=/devices/virtual/usbmisc/hiddev0\0SUBSYSTEM=usbmisc\0"s;
+    const std::string typecMux =
+        "add@/devices/virtual/typec_mux/mux0\0ACTION=add\0"
+        "DEVPATH=/devices/virtual/typec_mux/mux0\0SUBSYSTEM=typec_mux\0"s;
+
+    EXPECT_TRUE(filter({usbmisc, typecMux}).empty());
+}
+
+TEST(UeventFilterTest, PassesUnexpectedLayouts) {
+    // Header longer than the filter window
+    const std::string longPath = "/devices/virtual/block/" + std::string(128, 'a');
+    const std::string longHeader = "add@" + longPath + "\0ACTION=add\0DEVPATH="s + longPath +
+                                   "\0SUBSYSTEM=block\0"s;
+    // Another key before SUBSYSTEM
+    const std::string otherKey =
+        "add@/devices/virtual/block/loop0\0ACTION=add\0DEVPATH=/devices/virtual/block/loop0\0"
+        "SEQNUM=1\0SUBSYSTEM=block\0"s;
+    const std::vector<std::string> messages = {longHeader, otherKey};
+
+    EXPECT_EQ(filter(messages), messages);
+}
+
+TEST(UeventFilterTest, DropsMessagesShorterThanTheKey) {
+    // Loads past the end of a message abort the program, the HAL ignores these anyway
+    const std::string garbage = "garbage"s;
+    const std::string truncated = "add@/devices/a\0ACTION=add\0DEVPATH=/devices/a\0SUBSYS"s;
+
+    EXPECT_TRUE(filter({garbage, truncated}).empty());
+}
+
+// Uevents of the port named after i, e.g. a partner plugged into port<i>
+std::string portUevent(unsigned i) {
+    const std::string devPath = "/devices/platform/typec/port" + std::to_string(i);
+
+    return "change@" + devPath + "\0ACTION=change\0DEVPATH="s + devPath +
+           "\0SUBSYSTEM=typec\0DEVTYPE=typec_port\0"s;
+}
+
+TEST(UeventBatchTest, DrainsPendingUevents) {
+    constexpr unsigned kCount = 2 * UeventBatch::kSize + 8;
+    unique_fd reader, writer;
+    UeventBatch batch(false);
+    std::vector<std::string> received;
+    bool lost = false;
+    bool pending;
+
+    ASSERT_TRUE(makeSocketPair(&reader, &writer));
+    for (unsigned i = 0; i < kCount; i++) {
+        std::string uevent = portUevent(i);
+        ASSERT_EQ(send(writer.get(), uevent.data(), uevent.size(), 0), uevent.size());
+    }
+    do {
+        pending = batch.receive(reader.get(), &lost);
+        EXPECT_EQ(batch.size(), pending ? UeventBatch::kSize : kCount % UeventBatch::kSize);
+        for (size_t i = 0; i < batch.size(); i++)
+            received.emplace_back(batch.records()[i].typecPort());
+    } while (pending);
+
+    ASSERT_EQ(received.size(), kCount);
+    for (unsigned i = 0; i < kCount; i++)
+        EXPECT_EQ(received[i], "port" + std::to_string(i));
+    EXPECT_FALSE(lost);
+    // Nothing left
+    EXPECT_FALSE(batch.receive(reader.get(), &lost));
+    EXPECT_EQ(batch.size(), 0);
+}
+
+TEST(UeventBatchTest, DropsOverlongUevents) {
+    const std::string overlong = portUevent(1) + "KEY=" + std::string(UEVENT_MSG_LEN, 'a') + '\0';
+    unique_fd reader, writer;
+    UeventBatch batch(false);
+    bool lost = false;
+
+    ASSERT_TRUE(makeSocketPair(&reader, &writer));
+    for (const std::string &uevent : {portUevent(0), overlong, portUevent(2)})
+        ASSERT_EQ(send(writer.get(), uevent.data(), uevent.size(), 0), uevent.size());
+
+    EXPECT_FALSE(batch.receive(reader.get(), &lost));
+    EXPECT_TRUE(lost);
+    // The uevents around it are kept
+    ASSERT_EQ(batch.size(), 2);
+    EXPECT_EQ(batch.records()[0].typecPort(), "port0");
+    EXPECT_EQ(batch.records()[1].typecPort(), "port2");
+}
+
+/*
+ * Overruns the receive buffer of a netlink socket with multicast messages,
+ * as the kernel sends uevents: unlike socketpairs, netlink drops them and
+ * reports the overrun.
+ */
+TEST(UeventBatchTest, ReportsOverruns) {
+    constexpr unsigned kCount = 1000;
+    const int bufferSize = 4096;
+    unique_fd reader(socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                            NETLINK_USERSOCK));
+    unique_fd writer(socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                            NETLINK_USERSOCK));
+    struct sockaddr_nl group = {.nl_family = AF_NETLINK, .nl_pid = 0, .nl_groups = 1};
+    UeventBatch batch(false);
+    unsigned received = 0;
+    bool lost = false;
+    bool pending;
+
+    if (reader < 0 || writer < 0 ||
+        bind(reader.get(), reinterpret_cast<struct sockaddr *>(&group), sizeof(group)))
+        GTEST_SKIP() << "No multicast netlink socket: " << strerror(errno);
+    ASSERT_EQ(setsockopt(reader.get(), SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize)),
+              0);
+    for (unsigned i = 0; i < kCount; i++) {
+        std::string uevent = portUevent(i);
+
+        // Multicast, then refused as unicast: no kernel socket listens on NETLINK_USERSOCK
+        if (sendto(writer.get(), uevent.data(), uevent.size(), 0,
+                   reinterpret_cast<struct sockaddr *>(&group), sizeof(group)) == -1 &&
+            errno != ECONNREFUSED)
+            GTEST_SKIP() << "Cannot multicast netlink messages: " << strerror(errno);
+    }
+
+    do {
+        pending = batch.receive(reader.get(), &lost);
+        received += batch.size();
+    } while (pending);
+
+    EXPECT_TRUE(lost);
+    // The uevents queued before the overrun are still received
+    EXPECT_GT(received, 0);
+    EXPECT_LT(received, kCount);
+}
+
+}  // namespace
+}  // namespace implementation
+}  // namespace V1_2
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+
+#include "UsbTestUtils.h"
+
+namespace android {
+namespace hardware {
+namespace usb {
+namespace V1_2 {
+namespace implementation {
+namespace {
+
+using ::android::hardware::usb::V1_0::PortMode;
+using namespace std::chrono_literals;
+
+/*
+ * Time from switchRole() to the notification of its outcome, swapping the
+ * role of the argument type back and forth with a partner plugged. Data
+ * and power role swaps complete once the role nodes are written, port type
+ * switches once the partner comes back, after a swap delay of 20 ms.
+ * Unlike the kernel, the simulator updates the nodes after the write
+ * returns: each swap waits untimed for the port status to report the role,
+ * which takes the settle time of the HAL, hence the fixed iteration count.
+ */
+void BM_RoleSwapLatency(benchmark::State &state) {
+    const PortRoleType type = static_cast<PortRoleType>(state.range(0));
+    // The roles the partner plugged gives the port first, then the other ones
+    const uint32_t roles[3][2] = {
+            {static_cast<uint32_t>(PortDataRole::HOST),
+             static_cast<uint32_t>(PortDataRole::DEVICE)},
+            {static_cast<uint32_t>(PortPowerRole::SOURCE),
+             static_cast<uint32_t>(PortPowerRole::SINK)},
+            {static_cast<uint32_t>(PortMode::DFP), static_cast<uint32_t>(PortMode::UFP)}};
+    SimulatedUsb hal(1);
+    hal.start();
+    SimPartner partner;
+    unsigned long switches = 0;
+
+    partner.swapDelay = 20ms;
+    hal.sim.plug("port0", partner);
+    if (!hal.recorder->waitForPorts(1, PortMode_1_1::DFP)) {
+        state.SkipWithError("the partner wasn't notified");
+        return;
+    }
+
+    for (auto _ : state) {
+        PortRole role = {.type = type, .role = roles[state.range(0)][++switches % 2]};
+        auto start = std::chrono::steady_clock::now();
+
+        hal.usb->switchRole("port0", role);
+        if (!hal.recorder->waitForSwitch(switches)) {
+            state.SkipWithError("role switch failed");
+            break;
+        }
+        state.SetIterationTime(
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        if (!hal.recorder->waitForRole("port0", role)) {
+            state.SkipWithError("the role wasn't notified");
+            break;
+        }
+    }
+}
+BENCHMARK(BM_RoleSwapLatency)
+        ->ArgName("type")
+        ->Arg(static_cast<int64_t>(PortRoleType::DATA_ROLE))
+        ->Arg(static_cast<int64_t>(PortRoleType::POWER_ROLE))
+        ->Arg(static_cast<int64_t>(PortRoleType::MODE))
+        ->Iterations(50)
+        ->Unit(benchmark::kMillisecond)
+        ->UseManualTime();
+
+/*
+ * Time for a partner to be plugged into, then unplugged from, each of the
+ * argument ports, until the HAL notifies them all, which includes its
+ * settle time. Also counts the port status notifications, the uevents
+ * they coalesce, and the uevents the HAL didn't read in time.
+ */
+void BM_PlugStorm(benchmark::State &state) {
+    const unsigned ports = state.range(0);
+    SimulatedUsb hal(ports);
+    hal.start();
+    unsigned long statusCount, ueventCount, droppedCount;
+
+    if (!hal.recorder->waitForPorts(ports, PortMode_1_1::NONE)) {
+        state.SkipWithError("the ports weren't notified");
+        return;
+    }
+    statusCount = hal.recorder->statusCount();
+    ueventCount = hal.sim.ueventCount();
+    droppedCount = hal.sim.droppedUeventCount();
+
+    for (auto _ : state) {
+        for (unsigned i = 0; i < ports; i++)
+            hal.sim.plug(portName(i), SimPartner());
+        if (!hal.recorder->waitForPorts(ports, PortMode_1_1::DFP)) {
+            state.SkipWithError("the plugs weren't notified");
+            break;
+        }
+        for (unsigned i = 0; i < ports; i++)
+            hal.sim.unplug(portName(i));
+        if (!hal.recorder->waitForPorts(ports, PortMode_1_1::NONE)) {
+            state.SkipWithError("the unplugs weren't notified");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * ports * 2);
+    state.counters["notifications"] = benchmark::Counter(
+            hal.recorder->statusCount() - statusCount, benchmark::Counter::kAvgIterations);
+    state.counters["uevents"] = benchmark::Counter(hal.sim.ueventCount() - ueventCount,
+                                                   benchmark::Counter::kAvgIterations);
+    state.counters["dropped_uevents"] = hal.sim.droppedUeventCount() - droppedCount;
+}
+BENCHMARK(BM_PlugStorm)->ArgName("ports")->Arg(1)->Arg(4)->Unit(benchmark::kMillisecond)
+        ->UseRealTime();
+
+/*
+ * Registers the callback then unregisters it, as a client restarting does.
+ * The worker thread keeps running, and notifies the port status to the
+ * callback registered in the background.
+ */
+void BM_CallbackChurn(benchmark::State &state) {
+    SimulatedUsb hal(1);
+    hal.start();
+    unsigned long statusCount;
+
+    if (!hal.recorder->waitForPorts(1, PortMode_1_1::NONE)) {
+        state.SkipWithError("the port wasn't notified");
+        return;
+    }
+    statusCount = hal.recorder->statusCount();
+
+    for (auto _ : state) {
+        hal.usb->setCallback(hal.recorder);
+        hal.usb->setCallback(NULL);
+    }
+    state.counters["notifications"] = benchmark::Counter(
+            hal.recorder->statusCount() - statusCount, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_CallbackChurn)->UseRealTime();
+
+/*
+ * What the churn cost when setCallback() restarted the worker thread: the
+ * HAL created on the argument ports, its worker thread opening the kernel
+ * uevent socket and scanning the ports, the power contracts and the host
+ * links from sysfs, until the port status is notified, then stopped and
+ * joined. The removed path stopped the thread with a SIGUSR1 pthread_kill()
+ * instead of the control eventfd, and didn't create the eventfd nor the
+ * property listener the HAL creation adds.
+ */
+void BM_WorkerRestart(benchmark::State &state) {
+    const unsigned ports = state.range(0);
+    SimulatedUsb hal(ports);
+
+    for (auto _ : state) {
+        // The kernel uevent socket, as the HAL service opens it
+        sp<Usb> usb = new Usb(UsbEnvironment{hal.sim.root(), nullptr});
+        sp<CallbackRecorder> recorder = new CallbackRecorder();
+
+        usb->setCallback(recorder);
+        if (!recorder->waitForPorts(ports, PortMode_1_1::NONE)) {
+            state.SkipWithError("the ports weren't notified");
+            break;
+        }
+    }
+}
+BENCHMARK(BM_WorkerRestart)->ArgName("ports")->Arg(1)->Arg(4)->Unit(benchmark::kMicrosecond)
+        ->UseRealTime();
+
+}  // namespace
+}  // namespace implementation
+}  // namespace V1_2
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <android-base/properties.h>
+#include <gtest/gtest.h>
+#include <pthread.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "Uevent.h"
+#include "UsbTestUtils.h"
+
+namespace android {
+namespace hardware {
+namespace usb {
+namespace V1_2 {
+namespace implementation {
+namespace {
+
+using ::android::base::GetProperty;
+using ::android::base::SetProperty;
+using ::android::hardware::usb::V1_0::PortMode;
+using namespace std::chrono_literals;
+using namespace std::string_literals;
+
+// Longer than the time the HAL leaves the port status to settle after a uevent
+constexpr auto kSettled = 500ms;
+
+// The simulated port0, as the kernel names it in its uevents
+constexpr char kPortPath[] = "/devices/platform/typec-sim/typec/port0";
+
+// Forces the ports to be reported as legacy USB ports, rescanned on changes
+constexpr char kTypecLegacy[] = "vendor.typec.legacy";
+
+// The HAL on a simulated port, the uevents being sent by the test instead of the simulator
+class UsbUeventTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        ASSERT_TRUE(mHal.start(true));
+        ASSERT_TRUE(mHal.recorder->waitForMode("port0", PortMode_1_1::NONE));
+    }
+
+    // Sends the typec uevent of the port device at path, relative to port0
+    void sendTypecUevent(const std::string &action, const std::string &path,
+                         const std::string &devType) {
+        std::string devPath = kPortPath + path;
+
+        ASSERT_TRUE(mHal.sendUevent(action + "@" + devPath + "\0ACTION="s + action +
+                                    "\0DEVPATH="s + devPath + "\0SUBSYSTEM=typec\0DEVTYPE="s +
+                                    devType + "\0"s));
+    }
+
+    // Sends what the kernel sends for a PD partner plugged into port0
+    void sendPartnerBurst() {
+        sendTypecUevent("add", "/port0-partner", "typec_partner");
+        sendTypecUevent("change", "", "typec_port");
+        // Discovered once the partner is added
+        sendTypecUevent("change", "/port0-partner", "typec_partner");
+        sendTypecUevent("add", "/port0-partner/port0-partner.0", "typec_alternate_mode");
+        sendTypecUevent("add", "/port0-partner/port0-partner.1", "typec_alternate_mode");
+    }
+
+    unsigned long skipCount() {
+        pthread_mutex_lock(&mHal.usb->mLock);
+        unsigned long count = mHal.usb->mNotifySkipCount;
+        pthread_mutex_unlock(&mHal.usb->mLock);
+        return count;
+    }
+
+    SimulatedUsb mHal{1};
+};
+
+TEST_F(UsbUeventTest, ResyncsAfterAnOverlongUevent) {
+    // The simulator has no socket, its uevents are lost
+    mHal.sim.plug("port0", SimPartner());
+    ASSERT_GT(mHal.sim.droppedUeventCount(), 0);
+
+    ASSERT_TRUE(mHal.sendUevent(
+            "change@/devices/virtual/misc/a\0ACTION=change\0DEVPATH=/devices/virtual/misc/a\0"
+            "SUBSYSTEM=typec\0KEY="s +
+            std::string(UEVENT_MSG_LEN, 'a')));
+    // The partner is a sink, so the port becomes a source and a host
+    EXPECT_TRUE(mHal.recorder->waitForMode("port0", PortMode_1_1::DFP));
+}
+
+TEST_F(UsbUeventTest, NotifiesAPartnerBurstOnce) {
+    // The simulator has no socket, the test sends the uevents instead
+    mHal.sim.plug("port0", SimPartner());
+    unsigned long statusCount = mHal.recorder->statusCount();
+
+    sendPartnerBurst();
+    ASSERT_TRUE(mHal.recorder->waitForMode("port0", PortMode_1_1::DFP));
+    std::this_thread::sleep_for(kSettled);
+    EXPECT_EQ(mHal.recorder->statusCount() - statusCount, 1);
+}
+
+TEST_F(UsbUeventTest, SkipsIdenticalStatuses) {
+    mHal.sim.plug("port0", SimPartner());
+    sendPartnerBurst();
+    ASSERT_TRUE(mHal.recorder->waitForMode("port0", PortMode_1_1::DFP));
+    std::this_thread::sleep_for(kSettled);
+    unsigned long statusCount = mHal.recorder->statusCount();
+    unsigned long skipped = skipCount();
+
+    // Late alternate mode entries change nothing the port status tells
+    sendTypecUevent("change", "/port0-partner/port0-partner.0", "typec_alternate_mode");
+    std::this_thread::sleep_for(kSettled);
+    sendTypecUevent("change", "/port0-partner", "typec_partner");
+    std::this_thread::sleep_for(kSettled);
+    EXPECT_EQ(mHal.recorder->statusCount(), statusCount);
+    EXPECT_EQ(skipCount() - skipped, 2);
+
+    mHal.sim.unplug("port0");
+    sendTypecUevent("remove", "/port0-partner", "typec_partner");
+    EXPECT_TRUE(mHal.recorder->waitForMode("port0", PortMode_1_1::NONE));
+    EXPECT_EQ(mHal.recorder->statusCount() - statusCount, 1);
+}
+
+TEST_F(UsbUeventTest, RescansOnLegacyModeChanges) {
+    const std::string legacy = GetProperty(kTypecLegacy, "");
+    unsigned long statusCount = mHal.recorder->statusCount();
+
+    // Without any uevent, only a rescan finds the partner
+    mHal.sim.plug("port0", SimPartner());
+    ASSERT_TRUE(SetProperty(kTypecLegacy, "1"));
+    ASSERT_TRUE(mHal.recorder->waitForStatusCount(statusCount + 1));
+    ASSERT_TRUE(SetProperty(kTypecLegacy, "0"));
+    EXPECT_TRUE(mHal.recorder->waitForMode("port0", PortMode_1_1::DFP));
+    EXPECT_NE(mHal.eventLog().find("ports rescanned"), std::string::npos);
+    SetProperty(kTypecLegacy, legacy);
+}
+
+// The HAL on a simulated port0, switching roles with the partners the tests plug
+class UsbRoleSwitchTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        ASSERT_TRUE(mHal.start());
+        ASSERT_TRUE(mHal.recorder->waitForMode("port0", PortMode_1_1::NONE));
+    }
+
+    // Plugs partner into port0, a sink one making it a host
+    void plug(const SimPartner &partner) {
+        mHal.sim.plug("port0", partner);
+        ASSERT_TRUE(mHal.recorder->waitForMode(
+                "port0", partner.source ? PortMode_1_1::UFP : PortMode_1_1::DFP));
+    }
+
+    // Requests a switch of port0 and waits for its outcome, the time it took in duration
+    bool switchRole(const PortRole &role, Status expected,
+                    std::chrono::milliseconds *duration = nullptr) {
+        auto start = std::chrono::steady_clock::now();
+
+        mHal.usb->switchRole("port0", role);
+        bool notified = mHal.recorder->waitForSwitch(++mSwitches, expected);
+        if (duration)
+            *duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - start);
+        return notified;
+    }
+
+    SimulatedUsb mHal{1};
+    unsigned long mSwitches = 0;
+};
+
+constexpr PortRole kDevice = {.type = PortRoleType::DATA_ROLE,
+                              .role = static_cast<uint32_t>(PortDataRole::DEVICE)};
+constexpr PortRole kDfp = {.type = PortRoleType::MODE,
+                           .role = static_cast<uint32_t>(PortMode::DFP)};
+constexpr PortRole kUfp = {.type = PortRoleType::MODE,
+                           .role = static_cast<uint32_t>(PortMode::UFP)};
+
+// Shorter than any timeout, the preflight rejects don't wait for the partner
+constexpr auto kRejected = 1s;
+
+TEST_F(UsbRoleSwitchTest, RejectsSwitchesWithoutAPartner) {
+    std::chrono::milliseconds duration;
+
+    ASSERT_TRUE(switchRole(kUfp, Status::ERROR, &duration));
+    EXPECT_LT(duration, kRejected);
+    EXPECT_NE(mHal.eventLog().find("failed, no partner attached"), std::string::npos);
+}
+
+TEST_F(UsbRoleSwitchTest, RejectsSwapsWithoutPd) {
+    SimPartner partner;
+    std::chrono::milliseconds duration;
+
+    partner.supportsPD = false;
+    partner.swapDelay = 20ms;
+    plug(partner);
+
+    ASSERT_TRUE(switchRole(kDevice, Status::ERROR, &duration));
+    EXPECT_LT(duration, kRejected);
+    EXPECT_NE(mHal.eventLog().find("failed, the partner doesn't support USB PD"), std::string::npos);
+
+    // Port type switches don't need PD
+    EXPECT_TRUE(switchRole(kUfp, Status::SUCCESS));
+}
+
+TEST_F(UsbRoleSwitchTest, AdaptsTheTimeoutToThePartner) {
+    SimPartner partner;
+
+    partner.idHeader = 0x6c000000;
+    partner.product = 0x12345678;
+    partner.swapDelay = 20ms;
+    plug(partner);
+
+    // Unknown partners get the full timeout, known ones twice their longest switch, 2 s at least
+    ASSERT_TRUE(switchRole(kDfp, Status::SUCCESS));
+    ASSERT_TRUE(mHal.recorder->waitForMode("port0", PortMode_1_1::DFP));
+    ASSERT_TRUE(switchRole(kUfp, Status::SUCCESS));
+    std::string log = mHal.eventLog();
+    size_t first = log.find("started, timeout "s + std::to_string(PORT_TYPE_TIMEOUT * 1000) + "ms");
+    EXPECT_NE(first, std::string::npos);
+    EXPECT_NE(log.find("started, timeout 2000ms", first), std::string::npos);
+}
+
+TEST_F(UsbRoleSwitchTest, FailsFastAfterTimeouts) {
+    SimPartner partner;
+    std::chrono::milliseconds duration;
+
+    // A sink only partner, which never comes back once port0 is a sink too
+    partner.dualRole = false;
+    partner.idHeader = 0x6c000000;
+    partner.product = 0x12345678;
+    partner.swapDelay = 20ms;
+    plug(partner);
+    // Shortens the timeout to the 2 s minimum
+    ASSERT_TRUE(switchRole(kDfp, Status::SUCCESS));
+    ASSERT_TRUE(mHal.recorder->waitForMode("port0", PortMode_1_1::DFP));
+
+    for (int i = 0; i < 2; i++) {
+        ASSERT_TRUE(switchRole(kUfp, Status::ERROR, &duration));
+        EXPECT_GE(duration, 2s);
+        EXPECT_LT(duration, std::chrono::seconds(PORT_TYPE_TIMEOUT));
+        // Back to dual role, the partner attaches again
+        ASSERT_TRUE(mHal.recorder->waitForMode("port0", PortMode_1_1::DFP));
+    }
+
+    ASSERT_TRUE(switchRole(kUfp, Status::ERROR, &duration));
+    EXPECT_LT(duration, kRejected);
+    std::string log = mHal.eventLog();
+    EXPECT_NE(log.find("timed out, the partner didn't come back"), std::string::npos);
+    EXPECT_NE(log.find("failed, it failed 2 times in a row with this partner"), std::string::npos);
+
+    // Other partners aren't affected
+    mHal.sim.unplug("port0");
+    ASSERT_TRUE(mHal.recorder->waitForMode("port0", PortMode_1_1::NONE));
+    partner.dualRole = true;
+    partner.product = 0x87654321;
+    plug(partner);
+    EXPECT_TRUE(switchRole(kUfp, Status::SUCCESS));
+}
+
+}  // namespace
+}  // namespace implementation
+}  // namespace V1_2
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_USB_V1_2_USBTESTUTILS_H
+#define ANDROID_HARDWARE_USB_V1_2_USBTESTUTILS_H
+
+#include <android-base/file.h>
+#include <android-base/unique_fd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "TypecSimulator.h"
+#include "Usb.h"
+
+namespace android {
+namespace hardware {
+namespace usb {
+namespace V1_2 {
+namespace implementation {
+
+using ::vendor::ti::hardware::usb::V1_0::IUsbExtCallback;
+
+// Longest a role switch or a port status can take, the port type switch timeout
+constexpr auto kWaitTimeout = std::chrono::seconds(PORT_TYPE_TIMEOUT);
+
+// Records the notifications of the HAL, to be waited for
+class CallbackRecorder : public IUsbCallback {
+  public:
+    Return<void> notifyPortStatusChange(const hidl_vec<V1_0::PortStatus> & /*status*/,
+                                        Status /*retval*/) override {
+        return Void();
+    }
+    Return<void> notifyPortStatusChange_1_1(const hidl_vec<PortStatus_1_1> & /*status*/,
+                                            Status /*retval*/) override {
+        return Void();
+    }
+    Return<void> notifyPortStatusChange_1_2(const hidl_vec<PortStatus> &status,
+                                            Status retval) override {
+        std::lock_guard<std::mutex> lock(mLock);
+        if (retval == Status::SUCCESS)
+            mStatus = status;
+        mStatusCount++;
+        mNotified.notify_all();
+        return Void();
+    }
+    Return<void> notifyRoleSwitchStatus(const hidl_string & /*portName*/,
+                                        const PortRole & /*newRole*/, Status retval) override {
+        std::lock_guard<std::mutex> lock(mLock);
+        mSwitchStatus = retval;
+        mSwitchCount++;
+        mNotified.notify_all();
+        return Void();
+    }
+
+    // Waits for the count-th role switch outcome, false on timeout or another outcome
+    bool waitForSwitch(unsigned long count, Status expected = Status::SUCCESS) {
+        std::unique_lock<std::mutex> lock(mLock);
+
+        return mNotified.wait_for(lock, kWaitTimeout, [&] { return mSwitchCount >= count; }) &&
+               mSwitchStatus == expected;
+    }
+
+    // Waits for port to be notified in role
+    bool waitForRole(const std::string &port, const PortRole &role) {
+        return waitForStatus(port, [&role](const PortStatus_1_1 &status) {
+            switch (role.type) {
+                case PortRoleType::DATA_ROLE:
+                    return status.status.currentDataRole == static_cast<PortDataRole>(role.role);
+                case PortRoleType::POWER_ROLE:
+                    return status.status.currentPowerRole == static_cast<PortPowerRole>(role.role);
+                default:
+                    return status.currentMode == static_cast<PortMode_1_1>(role.role);
+            }
+        });
+    }
+
+    // Waits for port to be notified in mode
+    bool waitForMode(const std::string &port, PortMode_1_1 mode) {
+        return waitForStatus(port, [mode](const PortStatus_1_1 &status) {
+            return status.currentMode == mode;
+        });
+    }
+
+    // Waits for the ports to be all notified in mode
+    bool waitForPorts(size_t ports, PortMode_1_1 mode) {
+        std::unique_lock<std::mutex> lock(mLock);
+
+        return mNotified.wait_for(lock, kWaitTimeout, [&] {
+            size_t count = 0;
+
+            for (const PortStatus &status : mStatus) {
+                if (status.status_1_1.currentMode == mode)
+                    count++;
+            }
+            return count == ports;
+        });
+    }
+
+    // Port status notifications so far
+    unsigned long statusCount() {
+        std::lock_guard<std::mutex> lock(mLock);
+        return mStatusCount;
+    }
+
+    // Waits for count port status notifications so far, whatever their outcome
+    bool waitForStatusCount(unsigned long count) {
+        std::unique_lock<std::mutex> lock(mLock);
+
+        return mNotified.wait_for(lock, kWaitTimeout, [&] { return mStatusCount >= count; });
+    }
+
+    // Latest port status notified for port
+    bool getStatus(const std::string &port, PortStatus *status) {
+        std::lock_guard<std::mutex> lock(mLock);
+
+        for (const PortStatus &portStatus : mStatus) {
+            if (portStatus.status_1_1.status.portName == port) {
+                *status = portStatus;
+                return true;
+            }
+        }
+        return false;
+    }
+
+  private:
+    std::mutex mLock;
+    std::condition_variable mNotified;
+    hidl_vec<PortStatus> mStatus;
+    unsigned long mStatusCount = 0;
+    Status mSwitchStatus = Status::SUCCESS;
+    unsigned long mSwitchCount = 0;
+
+    template <typename Predicate>
+    bool waitForStatus(const std::string &port, Predicate predicate) {
+        std::unique_lock<std::mutex> lock(mLock);
+
+        return mNotified.wait_for(lock, kWaitTimeout, [&] {
+            for (const PortStatus &status : mStatus) {
+                if (status.status_1_1.status.portName == port)
+                    return predicate(status.status_1_1);
+            }
+            return false;
+        });
+    }
+};
+
+// Records the degraded links notified through IUsbExt, to be waited for
+class ExtCallbackRecorder : public IUsbExtCallback {
+  public:
+    Return<void> notifyLinkDegraded(const UsbDeviceLink &device,
+                                    uint32_t degradedCount) override {
+        std::lock_guard<std::mutex> lock(mLock);
+        mLinks.push_back(device);
+        mCounts.push_back(degradedCount);
+        mNotified.notify_all();
+        return Void();
+    }
+
+    bool waitForLinks(size_t count) {
+        std::unique_lock<std::mutex> lock(mLock);
+        return mNotified.wait_for(lock, kWaitTimeout, [&] { return mLinks.size() >= count; });
+    }
+
+    std::mutex mLock;
+    std::condition_variable mNotified;
+    std::vector<UsbDeviceLink> mLinks;
+    std::vector<uint32_t> mCounts;
+};
+
+inline std::string portName(unsigned i) {
+    return "port" + std::to_string(i);
+}
+
+/*
+ * The HAL running on the simulated ports port0 to port<ports - 1>, once
+ * started. Its uevents come from the simulator, or only from sendUevent()
+ * for the tests which lose or forge some.
+ */
+struct SimulatedUsb {
+    explicit SimulatedUsb(unsigned ports) : sim(root.path) {
+        for (unsigned i = 0; i < ports; i++)
+            sim.addPort(portName(i));
+    }
+
+    // Creates the HAL and registers the recorder, false if the uevent socket can't be created
+    bool start(bool testUevents = false) {
+        if (testUevents) {
+            int fds[2];
+
+            if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, fds))
+                return false;
+            ueventWriter.reset(fds[1]);
+            usb = new Usb(UsbEnvironment{sim.root(), [fds] { return fds[0]; }});
+        } else {
+            usb = new Usb(UsbEnvironment{sim.root(), [this] { return sim.openUeventSocket(); }});
+        }
+        recorder = new CallbackRecorder();
+        usb->setCallback(recorder);
+        return true;
+    }
+
+    bool sendUevent(const std::string &uevent) {
+        return send(ueventWriter.get(), uevent.data(), uevent.size(), 0) ==
+               static_cast<ssize_t>(uevent.size());
+    }
+
+    // The events the HAL logged, as debug() prints them
+    std::string eventLog() {
+        int fds[2];
+        std::string log;
+
+        if (pipe(fds))
+            return log;
+        unique_fd reader(fds[0]);
+        // Far less than a pipe holds
+        usb->mEventLog.dump(fds[1]);
+        close(fds[1]);
+        ::android::base::ReadFdToString(reader, &log);
+        return log;
+    }
+
+    TemporaryDir root;
+    TypecSimulator sim;
+    unique_fd ueventWriter;
+    // Destroyed before the simulator its worker thread reads
+    sp<Usb> usb;
+    sp<CallbackRecorder> recorder;
+};
+
+}  // namespace implementation
+}  // namespace V1_2
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_USB_V1_2_USBTESTUTILS_H